@@ -0,0 +1,294 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "CanvasView.h"
+
+#include "ImageModel.h"
+#include "ViewMonitor.h"
+#include "UndoHandler.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QScrollBar>
+#include <QStatusTipEvent>
+#include <QCoreApplication>
+#include <QMenu>
+
+// codels per side of a painted tile
+static const int TileSize = 64;
+// below this pixel size the grid would hide the codels
+static const int MinGridSize = 4;
+
+CanvasView::CanvasView( QWidget* parent ) : QAbstractScrollArea( parent ), mModel( 0 ), mMonitor( 0 ), mUndoHandler( 0 ), mContextMenu( 0 ), mContextCodel( -1, -1 ), mPixelSize( 1 ), mShowGrid( true ), mHoverCodel( -1, -1 )
+{
+    viewport()->setMouseTracking( true ); // for the status tips
+    viewport()->setAttribute( Qt::WA_OpaquePaintEvent );
+}
+
+CanvasView::~CanvasView()
+{
+}
+
+void CanvasView::setModel( ImageModel* model )
+{
+    if ( mModel )
+        disconnect( mModel, 0, this, 0 );
+    mModel = model;
+    if ( mModel ) {
+        connect( mModel, SIGNAL( modelReset() ), this, SLOT( slotModelReset() ) );
+        connect( mModel, SIGNAL( layoutChanged() ), this, SLOT( slotModelReset() ) );
+        connect( mModel, SIGNAL( dataChanged( QModelIndex, QModelIndex ) ), this, SLOT( slotDataChanged( QModelIndex, QModelIndex ) ) );
+    }
+    slotModelReset();
+}
+
+void CanvasView::setMonitor( ViewMonitor* monitor )
+{
+    mMonitor = monitor;
+}
+
+void CanvasView::setUndoHandler( UndoHandler* handler )
+{
+    mUndoHandler = handler;
+}
+
+void CanvasView::setContextMenu( QMenu* menu )
+{
+    mContextMenu = menu;
+}
+
+int CanvasView::pixelSize() const
+{
+    return mPixelSize;
+}
+
+bool CanvasView::showGrid() const
+{
+    return mShowGrid;
+}
+
+void CanvasView::setPixelSize( int size )
+{
+    size = qMax( 1, size );
+    if ( size == mPixelSize )
+        return;
+
+    // keep the codel in the middle of the viewport where it is
+    QPointF center( horizontalScrollBar()->value() + viewport()->width() / 2.0,
+                    verticalScrollBar()->value() + viewport()->height() / 2.0 );
+    center /= mPixelSize;
+
+    mPixelSize = size;
+    updateScrollBars();
+    horizontalScrollBar()->setValue( qRound( center.x() * size - viewport()->width() / 2.0 ) );
+    verticalScrollBar()->setValue( qRound( center.y() * size - viewport()->height() / 2.0 ) );
+    viewport()->update();
+}
+
+void CanvasView::setShowGrid( bool show )
+{
+    mShowGrid = show;
+    viewport()->update();
+}
+
+QPoint CanvasView::codelAt( const QPoint& pos ) const
+{
+    if ( !mModel )
+        return QPoint( -1, -1 );
+    int x = pos.x() + horizontalScrollBar()->value();
+    int y = pos.y() + verticalScrollBar()->value();
+    if ( x < 0 || y < 0 )
+        return QPoint( -1, -1 );
+
+    QPoint codel( x / mPixelSize, y / mPixelSize );
+    const QSize size = mModel->imageSize();
+    if ( codel.x() >= size.width() || codel.y() >= size.height() )
+        return QPoint( -1, -1 );
+    return codel;
+}
+
+QRect CanvasView::codelRect( int x, int y ) const
+{
+    return QRect( x * mPixelSize - horizontalScrollBar()->value(),
+                  y * mPixelSize - verticalScrollBar()->value(),
+                  mPixelSize, mPixelSize );
+}
+
+QPoint CanvasView::contextCodel() const
+{
+    return mContextCodel;
+}
+
+void CanvasView::paintEvent( QPaintEvent* event )
+{
+    QPainter painter( viewport() );
+    painter.fillRect( event->rect(), palette().dark() );
+    if ( !mModel )
+        return;
+
+    const QImage image = mModel->image();
+    const QPoint offset( horizontalScrollBar()->value(), verticalScrollBar()->value() );
+
+    // the codels under the exposed rectangle
+    const QRect exposed = event->rect().translated( offset );
+    const QRect codels = QRect( QPoint( exposed.left() / mPixelSize, exposed.top() / mPixelSize ),
+                                QPoint( exposed.right() / mPixelSize, exposed.bottom() / mPixelSize ) ) & image.rect();
+    if ( codels.isEmpty() )
+        return;
+
+    for ( int ty = codels.top() / TileSize; ty <= codels.bottom() / TileSize; ++ty ) {
+        for ( int tx = codels.left() / TileSize; tx <= codels.right() / TileSize; ++tx ) {
+            QRect tile = QRect( tx * TileSize, ty * TileSize, TileSize, TileSize ) & codels;
+            QRect target( tile.topLeft() * mPixelSize - offset, tile.size() * mPixelSize );
+            if ( event->region().intersects( target ) )
+                painter.drawImage( target, image, tile );
+        }
+    }
+
+    if ( mShowGrid && mPixelSize >= MinGridSize ) {
+        painter.setPen( palette().color( QPalette::Window ) );
+        const int left = codels.left() * mPixelSize - offset.x();
+        const int top = codels.top() * mPixelSize - offset.y();
+        const int right = ( codels.right() + 1 ) * mPixelSize - offset.x();
+        const int bottom = ( codels.bottom() + 1 ) * mPixelSize - offset.y();
+        for ( int x = left; x <= right; x += mPixelSize )
+            painter.drawLine( x, top, x, bottom );
+        for ( int y = top; y <= bottom; y += mPixelSize )
+            painter.drawLine( left, y, right, y );
+    }
+
+    painter.setRenderHint( QPainter::Antialiasing );
+    painter.setPen( Qt::NoPen );
+    painter.setBrush( Qt::red );
+    foreach( const QPoint& codel, mModel->breakpoints() ) {
+        if ( codels.contains( codel ) ) {
+            const QRect rect = codelRect( codel.x(), codel.y() );
+            const int size = qMax( 2, mPixelSize / 2 );
+            painter.drawEllipse( QRect( 0, 0, size, size ).translated( rect.center() - QPoint( size / 2, size / 2 ) ) );
+        }
+    }
+    painter.setRenderHint( QPainter::Antialiasing, false );
+
+    const QPoint debugged = mModel->debuggedPixel();
+    if ( codels.contains( debugged ) ) {
+        QPen pen( Qt::black );
+        pen.setWidth( 2 );
+        painter.setPen( pen );
+        painter.setBrush( Qt::NoBrush );
+        painter.drawRect( codelRect( debugged.x(), debugged.y() ).adjusted( 1, 1, -1, -1 ) );
+    }
+}
+
+void CanvasView::resizeEvent( QResizeEvent* event )
+{
+    QAbstractScrollArea::resizeEvent( event );
+    updateScrollBars();
+}
+
+void CanvasView::scrollContentsBy( int dx, int dy )
+{
+    // move what is already painted, only the uncovered strip is new
+    viewport()->scroll( dx, dy );
+}
+
+void CanvasView::mousePressEvent( QMouseEvent* event )
+{
+    const QPoint codel = codelAt( event->pos() );
+    if ( codel.x() < 0 )
+        return;
+
+    if ( event->button() == Qt::LeftButton ) {
+        editCodel( codel, false );
+    } else if ( event->button() == Qt::RightButton ) {
+        if ( event->modifiers() == Qt::NoModifier && mContextMenu ) {
+            mContextCodel = codel;
+            mContextMenu->popup( event->globalPos() );
+        } else if ( event->modifiers() == Qt::ControlModifier && mMonitor ) {
+            mMonitor->setCurrentColor( QColor( mModel->image().pixel( codel ) ) );
+        }
+    }
+}
+
+void CanvasView::mouseMoveEvent( QMouseEvent* event )
+{
+    const QPoint codel = codelAt( event->pos() );
+    if ( codel == mHoverCodel )
+        return;
+    setHoverCodel( codel );
+
+    if ( ( event->buttons() & Qt::LeftButton ) && codel.x() >= 0 )
+        editCodel( codel, true );
+}
+
+void CanvasView::leaveEvent( QEvent* event )
+{
+    Q_UNUSED( event )
+    setHoverCodel( QPoint( -1, -1 ) );
+}
+
+void CanvasView::slotModelReset()
+{
+    updateScrollBars();
+    viewport()->update();
+}
+
+void CanvasView::slotDataChanged( const QModelIndex& topLeft, const QModelIndex& bottomRight )
+{
+    if ( !topLeft.isValid() || !bottomRight.isValid() ) {
+        viewport()->update();
+        return;
+    }
+    QRect rect = codelRect( topLeft.column(), topLeft.row() ) | codelRect( bottomRight.column(), bottomRight.row() );
+    viewport()->update( rect );
+}
+
+void CanvasView::updateScrollBars()
+{
+    const QSize size = mModel ? mModel->imageSize() * mPixelSize : QSize( 0, 0 );
+    const QSize view = viewport()->size();
+
+    horizontalScrollBar()->setRange( 0, qMax( 0, size.width() - view.width() ) );
+    horizontalScrollBar()->setPageStep( view.width() );
+    horizontalScrollBar()->setSingleStep( mPixelSize );
+    verticalScrollBar()->setRange( 0, qMax( 0, size.height() - view.height() ) );
+    verticalScrollBar()->setPageStep( view.height() );
+    verticalScrollBar()->setSingleStep( mPixelSize );
+}
+
+void CanvasView::editCodel( const QPoint& codel, bool merge )
+{
+    if ( !mUndoHandler || !mMonitor )
+        return;
+    mUndoHandler->createEditPixel( codel.x(), codel.y(), mMonitor->currentColor(), merge );
+    emit imageEdited();
+}
+
+void CanvasView::setHoverCodel( const QPoint& codel )
+{
+    mHoverCodel = codel;
+
+    QString tip;
+    if ( mModel && codel.x() >= 0 )
+        tip = mModel->data( mModel->index( codel.y(), codel.x() ), Qt::StatusTipRole ).toString();
+    QStatusTipEvent event( tip );
+    QCoreApplication::sendEvent( this, &event );
+}
+
+#include "CanvasView.moc"
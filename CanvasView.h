@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef CANVASVIEW_H
+#define CANVASVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QModelIndex>
+
+class ImageModel;
+class ViewMonitor;
+class UndoHandler;
+class QMenu;
+
+/**
+  * Shows and edits the program of an ImageModel. The visible part is
+  * painted tile by tile straight from the image, scaled by the pixel
+  * size, so the cost of a repaint depends on the viewport and not on
+  * the size of the program.
+  */
+class CanvasView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit CanvasView( QWidget* parent = 0 );
+    virtual ~CanvasView();
+
+    void setModel( ImageModel* model );
+    void setMonitor( ViewMonitor* monitor );
+    void setUndoHandler( UndoHandler* handler );
+    void setContextMenu( QMenu* menu );
+
+    int pixelSize() const;
+    bool showGrid() const;
+
+    /** the codel at a viewport position, (-1, -1) if there is none */
+    QPoint codelAt( const QPoint& pos ) const;
+    /** the viewport rectangle of a codel */
+    QRect codelRect( int x, int y ) const;
+    /** the codel the context menu was opened on */
+    QPoint contextCodel() const;
+
+signals:
+    void imageEdited();
+
+public slots:
+    void setPixelSize( int size );
+    void setShowGrid( bool show );
+
+protected:
+    void paintEvent( QPaintEvent* event );
+    void resizeEvent( QResizeEvent* event );
+    void scrollContentsBy( int dx, int dy );
+    void mousePressEvent( QMouseEvent* event );
+    void mouseMoveEvent( QMouseEvent* event );
+    void leaveEvent( QEvent* event );
+
+private slots:
+    void slotModelReset();
+    void slotDataChanged( const QModelIndex& topLeft, const QModelIndex& bottomRight );
+
+private:
+    void updateScrollBars();
+    void editCodel( const QPoint& codel, bool merge );
+    void setHoverCodel( const QPoint& codel );
+
+    ImageModel* mModel;
+    ViewMonitor* mMonitor;
+    UndoHandler* mUndoHandler;
+    QMenu* mContextMenu;
+    QPoint mContextCodel;
+
+    int mPixelSize;
+    bool mShowGrid;
+    QPoint mHoverCodel;
+};
+
+#endif // CANVASVIEW_H
@@ -26,14 +26,42 @@ extern "C"
 
 #include "ImageModel.h"
 #include "CommandImpl.h"
+#include "TraceRing.h"
 
+#include <QTimer>
+#include <QAction>
 #include <QDebug>
 
-DebugWidget::DebugWidget( ImageModel* model, QWidget* parent, Qt::WindowFlags f ): QWidget( parent, f ), mImageModel( model )
+// the widgets are not updated faster than the screen refreshes
+static const int FrameInterval = 16;
+// more deltas than this in a frame and it is cheaper to refill the stacks
+static const int MaxDeltas = 64;
+
+DebugWidget::DebugWidget( ImageModel* model, QWidget* parent, Qt::WindowFlags f ): QWidget( parent, f ), mImageModel( model ), mTraceRing( 0 ), mStepPending( false ), mActionPending( false ), mJumpPending( false ), mUpdatingScrubber( false ), mDeltasDropped( false ), mHaveLastDelta( false )
 {
     setupUi( this );
     mFlowCompass = new FlowCompass( this->mCompassBox );
     mCompassBox->layout()->addWidget( mFlowCompass );
+
+    mFrameTimer = new QTimer( this );
+    mFrameTimer->setSingleShot( true );
+    connect( mFrameTimer, SIGNAL( timeout() ), this, SLOT( present() ) );
+    connect( mScrubber, SIGNAL( valueChanged( int ) ), this, SLOT( slotScrubbed( int ) ) );
+
+    mBeforeModel = new StackModel( this );
+    mAfterModel = new StackModel( this );
+    mBeforeStack->setModel( mBeforeModel );
+    mAfterStack->setModel( mAfterModel );
+
+    QAction* topOnly = new QAction( tr( "Show only the top values" ), this );
+    topOnly->setCheckable( true );
+    connect( topOnly, SIGNAL( toggled( bool ) ), this, SLOT( slotShowTopOnly( bool ) ) );
+    QListView* views[] = { mBeforeStack, mAfterStack };
+    for ( int i = 0; i < 2; ++i ) {
+        views[i]->setUniformItemSizes( true );
+        views[i]->setContextMenuPolicy( Qt::ActionsContextMenu );
+        views[i]->addAction( topOnly );
+    }
 }
 
 DebugWidget::~DebugWidget()
@@ -41,12 +69,20 @@ DebugWidget::~DebugWidget()
 
 }
 
+void DebugWidget::setTraceRing( TraceRing* ring )
+{
+    mTraceRing = ring;
+}
+
 void DebugWidget::slotDebugStopped()
 {
+    mFrameTimer->stop();
+    mStepPending = mActionPending = mJumpPending = false;
     mImageModel->setDebuggedPixel( -1, -1 );
+    slotHistoryChanged( 0, 0 );
+    mScrubber->setEnabled( false );
     changeCurrent( 1 );
-    mBeforeStack->clear();
-    mAfterStack->clear();
+    clearStacks();
     mValueLabel->setText( "" );
     mActionLabel->setText( "" );
 }
@@ -57,9 +93,31 @@ void DebugWidget::slotDebugStarted()
     mValueLabel->setText( "" );
     mCoordinate->setText( "Before first instruction" );
     mFlowCompass->reset();
+    mStack.clear();
+    clearStacks();
+    mFrameTimer->stop();
+    mStepPending = mActionPending = mJumpPending = false;
+    mLastFrame = QTime();
+    slotHistoryChanged( 0, 0 );
+    mScrubber->setEnabled( true );
     changeCurrent( 0 );
 }
 
+void DebugWidget::slotHistoryChanged( int firstStep, int lastStep )
+{
+    mUpdatingScrubber = true;
+    mScrubber->setRange( firstStep, lastStep );
+    mUpdatingScrubber = false;
+    mStepCount->setText( QString( "/ %1" ).arg( lastStep ) );
+}
+
+void DebugWidget::slotScrubbed( int step )
+{
+    mStepNumber->setText( QString::number( step ) );
+    if ( !mUpdatingScrubber )
+        emit goToStep( step );
+}
+
 void DebugWidget::changeCurrent( int idx )
 {
     mStackedWidget->currentWidget()->setSizePolicy( QSizePolicy::Ignored, QSizePolicy::Ignored );
@@ -69,57 +127,134 @@ void DebugWidget::changeCurrent( int idx )
 }
 
 
-void DebugWidget::slotActionChanged( trace_action* action )
+void DebugWidget::slotTraceReady()
+{
+    if ( !mTraceRing )
+        return;
+
+    // every action moves the stack along, only the newest is shown
+    TraceEvent event;
+    mTraceRing->beginDrain();
+    while ( mTraceRing->pop( event ) ) {
+        if ( event.type == TraceEvent::Step ) {
+            mPendingStep = event;
+            mStepPending = true;
+        } else if ( event.type == TraceEvent::Jump ) {
+            // what came before does not count any more
+            mJumpStack = mTraceRing->snapshot();
+            mStack.setStack( mJumpStack );
+            mPendingDeltas.clear();
+            mDeltasDropped = false;
+            mJumpPending = true;
+            mActionPending = false;
+            mPendingStep = event;
+            mStepPending = true;
+        } else {
+            mStack.apply( event.delta );
+            if ( mPendingDeltas.size() < MaxDeltas )
+                mPendingDeltas.append( event.delta );
+            else
+                mDeltasDropped = true;
+            mPendingAction = event;
+            mActionPending = true;
+        }
+    }
+
+    // a single step is shown right away, a running program once a frame
+    if ( mFrameTimer->isActive() || !( mStepPending || mActionPending || mJumpPending ) )
+        return;
+    const int since = mLastFrame.isNull() ? FrameInterval : mLastFrame.elapsed();
+    if ( since >= FrameInterval || since < 0 )
+        present();
+    else
+        mFrameTimer->start( FrameInterval - since );
+}
+
+void DebugWidget::present()
 {
-    mActionLabel->setText( command( action->light_change, action->hue_change ).name );
-    mAfterStack->clear();
-    for ( int i = 0; i < action->after_num; i++ ) {
-        QListWidgetItem *item = new QListWidgetItem( mAfterStack );
-        int val = action->after_stack[action->after_num - i - 1];
-        QString character;
-        if ( val >= 32 && val <= 126 )
-            character = QString( "(char: '%1')" ).arg( ( char ) val );
-        QString value = QString( "%1 %2" ).arg( val ).arg( character );
-        item->setText( value );
-        mAfterStack->addItem( item );
+    mLastFrame.start();
+    if ( mJumpPending ) {
+        mActionLabel->setText( "" );
+        mBeforeModel->setStack( mJumpStack );
+        mAfterModel->setStack( mJumpStack );
+        mHaveLastDelta = false;
     }
+    if ( mActionPending )
+        showAction( mPendingAction );
+    if ( mStepPending )
+        showStep( mPendingStep );
+    mStepPending = mActionPending = mJumpPending = false;
+}
+
+void DebugWidget::clearStacks()
+{
+    mBeforeModel->clear();
+    mAfterModel->clear();
+    mPendingDeltas.clear();
+    mDeltasDropped = false;
+    mHaveLastDelta = false;
+}
+
+void DebugWidget::slotShowTopOnly( bool top )
+{
+    StackModel::Mode mode = top ? StackModel::TopOfStack : StackModel::FullStack;
+    mBeforeModel->setMode( mode );
+    mAfterModel->setMode( mode );
+}
 
-    mBeforeStack->clear();
-    for ( int i = 0; i < action->before_num; i++ ) {
-        QListWidgetItem *item = new QListWidgetItem( mBeforeStack );
-        int val = action->before_stack[action->before_num - i - 1];
-        QString character;
-        if ( val >= 32 && val <= 126 )
-            character = QString( "(char: '%1')" ).arg( ( char ) val );
-        QString value = QString( "%1 %2" ).arg( val ).arg( character );
-        item->setText( value );
-        mBeforeStack->addItem( item );
+void DebugWidget::showAction( const TraceEvent &action )
+{
+    mActionLabel->setText( command( action.lightChange, action.hueChange ).name );
+
+    if ( mDeltasDropped ) {
+        mAfterModel->setStack( mStack.after() );
+        mBeforeModel->setStack( mStack.before() );
+        mLastDelta = action.delta;
+        mHaveLastDelta = true;
+    } else {
+        // the before stack is always one action behind
+        foreach( const stack_delta& delta, mPendingDeltas ) {
+            if ( mHaveLastDelta )
+                mBeforeModel->apply( mLastDelta );
+            mAfterModel->apply( delta );
+            mLastDelta = delta;
+            mHaveLastDelta = true;
+        }
     }
+    mPendingDeltas.clear();
+    mDeltasDropped = false;
 }
 
-void DebugWidget::slotStepped( trace_step* step )
+void DebugWidget::showStep( const TraceEvent &step )
 {
-    mCoordinate->setText( QString( "%1,%2" ).arg( step->n_xpos ).arg( step->n_ypos ) );
-    mImageModel->setDebuggedPixel( step->n_xpos, step->n_ypos );
-    quint64 connected = mImageModel->data( mImageModel->index( step->n_ypos, step->n_xpos ), ImageModel::ContiguousBlocksRole ).toInt();
+    mCoordinate->setText( QString( "%1,%2" ).arg( step.xpos ).arg( step.ypos ) );
+    // the scrubber is left alone while it is dragged
+    if ( !mScrubber->isSliderDown() ) {
+        mUpdatingScrubber = true;
+        mScrubber->setMaximum( qMax( mScrubber->maximum(), step.executionStep + 1 ) );
+        mScrubber->setValue( step.executionStep + 1 );
+        mUpdatingScrubber = false;
+    }
+    mImageModel->setDebuggedPixel( step.xpos, step.ypos );
+    quint64 connected = mImageModel->data( mImageModel->index( step.ypos, step.xpos ), ImageModel::ContiguousBlocksRole ).toInt();
     QString character;
     if ( connected >= 32 && connected <= 126 )
         character = QString( "(char: '%1')" ).arg( ( char ) connected );
     QString value = QString( "%1 %2" ).arg( connected ).arg( character );
     mValueLabel->setText( value );
 
-    if( step->n_dp == 'l' )
+    if( step.dp == 'l' )
         mFlowCompass->setDPDirection( FlowCompass::Left );
-    else if( step->n_dp == 'r' )
+    else if( step.dp == 'r' )
         mFlowCompass->setDPDirection( FlowCompass::Right );
-    else if( step->n_dp == 'u' )
+    else if( step.dp == 'u' )
         mFlowCompass->setDPDirection( FlowCompass::Up );
-    else if( step->n_dp == 'd' )
+    else if( step.dp == 'd' )
         mFlowCompass->setDPDirection( FlowCompass::Down);
 
-    if( step->n_cc == 'l' )
+    if( step.cc == 'l' )
         mFlowCompass->setCCDirection( FlowCompass::Left );
-    else if( step->n_cc == 'r' )
+    else if( step.cc == 'r' )
         mFlowCompass->setCCDirection( FlowCompass::Right );
 }
 
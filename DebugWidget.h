@@ -23,11 +23,14 @@
 #include "ui_DebugWidget.h"
 #include "Command.h"
 #include "FlowCompass.h"
+#include "StackMirror.h"
+#include "StackModel.h"
+#include "TraceRing.h"
 
 #include <QWidget>
+#include <QTime>
 
-struct trace_step;
-struct trace_action;
+class QTimer;
 class ImageModel;
 class DebugWidget : public QWidget, public Ui_DebugUi
 {
@@ -36,17 +39,60 @@ public:
     DebugWidget( ImageModel* model, QWidget* parent = 0, Qt::WindowFlags f = 0 );
     virtual ~DebugWidget();
 
+    void setTraceRing( TraceRing* ring );
+
 public slots:
-    void slotStepped( trace_step* );
-    void slotActionChanged( trace_action* );
+    /** drain the trace ring and show the latest step and action */
+    void slotTraceReady();
     void slotDebugStopped();
     void slotDebugStarted();
+    /** the steps the scrubber can go to */
+    void slotHistoryChanged( int firstStep, int lastStep );
+
+signals:
+    /** the scrubber was moved to another step */
+    void goToStep( int step );
+
+private slots:
+    void slotShowTopOnly( bool top );
+    void slotScrubbed( int step );
+    /** show the newest step and action that came in */
+    void present();
 
 private:
     void changeCurrent( int idx );
+    void showStep( const TraceEvent &step );
+    void showAction( const TraceEvent &action );
+    void clearStacks();
     Command command( int light_change, int hue_change );
     ImageModel* mImageModel;
+    TraceRing* mTraceRing;
+    StackMirror mStack;
+    StackModel* mBeforeModel;
+    StackModel* mAfterModel;
     FlowCompass *mFlowCompass;
+
+    // the newest state not shown yet; while running continuously the
+    // widgets are updated at most once per frame
+    TraceEvent mPendingStep;
+    TraceEvent mPendingAction;
+    bool mStepPending;
+    bool mActionPending;
+
+    // the stack after the last jump, the models start again from it
+    QVector<long> mJumpStack;
+    bool mJumpPending;
+    bool mUpdatingScrubber;
+
+    // the deltas the stack models have not seen yet; past MaxDeltas the
+    // models are refilled from mStack instead
+    QVector<stack_delta> mPendingDeltas;
+    bool mDeltasDropped;
+    // the newest delta, which the before model is still missing
+    stack_delta mLastDelta;
+    bool mHaveLastDelta;
+    QTimer* mFrameTimer;
+    QTime mLastFrame;
 };
 
 #endif // DEBUGWIDGET_H
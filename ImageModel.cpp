@@ -27,9 +27,18 @@ extern "C"
 #include <QMessageBox>
 #include <QDebug>
 
+// a view does not repaint faster than the screen refreshes
+static const int FrameInterval = 16;
+// past this many rectangles the dirty region collapses to its bounds
+static const int MaxDirtyRects = 32;
+
 ImageModel::ImageModel( QObject *parent ) :
-    QAbstractTableModel( parent ), mPixelSize( 1 ), mDebugPixel( -1, -1 )
+    QAbstractTableModel( parent ), mBlocksValid( false ), mDebugPixel( -1, -1 )
 {
+    mFlushTimer = new QTimer( this );
+    mFlushTimer->setSingleShot( true );
+    mFlushTimer->setInterval( FrameInterval );
+    connect( mFlushTimer, SIGNAL( timeout() ), this, SLOT( flushDirty() ) );
 }
 
 ImageModel::~ImageModel()
@@ -107,8 +116,11 @@ QImage ImageModel::autoScale(const QImage& _image, int codel_size)
 
 void ImageModel::setImage( const QImage& image, int codel_size )
 {
+    clearBreakpoints();
     mImage = autoScale(image, codel_size);
     qDebug() << mImage.width() << mImage.height();
+    mBlocksValid = false;
+    mDirty = QRegion();
     reset();
 }
 
@@ -128,22 +140,100 @@ void ImageModel::insertImage(const QImage& _image, int x, int y)
 {
     QPainter p( &mImage );
     p.drawImage( x, y, _image );
-    reset();
+    p.end();
+    mBlocksValid = false;
+    markDirty( QRect( QPoint( x, y ), _image.size() ) );
+}
+
+void ImageModel::setPixels( const QImage& pixels, int x, int y )
+{
+    const QRect rect = QRect( QPoint( x, y ), pixels.size() ) & mImage.rect();
+    if ( rect.isEmpty() )
+        return;
+    QPainter p( &mImage );
+    p.setCompositionMode( QPainter::CompositionMode_Source );
+    p.drawImage( x, y, pixels );
+    p.end();
+    mBlocksValid = false;
+    markDirty( rect );
 }
 
 void ImageModel::setDebuggedPixel( int x, int y )
 {
-    emitNeighborsChanged( mDebugPixel.y(), mDebugPixel.x() );
+    markNeighborsDirty( mDebugPixel.y(), mDebugPixel.x() );
     mDebugPixel.setY( y );
     mDebugPixel.setX( x );
-    emitNeighborsChanged( mDebugPixel.y(), mDebugPixel.x() );
+    markNeighborsDirty( mDebugPixel.y(), mDebugPixel.x() );
+}
+
+QPoint ImageModel::debuggedPixel() const
+{
+    return mDebugPixel;
+}
+
+void ImageModel::setBreakpoint( int x, int y, bool on )
+{
+    const QPoint codel( x, y );
+    if ( on == mBreakpoints.contains( codel ) || ( on && !mImage.rect().contains( codel ) ) )
+        return;
+    // the interpreter never stops on white or black (nor on unknown
+    // colors, which run as white): a breakpoint there could not fire
+    if ( on ) {
+        const QRgb color = pixelAt( x, y );
+        const int idx = get_color_idx( ( ( qRed( color ) * 256 + qGreen( color ) ) * 256 ) + qBlue( color ) );
+        if ( idx < 0 || idx >= c_white )
+            return;
+    }
+    if ( on )
+        mBreakpoints.append( codel );
+    else
+        mBreakpoints.removeAll( codel );
+    markDirty( QRect( codel, QSize( 1, 1 ) ) );
+    emit breakpointChanged( x, y, on );
+}
+
+bool ImageModel::hasBreakpoint( int x, int y ) const
+{
+    return mBreakpoints.contains( QPoint( x, y ) );
 }
 
-void ImageModel::emitNeighborsChanged( int row, int col )
+QList<QPoint> ImageModel::breakpoints() const
 {
-    QModelIndex topLeft = index( row - 1,  col - 1 );
-    QModelIndex bottomRight = index( row + 1,  col + 1 );
-    emit dataChanged( topLeft, bottomRight );
+    return mBreakpoints;
+}
+
+void ImageModel::clearBreakpoints()
+{
+    foreach( const QPoint& codel, mBreakpoints )
+        setBreakpoint( codel.x(), codel.y(), false );
+}
+
+void ImageModel::markNeighborsDirty( int row, int col )
+{
+    if ( row < 0 || col < 0 )
+        return;
+    markDirty( QRect( col - 1, row - 1, 3, 3 ) );
+}
+
+void ImageModel::markDirty( const QRect& rect )
+{
+    const QRect dirty = rect & mImage.rect();
+    if ( dirty.isEmpty() )
+        return;
+    mDirty += dirty;
+    if ( mDirty.rectCount() > MaxDirtyRects )
+        mDirty = mDirty.boundingRect();
+    if ( !mFlushTimer->isActive() )
+        mFlushTimer->start();
+}
+
+void ImageModel::flushDirty()
+{
+    mFlushTimer->stop();
+    const QVector<QRect> rects = ( mDirty & mImage.rect() ).rects();
+    mDirty = QRegion();
+    foreach( const QRect& rect, rects )
+        emit dataChanged( index( rect.top(), rect.left() ), index( rect.bottom(), rect.right() ) );
 }
 
 int ImageModel::columnCount( const QModelIndex& parent ) const
@@ -185,8 +275,6 @@ QVariant ImageModel::headerData( int section, Qt::Orientation orientation, int r
 {
     Q_UNUSED( orientation )
     switch ( role ) {
-    case Qt::SizeHintRole:
-        return QSize( mPixelSize, mPixelSize );
     case Qt::DisplayRole:
         return QString::number( section );
     default:
@@ -201,18 +289,17 @@ bool ImageModel::setData( const QModelIndex& index, const QVariant& value, int r
     if ( !value.canConvert<QColor>() )
         return false;
     QColor c = value.value<QColor>();
-    mImage.setPixel( index.column(), index.row(), c.rgb() );
-    emit dataChanged( index, index );
+    if ( mImage.pixel( index.column(), index.row() ) != c.rgb() ) {
+        mImage.setPixel( index.column(), index.row(), c.rgb() );
+        if ( mBlocksValid )
+            updateBlocks( index.column(), index.row() );
+    }
+    markDirty( QRect( index.column(), index.row(), 1, 1 ) );
     emit pixelChanged( index.column(), index.row(), c.rgb() );
     return true;
 }
 
 
-void ImageModel::slotPixelSizeChange( int size )
-{
-    mPixelSize = size;
-}
-
 QString ImageModel::statusString( QModelIndex index ) const
 {
     QString coords;
@@ -227,55 +314,177 @@ QString ImageModel::statusString( QModelIndex index ) const
 }
 
 
-struct Frame {
-    Frame( int _x, int _y ) : x( _x ), y( _y ) {}
-    int x, y;
-};
-
-// emulate stack based iterative recursion to traverse the image data
-// and find the number of contiguous blocks of the same color
-// converted from an earlier 'actually' recursive algorithm.
-// could probably use some optimization, however it seems to perform fine.
 quint64 ImageModel::contiguousBlocks( int x, int y ) const
 {
     if ( x < 0 || x >= mImage.width() || y < 0 || y >= mImage.height() )
         return 0;
 
-    // array used to mark pixels as visited.
-    // the image is mapped in row major fashion
-    QScopedPointer<QStack<Frame*> > stack( new QStack<Frame*>() );
-    QScopedPointer<QBitArray> markedArray( new QBitArray( mImage.width() * mImage.height() ) );
-    quint64 result = 0;
-    QRgb color = mImage.pixel( x, y );
-    stack->push( new Frame( x, y  ) );
-    while( !stack->isEmpty() ) {
-        Frame* frame = stack->pop();
-        if ( frame->x < 0 || frame->x >= mImage.width() || frame->y < 0 || frame->y >= mImage.height() ) {
-            delete frame;
+    if ( !mBlocksValid )
+        labelBlocks();
+    return mBlockSizes[mBlockMap[y * mImage.width() + x]];
+}
+
+QRgb ImageModel::pixelAt( int x, int y ) const
+{
+    // the image is always 32 bit, see autoScale()
+    return reinterpret_cast<const QRgb*>( mImage.scanLine( y ) )[x];
+}
+
+void ImageModel::labelBlocks() const
+{
+    const int width = mImage.width();
+    const int n = width * mImage.height();
+
+    mBlockMap.fill( -1, n );
+    mBlockSizes.clear();
+    mFreeLabels.clear();
+    for ( int i = 0; i < n; ++i ) {
+        if ( mBlockMap[i] >= 0 )
             continue;
-        }
-        if ( ( *markedArray )[frame->x*mImage.height()+frame->y] || mImage.pixel( frame->x, frame->y ) != color ) {
-            delete frame;
+        int label = mBlockSizes.size();
+        mBlockSizes.append( 0 );
+        mBlockSizes[label] = fillBlock( i % width, i / width, -1, label );
+    }
+    mBlocksValid = true;
+}
+
+// the pixel at x, y changed its color: the block it left may have
+// fallen apart and the blocks of its new color around it are joined.
+// only the pixels of those blocks are relabeled.
+void ImageModel::updateBlocks( int x, int y )
+{
+    static const int dx[4] = { 1, 0, -1, 0 };
+    static const int dy[4] = { 0, 1, 0, -1 };
+    const int width = mImage.width();
+    const int height = mImage.height();
+    const int i = y * width + x;
+    const int old = mBlockMap[i];
+
+    // keep the pixel out of the fills below
+    mBlockMap[i] = -2;
+
+    // split: give every part of the old block left around the pixel its
+    // own label, the old label is free afterwards
+    for ( int k = 0; k < 4; ++k ) {
+        int nx = x + dx[k], ny = y + dy[k];
+        if ( nx < 0 || nx >= width || ny < 0 || ny >= height || mBlockMap[ny * width + nx] != old )
             continue;
+        int label = newLabel();
+        mBlockSizes[label] = fillBlock( nx, ny, old, label );
+    }
+    mBlockSizes[old] = 0;
+    mFreeLabels.append( old );
+
+    // merge: the largest block of the new color around the pixel takes
+    // in the pixel and the other ones
+    const QRgb color = pixelAt( x, y );
+    int labels[4], seeds[4], count = 0, largest = -1;
+    for ( int k = 0; k < 4; ++k ) {
+        int nx = x + dx[k], ny = y + dy[k];
+        if ( nx < 0 || nx >= width || ny < 0 || ny >= height || pixelAt( nx, ny ) != color )
+            continue;
+        int label = mBlockMap[ny * width + nx];
+        bool seen = false;
+        for ( int j = 0; j < count; ++j )
+            seen = seen || labels[j] == label;
+        if ( seen )
+            continue;
+        labels[count] = label;
+        seeds[count] = ny * width + nx;
+        if ( largest < 0 || mBlockSizes[label] > mBlockSizes[labels[largest]] )
+            largest = count;
+        ++count;
+    }
+
+    int block;
+    if ( count == 0 ) {
+        block = newLabel();
+        mBlockSizes[block] = 0;
+    } else {
+        block = labels[largest];
+        for ( int j = 0; j < count; ++j ) {
+            if ( j == largest )
+                continue;
+            mBlockSizes[block] += fillBlock( seeds[j] % width, seeds[j] / width, labels[j], block );
+            mBlockSizes[labels[j]] = 0;
+            mFreeLabels.append( labels[j] );
         }
-        ( *markedArray )[frame->x*mImage.height()+frame->y] = 1;
-        stack->push( new Frame( frame->x + 1, frame->y ) );
-        stack->push( new Frame( frame->x - 1, frame->y ) );
-        stack->push( new Frame( frame->x, frame->y + 1 ) );
-        stack->push( new Frame( frame->x, frame->y - 1 ) );
-        delete frame;
-        result += 1;
     }
-    return result;
+    mBlockMap[i] = block;
+    mBlockSizes[block] += 1;
+}
+
+int ImageModel::newLabel() const
+{
+    if ( !mFreeLabels.isEmpty() ) {
+        int label = mFreeLabels.last();
+        mFreeLabels.pop_back();
+        return label;
+    }
+    mBlockSizes.append( 0 );
+    return mBlockSizes.size() - 1;
+}
+
+// relabel the pixels of label from that are connected to x, y and have
+// its color, return how many there are
+quint64 ImageModel::fillBlock( int x, int y, int from, int to ) const
+{
+    const int width = mImage.width();
+    const int height = mImage.height();
+    const QRgb color = pixelAt( x, y );
+    quint64 size = 0;
+
+    QVector<int> stack;
+    stack.append( y * width + x );
+    mBlockMap[y * width + x] = to;
+    while ( !stack.isEmpty() ) {
+        const int c = stack.last();
+        const int cx = c % width, cy = c / width;
+        stack.pop_back();
+        ++size;
+
+        if ( cx + 1 < width && mBlockMap[c + 1] == from && pixelAt( cx + 1, cy ) == color ) {
+            mBlockMap[c + 1] = to;
+            stack.append( c + 1 );
+        }
+        if ( cx > 0 && mBlockMap[c - 1] == from && pixelAt( cx - 1, cy ) == color ) {
+            mBlockMap[c - 1] = to;
+            stack.append( c - 1 );
+        }
+        if ( cy + 1 < height && mBlockMap[c + width] == from && pixelAt( cx, cy + 1 ) == color ) {
+            mBlockMap[c + width] = to;
+            stack.append( c + width );
+        }
+        if ( cy > 0 && mBlockMap[c - width] == from && pixelAt( cx, cy - 1 ) == color ) {
+            mBlockMap[c - width] = to;
+            stack.append( c - width );
+        }
+    }
+    return size;
 }
 
 void ImageModel::scaleImage( const QSize& size )
 {
     QImage newImage(size, QImage::Format_ARGB32_Premultiplied);
     newImage.fill( QColor( Qt::white ).rgb() );
-    QImage oldImage(mImage);
+    QPainter p( &newImage );
+    p.drawImage( 0, 0, mImage );
+    p.end();
+
+    // the kept pixels stay where they are, only the new margin is dirty
+    const QRect kept = mImage.rect() & newImage.rect();
+    // breakpoints cut off go away
+    foreach( const QPoint& codel, mBreakpoints ) {
+        if ( !newImage.rect().contains( codel ) )
+            setBreakpoint( codel.x(), codel.y(), false );
+    }
+    emit layoutAboutToBeChanged();
     mImage = newImage;
-    insertImage(oldImage, 0,0);
+    mBlocksValid = false;
+    mDirty &= mImage.rect();
+    emit layoutChanged();
+    foreach( const QRect& rect, ( QRegion( mImage.rect() ) - kept ).rects() )
+        markDirty( rect );
 }
 
 QSize ImageModel::imageSize() const
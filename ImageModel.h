@@ -21,7 +21,12 @@
 
 #include <QAbstractTableModel>
 #include <QImage>
-class QBitArray;
+#include <QList>
+#include <QRegion>
+#include <QVector>
+
+class QTimer;
+
 class ImageModel : public QAbstractTableModel
 {
     Q_OBJECT
@@ -55,11 +60,25 @@ public:
      */
     void insertImage( const QImage &image, int x, int y);
 
+    /**
+     * Overwrite the pixels at the x,y coord with those of the image,
+     * alpha included. Used to put saved tiles back on undo.
+     */
+    void setPixels( const QImage &pixels, int x, int y );
+
     void scaleImage( const QSize & size );
     QSize imageSize() const;
 
     void setDebuggedPixel( int x, int y );
-    void setBreakpoint( int x, int y );
+    QPoint debuggedPixel() const;
+    /**
+     * the interpreter stops when it enters the block of a breakpoint;
+     * white and black codels take none, as no step stops on them
+     */
+    void setBreakpoint( int x, int y, bool on = true );
+    bool hasBreakpoint( int x, int y ) const;
+    QList<QPoint> breakpoints() const;
+    void clearBreakpoints();
 
     int rowCount( const QModelIndex &parent = QModelIndex() ) const;
     int columnCount( const QModelIndex &parent = QModelIndex() ) const;
@@ -72,23 +91,42 @@ public:
     
 signals:
     void pixelChanged( int x, int y, QRgb color );
+    void breakpointChanged( int x, int y, bool on );
 
 public slots:
-    /*! This is a very bad hack.
-        headerData() needs to know the current pixel size (IN THE VIEW!) in order
-        to return a correct SizeHint, otherwise things get screwy.
-        Note: this pixel information is only used by headerData to return a SizeHint
-        It does not affect the backend image data at all
-        */
-    void slotPixelSizeChange( int size );
+    /**
+     * Emit dataChanged for everything changed since the last flush.
+     * Happens by itself once per frame.
+     */
+    void flushDirty();
+
 private:
-    void emitNeighborsChanged( int row, int col );
+    void markDirty( const QRect& rect );
+    void markNeighborsDirty( int row, int col );
     QString statusString( QModelIndex index ) const;
     quint64 contiguousBlocks( int x, int y ) const;
+
+    QRgb pixelAt( int x, int y ) const;
+    void labelBlocks() const;
+    void updateBlocks( int x, int y );
+    int newLabel() const;
+    quint64 fillBlock( int x, int y, int from, int to ) const;
+
     QImage mImage;
-    int mPixelSize;
+
+    // the color block of every pixel (row major) and the block sizes,
+    // built on the first query after the image was replaced
+    mutable QVector<int> mBlockMap;
+    mutable QVector<quint64> mBlockSizes;
+    mutable QVector<int> mFreeLabels;
+    mutable bool mBlocksValid;
 
     QPoint mDebugPixel;
+    QList<QPoint> mBreakpoints;
+
+    // changed pixels not announced yet, see flushDirty()
+    QRegion mDirty;
+    QTimer* mFlushTimer;
 };
 
 #endif // IMAGEMODEL_H
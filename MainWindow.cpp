@@ -20,7 +20,7 @@
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
 
-#include "PixelDelegate.h"
+#include "CanvasView.h"
 #include "ImageModel.h"
 #include "ViewMonitor.h"
 #include "ResizeDialog.h"
@@ -30,13 +30,12 @@
 #include "UndoHandler.h"
 
 #include <QHBoxLayout>
-#include <QTableView>
-#include <QHeaderView>
 #include <QImage>
 #include <QFileDialog>
 #include <QDesktopServices>
 #include <QFileInfo>
 #include <QMessageBox>
+#include <QInputDialog>
 #include <QWheelEvent>
 #include <QDebug>
 #include <QListView>
@@ -44,6 +43,8 @@
 #include <QThread>
 #include <QUndoStack>
 
+#include <climits>
+
 static const int INITIAL_CODEL_SIZE = 12;
 
 MainWindow::MainWindow( QWidget *parent ) :
@@ -59,19 +60,7 @@ MainWindow::MainWindow( QWidget *parent ) :
 
     mModel = new ImageModel;
     ui->mView->setModel( mModel );
-
-    ui->mView->setSelectionMode( QAbstractItemView::NoSelection );
-    ui->mView->horizontalHeader()->hide();
-    ui->mView->verticalHeader()->hide();
-    ui->mView->horizontalHeader()->setMinimumSectionSize( 1 );
-    ui->mView->verticalHeader()->setMinimumSectionSize( 1 );
-    ui->mView->verticalHeader()->setResizeMode( QHeaderView::Fixed );
-    ui->mView->horizontalHeader()->setResizeMode( QHeaderView::Fixed );
-    ui->mView->horizontalHeader()->setDefaultSectionSize( 12 );
-    ui->mView->verticalHeader()->setDefaultSectionSize( 12 );
-    ui->mView->viewport()->setMouseTracking( true ); // to enable Qt::StatusTipRole
     ui->mView->viewport()->installEventFilter( this );
-    ui->mView->setShowGrid( false );
 
     mUndoStack = new QUndoStack(this);
     mUndoHandler = new UndoHandler(mUndoStack, mModel);
@@ -83,11 +72,13 @@ MainWindow::MainWindow( QWidget *parent ) :
     mMonitor = new ViewMonitor( this );
     mMonitor->setPixelSize( INITIAL_CODEL_SIZE );
     ui->mZoomSlider->setValue( INITIAL_CODEL_SIZE );
+    ui->mView->setPixelSize( INITIAL_CODEL_SIZE );
 
     QMenu * contextMenu = new QMenu(this);
-    contextMenu->addAction(new QAction("Set &Breakpoint", contextMenu));
-    mDelegate = new PixelDelegate( mMonitor, mUndoHandler, contextMenu, this );
-    ui->mView->setItemDelegate( mDelegate );
+    contextMenu->addAction( tr( "Toggle &Breakpoint" ), this, SLOT( slotToggleBreakpoint() ) );
+    ui->mView->setMonitor( mMonitor );
+    ui->mView->setUndoHandler( mUndoHandler );
+    ui->mView->setContextMenu( contextMenu );
 
     mCommandWidget = new CommandWidget( mMonitor, ui->mCommandsPage );
     ui->mCommandsPage->layout()->addWidget( mCommandWidget );
@@ -107,9 +98,9 @@ MainWindow::MainWindow( QWidget *parent ) :
             mSaveMessage += ";;";
     }
 
-    connect( mDelegate, SIGNAL( imageEdited() ), SLOT( slotImageEdited() ) );
+    connect( ui->mView, SIGNAL( imageEdited() ), SLOT( slotImageEdited() ) );
     connect( ui->mZoomSlider, SIGNAL( valueChanged( int ) ), mMonitor, SLOT( setPixelSize( int ) ) );
-    connect( mMonitor, SIGNAL( pixelSizeChanged( int ) ), SLOT( slotUpdateView( int ) ) );
+    connect( mMonitor, SIGNAL( pixelSizeChanged( int ) ), ui->mView, SLOT( setPixelSize( int ) ) );
 
     connect( ui->mClearOutput, SIGNAL( clicked() ), this, SLOT( slotClearOutputView() ) );
 
@@ -119,11 +110,19 @@ MainWindow::MainWindow( QWidget *parent ) :
     connect( this, SIGNAL( executeSource( QImage ) ), mRunController, SLOT( runSource( QImage ) ) );
     connect( this, SIGNAL( debugSource( QImage ) ), mRunController, SLOT( debugSource( QImage ) ) );
     connect( this, SIGNAL( debugStep() ), mRunController, SLOT( step() ) );
+    connect( this, SIGNAL( debugStepBack() ), mRunController, SLOT( stepBack() ) );
+    connect( this, SIGNAL( debugContinue() ), mRunController, SLOT( debugContinue() ) );
+    connect( this, SIGNAL( debugPause() ), mRunController, SLOT( debugPause() ) );
     connect( this, SIGNAL( debugStop() ), this, SLOT( slotStopController() ) );
     connect( mModel, SIGNAL( pixelChanged( int, int, QRgb ) ), mRunController, SLOT( pixelChanged( int, int, QRgb ) ) );
-
-    connect( mRunController, SIGNAL( stepped( trace_step* ) ), mDebugWidget, SLOT( slotStepped( trace_step* ) ) );
-    connect( mRunController, SIGNAL( actionChanged( trace_action* ) ), mDebugWidget, SLOT( slotActionChanged( trace_action* ) ) );
+    connect( mModel, SIGNAL( breakpointChanged( int, int, bool ) ), mRunController, SLOT( setBreakpoint( int, int, bool ) ) );
+    connect( this, SIGNAL( addWatchpoint( int, int ) ), mRunController, SLOT( addWatchpoint( int, int ) ) );
+    connect( this, SIGNAL( clearWatchpoints() ), mRunController, SLOT( clearWatchpoints() ) );
+
+    mDebugWidget->setTraceRing( mRunController->traceRing() );
+    connect( mRunController, SIGNAL( traceReady() ), mDebugWidget, SLOT( slotTraceReady() ) );
+    connect( mRunController, SIGNAL( historyChanged( int, int ) ), mDebugWidget, SLOT( slotHistoryChanged( int, int ) ) );
+    connect( mDebugWidget, SIGNAL( goToStep( int ) ), mRunController, SLOT( goToStep( int ) ) );
     connect( mRunController, SIGNAL( stopped() ), this, SLOT( slotControllerStopped() ) );
     connect( mRunController, SIGNAL( debugStarted() ), this, SLOT( slotControllerStarted() ) );
     connect( mRunController, SIGNAL( stopped() ), mDebugWidget, SLOT( slotDebugStopped() ) );
@@ -131,6 +130,8 @@ MainWindow::MainWindow( QWidget *parent ) :
     connect( mRunController, SIGNAL( waitingForInt() ), this, SLOT( slotGetInt() ) );
     connect( mRunController, SIGNAL( waitingForChar() ), this, SLOT( slotGetChar() ) );
     connect( mRunController, SIGNAL( newOutput( QString ) ), this, SLOT( slotNewOutput( QString ) ) );
+    connect( mRunController, SIGNAL( speedChanged( int ) ), this, SLOT( slotSpeedChanged( int ) ) );
+    connect( mRunController, SIGNAL( breakpointHit( int ) ), this, SLOT( slotBreakpointHit( int ) ) );
 
     connect( &mRunThread, SIGNAL( started() ), mRunController, SLOT( slotThreadStarted() ) );
     mRunController->moveToThread( &mRunThread );
@@ -205,15 +206,10 @@ void MainWindow::setupToolbar()
     ui->mToolBar->addSeparator();
 
     QMenu* viewMenu = ui->mMenubar->addMenu( tr( "&View" ) );
-//     QAction* gridAct = ui->mToolBar->addAction( QIcon::fromTheme( "format-justify-fill" ), tr( "Toggle &Grid" ), this, SLOT( slotActionToggleGrid() ) );
-//     gridAct->setShortcut( QKeySequence::New );
-//     gridAct->setDisabled( true );
-//     connect( this, SIGNAL( validImageDocument( bool ) ), gridAct, SLOT( setEnabled( bool ) ) );
-//     viewMenu->addAction( gridAct );
-    QAction* headersAct = ui->mToolBar->addAction( QIcon::fromTheme( "view-form-table" ), tr( "Toggle &Headers" ), this, SLOT( slotActionToggleHeaders() ) );
-    headersAct->setDisabled( true );
-    connect( this, SIGNAL( validImageDocument( bool ) ), headersAct, SLOT( setEnabled( bool ) ) );
-    viewMenu->addAction( headersAct );
+    QAction* gridAct = ui->mToolBar->addAction( QIcon::fromTheme( "view-form-table" ), tr( "Toggle &Grid" ), this, SLOT( slotActionToggleGrid() ) );
+    gridAct->setDisabled( true );
+    connect( this, SIGNAL( validImageDocument( bool ) ), gridAct, SLOT( setEnabled( bool ) ) );
+    viewMenu->addAction( gridAct );
     QAction* zoomInAct = ui->mToolBar->addAction( QIcon::fromTheme( "zoom-in" ), tr( "Zoom &In" ), this, SLOT( slotActionZoom() ) );
     zoomInAct->setShortcuts(QKeySequence::ZoomIn);
     zoomInAct->setDisabled( true );
@@ -243,14 +239,29 @@ void MainWindow::setupToolbar()
     progMenu->addAction( debugAct );
     ui->mToolBar->addSeparator();
     progMenu->addSeparator();
+    QAction* stepBackAct = ui->mToolBar->addAction( QIcon::fromTheme( "media-skip-backward" ), tr( "Step &Back" ), this, SIGNAL( debugStepBack() ) );
+    stepBackAct->setDisabled( true );
+    connect( this, SIGNAL( debugStarted( bool ) ), stepBackAct, SLOT( setEnabled( bool ) ) );
+    progMenu->addAction( stepBackAct );
     QAction* stepAct = ui->mToolBar->addAction( QIcon( ":/icons/debug-step.png" ), tr( "&Step" ), this, SIGNAL( debugStep() ) );
     stepAct->setDisabled( true );
     connect( this, SIGNAL( debugStarted( bool ) ), stepAct, SLOT( setEnabled( bool ) ) );
     progMenu->addAction( stepAct );
+    QAction* continueAct = ui->mToolBar->addAction( QIcon::fromTheme( "media-playback-start" ), tr( "&Continue" ), this, SIGNAL( debugContinue() ) );
+    continueAct->setDisabled( true );
+    connect( this, SIGNAL( debugStarted( bool ) ), continueAct, SLOT( setEnabled( bool ) ) );
+    progMenu->addAction( continueAct );
+    QAction* pauseAct = ui->mToolBar->addAction( QIcon::fromTheme( "media-playback-pause" ), tr( "&Pause" ), this, SIGNAL( debugPause() ) );
+    pauseAct->setDisabled( true );
+    connect( this, SIGNAL( debugStarted( bool ) ), pauseAct, SLOT( setEnabled( bool ) ) );
+    progMenu->addAction( pauseAct );
     QAction* stopAct = ui->mToolBar->addAction( QIcon::fromTheme( "process-stop" ), tr( "&Stop" ), this, SIGNAL( debugStop() ) );
     stopAct->setDisabled( true );
     connect( this, SIGNAL( setStopEnabled( bool ) ), stopAct, SLOT( setEnabled( bool ) ) );
     progMenu->addAction( stopAct );
+    progMenu->addSeparator();
+    progMenu->addAction( tr( "Add &Watchpoint..." ), this, SLOT( slotAddWatchpoint() ) );
+    progMenu->addAction( tr( "C&lear Watchpoints" ), this, SIGNAL( clearWatchpoints() ) );
 }
 
 void MainWindow::setModified( bool flag )
@@ -275,11 +286,11 @@ bool MainWindow::eventFilter( QObject* obj, QEvent* event )
     } else if (event->type() == QEvent::MouseButtonPress ) {
         QMouseEvent * mevent = static_cast<QMouseEvent*>( event );
         if ( obj == ui->mView->viewport() && mWaitingForCoordSelection && mevent->button() == Qt::LeftButton ) {
-            QModelIndex i = ui->mView->indexAt(mevent->pos());
+            QPoint codel = ui->mView->codelAt(mevent->pos());
             setCursor(Qt::ArrowCursor);
             mWaitingForCoordSelection = false;
-            int x = i.column();
-            int y = i.row();
+            int x = codel.x();
+            int y = codel.y();
             
             
             QImage newImage = mModel->autoScale(mInsertImage, -1);
@@ -320,15 +331,7 @@ bool MainWindow::eventFilter( QObject* obj, QEvent* event )
 
 void MainWindow::slotActionToggleGrid()
 {
-//     ui->mView->setShowGrid( !ui->mView->showGrid() );
-}
-
-void MainWindow::slotUpdateView( int pixelSize )
-{
-    ui->mView->resizeColumnsToContents();
-    ui->mView->resizeRowsToContents();
-    if ( ui->mView->horizontalHeader()->isVisible() )
-        mModel->slotPixelSizeChange( pixelSize );
+    ui->mView->setShowGrid( !ui->mView->showGrid() );
 }
 
 void MainWindow::slotActionOpen()
@@ -434,41 +437,6 @@ void MainWindow::slotActionExit()
     qApp->quit();
 }
 
-void MainWindow::slotActionToggleHeaders()
-{
-    if ( ui->mView->horizontalHeader()->isVisible() ) { //hide
-        ui->mView->horizontalHeader()->hide();
-        ui->mView->verticalHeader()->hide();
-        ui->mView->horizontalHeader()->setMinimumSectionSize( 1 );
-        ui->mView->verticalHeader()->setMinimumSectionSize( 1 );
-        ui->mView->verticalHeader()->setResizeMode( QHeaderView::Fixed );
-        ui->mView->horizontalHeader()->setResizeMode( QHeaderView::Fixed );
-        ui->mView->horizontalHeader()->setDefaultSectionSize( mMonitor->pixelSize() );
-        ui->mView->verticalHeader()->setDefaultSectionSize( mMonitor->pixelSize() );
-        ui->mZoomSlider->setMinimum( 4 );
-        mModel->slotPixelSizeChange( 1 );
-    } else {  //show
-        ui->mView->horizontalHeader()->show();
-        ui->mView->verticalHeader()->show();
-        ui->mView->verticalHeader()->setResizeMode( QHeaderView::Fixed );
-        ui->mView->horizontalHeader()->setResizeMode( QHeaderView::Fixed );
-        int rows = mModel->rowCount();
-        if ( rows == 0 )
-            return;
-        int num_digits = 0;
-        while ( rows > 0 ) {
-            ++num_digits;
-            rows /= 10;
-        }
-        int largest_index = num_digits * 10; // not the largest index, but one of the largest (most digits)
-        ui->mZoomSlider->setValue( ui->mView->horizontalHeader()->sectionSize( largest_index ) );
-        ui->mZoomSlider->setMinimum( ui->mView->horizontalHeader()->sectionSize( largest_index ) );
-        ui->mView->horizontalHeader()->setMinimumSectionSize( largest_index );
-        ui->mView->verticalHeader()->setMinimumSectionSize( largest_index );
-        slotUpdateView( mMonitor->pixelSize() );
-    }
-}
-
 void MainWindow::slotActionResize()
 {
     QScopedPointer<ResizeDialog> dlg( new ResizeDialog( mModel->imageSize(), this ) );
@@ -643,6 +611,51 @@ void MainWindow::slotNewOutput( QString str )
     ui->mTextEdit->insertPlainText( str );
 }
 
+void MainWindow::slotSpeedChanged( int stepsPerSecond )
+{
+    ui->mStatusbar->showMessage( tr( "Executing at %1 steps/s" ).arg( stepsPerSecond ), 5000 );
+}
+
+void MainWindow::slotToggleBreakpoint()
+{
+    const QPoint codel = ui->mView->contextCodel();
+    mModel->setBreakpoint( codel.x(), codel.y(), !mModel->hasBreakpoint( codel.x(), codel.y() ) );
+}
+
+void MainWindow::slotAddWatchpoint()
+{
+    // as piet_watch_depth, piet_watch_top and piet_watch_command
+    QStringList kinds;
+    kinds << tr( "Stack depth greater than" ) << tr( "Top of stack equals" ) << tr( "Command is" );
+    bool ok = false;
+    const QString kind = QInputDialog::getItem( this, tr( "Add Watchpoint" ), tr( "Stop when:" ), kinds, 0, false, &ok );
+    if ( !ok )
+        return;
+
+    int value;
+    if ( kind == kinds[2] ) {
+        // hue change * 3 + lightness change, from push on
+        QStringList commands;
+        commands << "push" << "pop" << "add" << "subtract" << "multiply" << "divide" << "mod" << "not"
+                 << "greater" << "pointer" << "switch" << "duplicate" << "roll" << "in(number)"
+                 << "in(char)" << "out(number)" << "out(char)";
+        const QString command = QInputDialog::getItem( this, tr( "Add Watchpoint" ), kind, commands, commands.indexOf( "roll" ), false, &ok );
+        value = commands.indexOf( command ) + 1;
+    } else {
+        value = QInputDialog::getInt( this, tr( "Add Watchpoint" ), kind, 0, INT_MIN, INT_MAX, 1, &ok );
+    }
+    if ( ok )
+        emit addWatchpoint( kinds.indexOf( kind ), value );
+}
+
+void MainWindow::slotBreakpointHit( int watch )
+{
+    if ( watch < 0 )
+        ui->mStatusbar->showMessage( tr( "Stopped at a breakpoint" ), 5000 );
+    else
+        ui->mStatusbar->showMessage( tr( "Stopped at watchpoint %1" ).arg( watch + 1 ), 5000 );
+}
+
 
 
 #include "MainWindow.moc"
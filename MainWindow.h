@@ -30,10 +30,8 @@ namespace Ui
 class MainWindow;
 }
 
-class PixelDelegate;
 class ImageModel;
 class ViewMonitor;
-class QTableView;
 class OutputModel;
 class RunController;
 class CommandWidget;
@@ -60,7 +58,12 @@ signals:
     void executeSource( const QImage & );
     void debugSource( const QImage & );
     void debugStep();
+    void debugStepBack();
+    void debugContinue();
+    void debugPause();
     void debugStop();
+    void addWatchpoint( int kind, int value );
+    void clearWatchpoints();
     void debugStarted( bool );
     void setStopEnabled( bool );
 
@@ -70,7 +73,6 @@ private slots:
     void slotActionSave();
     void slotActionOpen();
     void slotActionToggleGrid();
-    void slotActionToggleHeaders();
     void slotActionNew();
     void slotActionResize();
     void slotActionInsert();
@@ -78,7 +80,6 @@ private slots:
     void slotActionDebug();
     void slotActionRun();
 
-    void slotUpdateView( int pixelSize );
     void slotImageEdited();
 
     void slotToggleOutput();
@@ -94,6 +95,11 @@ private slots:
     void slotStopController();
 
     void slotNewOutput( QString );
+    void slotSpeedChanged( int stepsPerSecond );
+
+    void slotToggleBreakpoint();
+    void slotAddWatchpoint();
+    void slotBreakpointHit( int watch );
 
 private:
     void setupToolbar();
@@ -108,7 +114,6 @@ private:
     QUndoStack* mUndoStack;
     UndoHandler* mUndoHandler;
     ImageModel* mModel;
-    PixelDelegate* mDelegate;
     ViewMonitor* mMonitor;
     OutputModel* mOutputModel;
     RunController* mRunController;
@@ -18,6 +18,7 @@
 */
 
 #include "NPietObserver.h"
+#include "TraceRing.h"
 #include <QDebug>
 #include <QThread>
 extern "C"
@@ -25,7 +26,7 @@ extern "C"
 #include "npiet/npiet_utils.h"
 }
 
-NPietObserver::NPietObserver( RunController* controller ): QObject( controller ), mRunController( controller )
+NPietObserver::NPietObserver( RunController* controller ): QObject( controller ), mRunController( controller ), mTraceRing( controller->traceRing() )
 {
     register_step_callback( call_step, this );
     register_action_callback( call_action, this );
@@ -35,12 +36,34 @@ NPietObserver::NPietObserver( RunController* controller ): QObject( controller )
 
 void NPietObserver::action( trace_action* act )
 {
-    emit actionChanged( act );
+    TraceEvent* event = reserve();
+    if ( event ) {
+        event->setAction( act );
+        publish();
+    }
 }
 
 void NPietObserver::step( trace_step* ste )
 {
-    emit stepped( ste );
+    TraceEvent* event = reserve();
+    if ( event ) {
+        event->setStep( ste );
+        publish();
+    }
+}
+
+TraceEvent* NPietObserver::reserve()
+{
+    if ( !mRunController->isTracing() )
+        return 0;
+    return mTraceRing->reserve();
+}
+
+void NPietObserver::publish()
+{
+    mTraceRing->publish();
+    if ( mTraceRing->needsNotify() )
+        emit traceReady();
 }
 
 char NPietObserver::get_char()
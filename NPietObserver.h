@@ -25,7 +25,13 @@
 
 struct trace_step;
 struct trace_action;
+class TraceRing;
+struct TraceEvent;
 
+/**
+  * Receives the callbacks of npiet on the interpreter thread and copies
+  * steps and actions into the trace ring of the RunController.
+  */
 class NPietObserver : public QObject
 {
 Q_OBJECT
@@ -45,11 +51,15 @@ public:
     static char call_readchar( void* object );
 
 signals:
-    void stepped( trace_step* );
-    void actionChanged( trace_action* );
+    /** the trace ring has new events, emitted once until it is drained */
+    void traceReady();
 
 private:
+    TraceEvent* reserve();
+    void publish();
+
     RunController* mRunController;
+    TraceRing* mTraceRing;
 };
 
 #endif // NPIETOBSERVER_H
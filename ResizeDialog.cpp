@@ -2,6 +2,10 @@
 
 #include <QtGui>
 
+// the canvas paints only what is visible, this just keeps the image
+// in memory reasonable (10000 * 10000 codels are 400 MB)
+static const int MaximumSize = 10000;
+
 ResizeDialog::ResizeDialog( const QSize &size, QWidget *parent ) :
     QDialog( parent )
 {
@@ -15,12 +19,12 @@ ResizeDialog::ResizeDialog( const QSize &size, QWidget *parent ) :
 
     mWidthSpin = new QSpinBox( this );
     mWidthSpin->setMinimum( 1 );
-    mWidthSpin->setMaximum( 100 );
+    mWidthSpin->setMaximum( MaximumSize );
     mWidthSpin->setSuffix( tr( " codels" ) );
     mWidthSpin->setValue( size.width() );
     mHeightSpin = new QSpinBox( this );
     mHeightSpin->setMinimum( 1 );
-    mHeightSpin->setMaximum( 1000 );
+    mHeightSpin->setMaximum( MaximumSize );
     mHeightSpin->setSuffix( tr( " codels" ) );
     mHeightSpin->setValue( size.height() );
 
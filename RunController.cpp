@@ -42,7 +42,7 @@ extern "C"
 #include "npiet/npiet_utils.h"
 }
 
-RunController::RunController(): QObject( 0 ), mPrepared( false ), mStdOut( 0 ), mObserver( 0 ), mAbort( false ), mExecuting( false ), mDebugging( false ), mTimer( 0 )
+RunController::RunController(): QObject( 0 ), mPrepared( false ), mStdOut( 0 ), mObserver( 0 ), mTraceRing( 4096, TraceRing::Backpressure ), mAbort( false ), mCancel( 0 ), mExecuting( false ), mDebugging( false ), mTimer( 0 ), mCheckSteps( 1 ), mRunSteps( 0 ), mLastReport( 0 ), mInputPos( 0 ), mLastStep( 0 ), mJumping( false )
 {
 #ifndef Q_WS_WIN
     mNotifier = 0;
@@ -65,8 +65,7 @@ RunController::~RunController()
 void RunController::slotThreadStarted()
 {
     mObserver = new NPietObserver( this );
-    connect( mObserver, SIGNAL( stepped( trace_step* ) ), this, SLOT( slotStepped( trace_step* ) ) );
-    connect( mObserver, SIGNAL( actionChanged( trace_action* ) ), this, SLOT( slotAction( trace_action* ) ) );
+    connect( mObserver, SIGNAL( traceReady() ), this, SIGNAL( traceReady() ) );
 }
 
 
@@ -90,22 +89,63 @@ bool RunController::initialize( const QImage &source )
     return false;
 }
 
+/** the time one tick() may run, in ms */
+static const int SliceTime = 5;
+
 void RunController::execute()
 {
     mExecuting = true;
     if ( !mPrepared )
         return;
+    startRun();
+}
+
+void RunController::startRun()
+{
+    mCancel = 0;
+    mCheckSteps = 1;
+    mRunSteps = 0;
+    mLastReport = 0;
+    mRunTime.start();
     mTimer->start( 0 );
 }
 
 void RunController::tick()
 {
     QMutexLocker locker( &mMutex );
-//     if( mAbort ) {
-//         abort = true;
-//     }
-    if ( !mAbort && piet_step() < 0 )
-        mAbort = true;
+    if ( !mAbort ) {
+        // step for about SliceTime ms, in batches between looks at the
+        // clock and the cancel flag; the lock is only given up while
+        // waiting for input
+        QTime slice;
+        slice.start();
+        int steps = 0;
+        bool hit = false;
+        while ( !mCancel ) {
+            int i = 0;
+            while ( i < mCheckSteps && canStep() ) {
+                const int res = mDebugging ? debugStep() : piet_step();
+                if ( res < 0 ) {
+                    mAbort = true;
+                    break;
+                }
+                ++i;
+                if ( res == piet_step_break ) {
+                    hit = true;
+                    break;
+                }
+            }
+            steps += i;
+            if ( mAbort || hit || i < mCheckSteps || slice.elapsed() >= SliceTime )
+                break;
+        }
+        // look at the clock about eight times a slice
+        mCheckSteps = qBound( 1, steps / 8, 4096 );
+        mRunSteps += steps;
+        reportSpeed( mAbort || hit );
+        if ( hit )
+            breakHit();
+    }
     if ( mAbort ) {
         mTimer->stop();
         finish();
@@ -115,16 +155,202 @@ void RunController::tick()
     }
 }
 
+void RunController::reportSpeed( bool final )
+{
+    int elapsed = mRunTime.elapsed();
+    if ( !final && elapsed - mLastReport < 500 )
+        return;
+    mLastReport = elapsed;
+    emit speedChanged( elapsed > 0 ? int( mRunSteps * 1000 / elapsed ) : 0 );
+    if ( mDebugging )
+        reportHistory();
+}
+
 void RunController::step()
 {
-    if ( !mPrepared )
+    QMutexLocker locker( &mMutex );
+    if ( !mPrepared || !mDebugging || !canStep() )
+        return;
+    debugStep();
+    reportHistory();
+}
+
+void RunController::stepBack()
+{
+    piet_state state;
+    piet_get_state( &state );
+    goToStep( int( state.exec_step ) - 1 );
+}
+
+void RunController::goToStep( int n )
+{
+    QMutexLocker locker( &mMutex );
+    if ( !mPrepared || !mDebugging || mTimer->isActive() || !canStep() || mCheckpoints.isEmpty() )
+        return;
+
+    piet_state state;
+    piet_get_state( &state );
+    const unsigned target = unsigned( qMax( n, int( mCheckpoints.first().step ) ) );
+    if ( target == state.exec_step )
         return;
+
+    if ( target < state.exec_step ) {
+        // the last checkpoint up to the target
+        int i = mCheckpoints.size() - 1;
+        while ( i > 0 && mCheckpoints[i].step > target )
+            --i;
+        const Checkpoint &cp = mCheckpoints[i];
+        state.exec_step = cp.step;
+        state.x = cp.x;
+        state.y = cp.y;
+        state.dp = cp.dp;
+        state.cc = cp.cc;
+        state.num_stack = cp.stack.size();
+        state.stack = cp.stack.constData();
+        if ( piet_set_state( &state ) < 0 )
+            return;
+        mInputPos = cp.input;
+    }
+
+    // no trace on the way, and the output of the steps made before
+    // was shown already
+    mJumping = true;
+    bool silent = true;
+    register_output_callback( discardOutput, 0 );
+    while ( !mCancel && state.exec_step < target ) {
+        if ( silent && state.exec_step >= mLastStep ) {
+            register_output_callback( 0, 0 );
+            silent = false;
+        }
+        if ( debugStep() < 0 )
+            break;
+        piet_get_state( &state );
+    }
+    if ( silent )
+        register_output_callback( 0, 0 );
+    mJumping = false;
+
+    publishJump();
+    reportHistory();
+}
+
+int RunController::debugStep()
+{
+    piet_state state;
+    piet_get_state( &state );
+    if ( mCheckpoints.isEmpty() || state.exec_step >= mCheckpoints.last().step + CheckpointInterval )
+        checkpoint();
     int res = piet_step();
+    piet_get_state( &state );
+    mLastStep = qMax( mLastStep, state.exec_step );
+    return res;
+}
+
+void RunController::checkpoint()
+{
+    piet_state state;
+    piet_get_state( &state );
+    Checkpoint cp;
+    cp.step = state.exec_step;
+    cp.x = state.x;
+    cp.y = state.y;
+    cp.dp = state.dp;
+    cp.cc = state.cc;
+    cp.stack.resize( state.num_stack );
+    qCopy( state.stack, state.stack + state.num_stack, cp.stack.begin() );
+    cp.input = mInputPos;
+    mCheckpoints.append( cp );
+}
+
+void RunController::clearHistory()
+{
+    piet_state state;
+    piet_get_state( &state );
+    mCheckpoints.clear();
+    mInput.clear();
+    mInputPos = 0;
+    mLastStep = state.exec_step;
+    checkpoint();
+    reportHistory();
+}
+
+void RunController::reportHistory()
+{
+    if ( !mCheckpoints.isEmpty() )
+        emit historyChanged( mCheckpoints.first().step, mLastStep );
+}
+
+void RunController::publishJump()
+{
+    piet_state state;
+    piet_get_state( &state );
+    QVector<long> stack( state.num_stack );
+    qCopy( state.stack, state.stack + state.num_stack, stack.begin() );
+    mTraceRing.setSnapshot( stack );
+
+    TraceEvent* event = mTraceRing.reserve();
+    if ( !event )
+        return;
+    event->setJump( &state );
+    mTraceRing.publish();
+    if ( mTraceRing.needsNotify() )
+        emit traceReady();
+}
+
+void RunController::breakHit()
+{
+    mTimer->stop();
+    if ( mExecuting ) {
+        // there was no trace, the debugging starts with the state here
+        mExecuting = false;
+        mDebugging = true;
+        emit debugStarted();
+        clearHistory();
+        publishJump();
+    }
+    emit breakpointHit( piet_context_default()->break_watch );
+}
+
+void RunController::setBreakpoint( int x, int y, bool on )
+{
+    piet_set_breakpoint( x, y, on );
+}
+
+void RunController::addWatchpoint( int kind, int value )
+{
+    piet_add_watch( kind, value );
+}
+
+void RunController::clearWatchpoints()
+{
+    piet_clear_watches();
+}
+
+void RunController::discardOutput( void* object, const char* str, int len )
+{
+    Q_UNUSED( object )
+    Q_UNUSED( str )
+    Q_UNUSED( len )
+}
+
+void RunController::debugContinue()
+{
+    if ( !mPrepared || !mDebugging || mTimer->isActive() )
+        return;
+    startRun();
+}
+
+void RunController::debugPause()
+{
+    if ( mDebugging )
+        mTimer->stop();
 }
 
 void RunController::abort()
 {
     qDebug() << "abort!";
+    // ends the running batch, so the lock comes free soon
+    mCancel = 1;
     QMutexLocker locker( &mMutex );
     stop();
 }
@@ -165,10 +391,13 @@ void RunController::debugSource( const QImage& source )
     mMutex.lock();
     stop();
     mDebugging = true;
+    mCancel = 0;
     mMutex.unlock();
     if ( !initialize( source ) )
         abort();
     emit debugStarted();
+    if ( mPrepared )
+        clearHistory();
 }
 
 void RunController::pixelChanged( int x, int y, QRgb color )
@@ -182,6 +411,10 @@ void RunController::pixelChanged( int x, int y, QRgb color )
             col_idx = ( /*unknown_color*/1 == 0 ? c_black : c_white );
         }
         set_cell( x, y, col_idx );
+        // the program is another one now: going back would not make
+        // the same steps again, going on may not read the same input
+        if ( mDebugging )
+            clearHistory();
     }
 }
 
@@ -222,24 +455,13 @@ void RunController::finish()
 
 bool RunController::prepare()
 {
-//     image = mSource.convertToFormat( QImage::Format_RGB32 );
-    QRgb* cells = ( QRgb* ) mSource.bits();
-    set_image( mSource.width(), mSource.height() );
-    for ( int i = 0; i < mSource.height(); ++i ) {
-        QRgb* lineptr = ( QRgb* ) mSource.scanLine( i );
-        for ( int j = 0; j < mSource.width(); ++j ) {
-            int r = qRed( lineptr[j] );
-            int g = qGreen( lineptr[j] );
-            int b = qBlue( lineptr[j] );
-            int col = (( r * 256 + g ) * 256 ) + b;
-            int col_idx = get_color_idx( col );
-            if ( col_idx < 0 ) {
-                /* set to black or white: */
-                col_idx = ( /*unknown_color*/1 == 0 ? c_black : c_white );
-            }
-            set_cell( j, i, col_idx );
-        }
-    }
+    if ( mSource.format() != QImage::Format_RGB32 && mSource.format() != QImage::Format_ARGB32 )
+        mSource = mSource.convertToFormat( QImage::Format_RGB32 );
+    const QImage &source = mSource;
+    set_image( source.width(), source.height() );
+    // unknown colors become white, as unknown_color defaults to
+    for ( int i = 0; i < source.height(); ++i )
+        set_row( i, source.scanLine( i ), piet_row_argb32 );
     mPrepared = true;
     return mPrepared;
 }
@@ -249,28 +471,41 @@ void RunController::stdoutReadyRead()
     emit newOutput( mStdOut->readAll() );
 }
 
-void RunController::slotAction( trace_action* act )
+TraceRing* RunController::traceRing()
 {
-    if ( mDebugging )
-        emit actionChanged( act );
+    return &mTraceRing;
 }
 
-void RunController::slotStepped( trace_step* step )
+bool RunController::isTracing() const
 {
-    if ( mDebugging )
-        emit stepped( step );
+    return mDebugging && !mJumping;
+}
+
+bool RunController::canStep() const
+{
+    // a step pushes at most a step and an action event
+    return mTraceRing.overflowPolicy() == TraceRing::DropOldest || mTraceRing.freeSlots() >= 2;
 }
 
 char RunController::getChar()
 {
+    // a step made again reads what it read before
+    if ( mDebugging && mInputPos < mInput.size() )
+        return char( mInput[mInputPos++] );
 //     QMutexLocker locker( &mMutex );
     emit waitingForChar();
     mWaitCond.wait( &mMutex );
+    if ( mDebugging ) {
+        mInput.append( mChar );
+        mInputPos = mInput.size();
+    }
     return mChar;
 }
 
 int RunController::getInt()
 {
+    if ( mDebugging && mInputPos < mInput.size() )
+        return mInput[mInputPos++];
 //     qDebug() << "getInt()" << "getting lock";
 //     QMutexLocker locker( &mMutex );
 //     qDebug() << "getInt()" << "got lock";
@@ -283,6 +518,10 @@ int RunController::getInt()
     qDebug() << "getInt()" << "woke up!" << mInt;
     if ( timer_running )
         mTimer->start();
+    if ( mDebugging ) {
+        mInput.append( mInt );
+        mInputPos = mInput.size();
+    }
     return mInt;
 }
 
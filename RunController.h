@@ -26,6 +26,11 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QTimer>
+#include <QTime>
+#include <QAtomicInt>
+#include <QVector>
+
+#include "TraceRing.h"
 
 #ifdef Q_WS_WIN
 #include <io.h>
@@ -36,9 +41,6 @@
 class QSocketNotifier;
 class NPietObserver;
 
-struct trace_step;
-struct trace_action;
-
 class RunController : public QObject
 {
     Q_OBJECT
@@ -52,14 +54,29 @@ public:
     int getInt();
     char getChar();
 
+    /** steps and actions while debugging, drained by the GUI thread */
+    TraceRing* traceRing();
+    bool isTracing() const;
+
+    /** steps between the checkpoints of a debugged run */
+    static const int CheckpointInterval = 1024;
+
 signals:
     void newOutput( const QString & );
-    void stepped( trace_step* );
-    void actionChanged( trace_action* );
+    void traceReady();
     void stopped();
     void debugStarted();
     void waitingForInt();
     void waitingForChar();
+    /** while executing, about twice a second and once at the end */
+    void speedChanged( int stepsPerSecond );
+    /** the debugged run can go to any step from firstStep to lastStep */
+    void historyChanged( int firstStep, int lastStep );
+    /**
+      * the interpreter stopped at a breakpoint (watch -1) or a watchpoint.
+      * A program executed goes on being debugged from there.
+      */
+    void breakpointHit( int watch );
 
 public slots:
     void slotThreadStarted();
@@ -69,7 +86,24 @@ public slots:
     void pixelChanged( int x, int y, QRgb color );
 
     void step();
+    /** keep stepping while debugging, the trace is still recorded */
+    void debugContinue();
+    void debugPause();
+    /** go back one step of the debugged run */
+    void stepBack();
+    /**
+      * go to step n of the debugged run: from the last checkpoint before
+      * it, or on from here. Steps made before are made again with the
+      * input given then and without output, new ones as by step().
+      */
+    void goToStep( int n );
     void abort();
+
+    /** kept by npiet, which stops on them while stepping */
+    void setBreakpoint( int x, int y, bool on );
+    /** a piet_watch_* watchpoint, see npiet.h */
+    void addWatchpoint( int kind, int value );
+    void clearWatchpoints();
 private slots:
     void stdoutReadyRead();
 	void win32OutputTimeout();
@@ -77,15 +111,22 @@ private slots:
     bool initialize( const QImage &source );
     void execute();
 
-    void slotStepped( trace_step* );
-    void slotAction( trace_action* );
-
     void tick();
 
 private:
     void captureStdout();
     bool prepare();
+    void startRun();
     void finish();
+    bool canStep() const;
+    void reportSpeed( bool final );
+    int debugStep();
+    void checkpoint();
+    void clearHistory();
+    void reportHistory();
+    void publishJump();
+    void breakHit();
+    static void discardOutput( void* object, const char* str, int len );
 
     /** Call with mutex locked */
     void stop();
@@ -105,6 +146,7 @@ private:
 
     // Reacting to notifications from npiet
     NPietObserver* mObserver;
+    TraceRing mTraceRing;
 
 
     bool mPrepared;
@@ -113,6 +155,7 @@ private:
     QMutex mMutex;
     QWaitCondition mWaitCond;
     bool mAbort;
+    QAtomicInt mCancel; /**< set by abort() without the lock, seen between batches */
     bool mExecuting;
     bool mDebugging;
     QTimer* mTimer;
@@ -120,6 +163,26 @@ private:
 
     char mChar;
     int mInt;
+
+    // time travel while debugging: the state every CheckpointInterval
+    // steps and all input read; the steps between are made again
+    struct Checkpoint {
+        unsigned step;
+        int x, y, dp, cc;
+        QVector<long> stack;
+        int input; /**< values of mInput read before */
+    };
+    QVector<Checkpoint> mCheckpoints;
+    QVector<int> mInput;
+    int mInputPos; /**< the next value of mInput to read again */
+    unsigned mLastStep; /**< the furthest step reached */
+    bool mJumping;
+
+    // execution speed
+    int mCheckSteps; /**< steps between looks at the clock */
+    qint64 mRunSteps;
+    QTime mRunTime;
+    int mLastReport;
 };
 
 #endif // RUNCONTROLLER_H
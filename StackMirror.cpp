@@ -0,0 +1,84 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "StackMirror.h"
+
+#include <algorithm>
+
+StackMirror::StackMirror()
+{
+    clear();
+}
+
+void StackMirror::clear()
+{
+    mStack.clear();
+    mLast.popped = 0;
+    mLast.pushed = 0;
+    mLast.roll_depth = 0;
+    mLast.roll_count = 0;
+}
+
+void StackMirror::setStack( const QVector<long> &stack )
+{
+    clear();
+    mStack = stack;
+}
+
+void StackMirror::apply( const stack_delta &delta )
+{
+    mLast = delta;
+
+    int popped = qMin( delta.popped, mStack.size() );
+    mLast.popped = popped;
+    for ( int i = 0; i < popped; ++i )
+        mPopped[i] = mStack[mStack.size() - popped + i];
+    mStack.resize( mStack.size() - popped );
+
+    if ( delta.roll_depth > 1 && delta.roll_depth <= mStack.size() ) {
+        // the top value goes roll_count places down
+        long* end = mStack.data() + mStack.size();
+        std::rotate( end - delta.roll_depth, end - delta.roll_count, end );
+    } else {
+        mLast.roll_depth = 0;
+    }
+
+    for ( int i = 0; i < delta.pushed; ++i )
+        mStack.append( delta.values[i] );
+}
+
+const QVector<long>& StackMirror::after() const
+{
+    return mStack;
+}
+
+QVector<long> StackMirror::before() const
+{
+    QVector<long> stack = mStack;
+    stack.resize( stack.size() - mLast.pushed );
+
+    if ( mLast.roll_depth > 1 ) {
+        long* end = stack.data() + stack.size();
+        std::rotate( end - mLast.roll_depth, end - mLast.roll_depth + mLast.roll_count, end );
+    }
+
+    for ( int i = 0; i < mLast.popped; ++i )
+        stack.append( mPopped[i] );
+    return stack;
+}
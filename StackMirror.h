@@ -17,38 +17,45 @@
     02110-1301, USA.
 */
 
-#ifndef PIXELDELEGATE_H
-#define PIXELDELEGATE_H
+#ifndef STACKMIRROR_H
+#define STACKMIRROR_H
 
-#include <QStyledItemDelegate>
+#include <QVector>
 
-class ViewMonitor;
-class UndoHandler;
-class QMenu;
-
-class PixelDelegate : public QStyledItemDelegate
+extern "C"
+{
+#include "npiet/npiet_utils.h"
+}
+
+/**
+  * Rebuilds the interpreter stack from the stack_delta of every action,
+  * so npiet never has to hand out copies of the whole stack.
+  */
+class StackMirror
 {
-    Q_OBJECT
-
 public:
-    PixelDelegate( ViewMonitor* monitor,UndoHandler* handler, QMenu* menu, QObject *parent = 0 );
-    virtual ~PixelDelegate() {}
+    StackMirror();
 
-    void paint( QPainter *painter, const QStyleOptionViewItem &option,
-                const QModelIndex &index ) const;
+    void clear();
 
-    QSize sizeHint( const QStyleOptionViewItem &option,
-                    const QModelIndex &index ) const;
+    /** start again from a whole stack, bottom first */
+    void setStack( const QVector<long> &stack );
 
-    bool editorEvent( QEvent* event, QAbstractItemModel* model, const QStyleOptionViewItem& option, const QModelIndex& index );
+    /** apply the change of the next action */
+    void apply( const stack_delta &delta );
 
-signals:
-    void imageEdited();
+    /** the stack after the last action, bottom first */
+    const QVector<long>& after() const;
+
+    /** the stack before the last action, rebuilt on each call */
+    QVector<long> before() const;
 
 private:
-    ViewMonitor* mMonitor;
-    UndoHandler* mUndoHandler;
-    QMenu* mContextMenu;
+    QVector<long> mStack;
+
+    // enough of the last action to undo it
+    stack_delta mLast;
+    long mPopped[3];
 };
 
-#endif
\ No newline at end of file
+#endif // STACKMIRROR_H
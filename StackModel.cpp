@@ -0,0 +1,165 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "StackModel.h"
+
+#include <algorithm>
+
+StackModel::StackModel( QObject* parent ) : QAbstractListModel( parent ), mMode( FullStack ), mTopRows( 64 )
+{
+}
+
+StackModel::~StackModel()
+{
+}
+
+StackModel::Mode StackModel::mode() const
+{
+    return mMode;
+}
+
+void StackModel::setMode( Mode mode )
+{
+    if ( mode == mMode )
+        return;
+    mMode = mode;
+    reset();
+}
+
+int StackModel::topRows() const
+{
+    return mTopRows;
+}
+
+void StackModel::setTopRows( int rows )
+{
+    mTopRows = qMax( 1, rows );
+    if ( mMode == TopOfStack )
+        reset();
+}
+
+void StackModel::clear()
+{
+    setStack( QVector<long>() );
+}
+
+void StackModel::setStack( const QVector<long> &stack )
+{
+    mStack = stack;
+    reset();
+}
+
+const QVector<long>& StackModel::stack() const
+{
+    return mStack;
+}
+
+void StackModel::apply( const stack_delta &delta )
+{
+    if ( mMode == FullStack )
+        applyFull( delta );
+    else
+        applyTop( delta );
+}
+
+// row 0 is the top of the stack, the end of mStack
+void StackModel::applyFull( const stack_delta &delta )
+{
+    int popped = qMin( delta.popped, mStack.size() );
+    if ( popped > 0 ) {
+        beginRemoveRows( QModelIndex(), 0, popped - 1 );
+        mStack.resize( mStack.size() - popped );
+        endRemoveRows();
+    }
+
+    // the top roll_count values go below the rest of the rolled ones
+    if ( delta.roll_depth > 1 && delta.roll_depth <= mStack.size() && delta.roll_count > 0 ) {
+        beginMoveRows( QModelIndex(), 0, delta.roll_count - 1, QModelIndex(), delta.roll_depth );
+        long* end = mStack.data() + mStack.size();
+        std::rotate( end - delta.roll_depth, end - delta.roll_count, end );
+        endMoveRows();
+    }
+
+    if ( delta.pushed > 0 ) {
+        beginInsertRows( QModelIndex(), 0, delta.pushed - 1 );
+        for ( int i = 0; i < delta.pushed; ++i )
+            mStack.append( delta.values[i] );
+        endInsertRows();
+    }
+}
+
+// the rows stay put, only their values and the depth row change
+void StackModel::applyTop( const stack_delta &delta )
+{
+    const int before = rowsFor( mStack.size() );
+
+    int popped = qMin( delta.popped, mStack.size() );
+    mStack.resize( mStack.size() - popped );
+    if ( delta.roll_depth > 1 && delta.roll_depth <= mStack.size() ) {
+        long* end = mStack.data() + mStack.size();
+        std::rotate( end - delta.roll_depth, end - delta.roll_count, end );
+    }
+    for ( int i = 0; i < delta.pushed; ++i )
+        mStack.append( delta.values[i] );
+
+    const int after = rowsFor( mStack.size() );
+    if ( after > before ) {
+        beginInsertRows( QModelIndex(), before, after - 1 );
+        endInsertRows();
+    } else if ( after < before ) {
+        beginRemoveRows( QModelIndex(), after, before - 1 );
+        endRemoveRows();
+    }
+    if ( after > 0 )
+        emit dataChanged( index( 0 ), index( after - 1 ) );
+}
+
+int StackModel::rowsFor( int depth ) const
+{
+    if ( mMode == FullStack || depth <= mTopRows )
+        return depth;
+    return mTopRows + 1;
+}
+
+int StackModel::rowCount( const QModelIndex &parent ) const
+{
+    if ( parent.isValid() )
+        return 0;
+    return rowsFor( mStack.size() );
+}
+
+QVariant StackModel::data( const QModelIndex &index, int role ) const
+{
+    if ( !index.isValid() || role != Qt::DisplayRole )
+        return QVariant();
+
+    const int depth = mStack.size();
+    if ( mMode == TopOfStack && index.row() == mTopRows )
+        return tr( "... %1 more" ).arg( depth - mTopRows );
+    if ( index.row() >= depth )
+        return QVariant();
+
+    long val = mStack[depth - index.row() - 1];
+    QString character;
+    if ( val >= 32 && val <= 126 )
+        character = QString( "(char: '%1')" ).arg( ( char ) val );
+    return QString( "%1 %2" ).arg( val ).arg( character );
+}
+
+#include "StackModel.moc"
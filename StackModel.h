@@ -0,0 +1,75 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef STACKMODEL_H
+#define STACKMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+extern "C"
+{
+#include "npiet/npiet_utils.h"
+}
+
+/**
+  * The interpreter stack as a list, top value first. Actions are applied
+  * as their stack_delta, announced as the rows they insert, remove and
+  * move, so a view only has to lay out and draw what changed and what is
+  * visible, however deep the stack is.
+  */
+class StackModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    enum Mode {
+        FullStack, /**< a row per value */
+        TopOfStack /**< the top values and a row with the remaining depth */
+    };
+
+    explicit StackModel( QObject* parent = 0 );
+    virtual ~StackModel();
+
+    Mode mode() const;
+    void setMode( Mode mode );
+    /** how many values TopOfStack shows */
+    int topRows() const;
+    void setTopRows( int rows );
+
+    void clear();
+    /** replace the whole stack, bottom first */
+    void setStack( const QVector<long> &stack );
+    /** apply the change of the next action */
+    void apply( const stack_delta &delta );
+    const QVector<long>& stack() const;
+
+    int rowCount( const QModelIndex &parent = QModelIndex() ) const;
+    QVariant data( const QModelIndex &index, int role = Qt::DisplayRole ) const;
+
+private:
+    int rowsFor( int depth ) const;
+    void applyFull( const stack_delta &delta );
+    void applyTop( const stack_delta &delta );
+
+    QVector<long> mStack;
+    Mode mMode;
+    int mTopRows;
+};
+
+#endif // STACKMODEL_H
@@ -0,0 +1,183 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "TraceRing.h"
+
+extern "C"
+{
+#include "npiet/npiet.h"
+}
+
+#include <QByteArray>
+
+// the counters run freely and wrap, only their difference matters
+static inline int next( int counter )
+{
+    return int( unsigned( counter ) + 1 );
+}
+
+static inline unsigned distance( int from, int to )
+{
+    return unsigned( to ) - unsigned( from );
+}
+
+void TraceEvent::setStep( const trace_step *step )
+{
+    type = Step;
+    executionStep = step->execution_step;
+    xpos = step->n_xpos;
+    ypos = step->n_ypos;
+    dp = step->n_dp;
+    cc = step->n_cc;
+}
+
+void TraceEvent::setAction( const trace_action *action )
+{
+    type = Action;
+    hueChange = action->hue_change;
+    lightChange = action->light_change;
+    value = action->value;
+    qstrncpy( message, action->msg ? action->msg : "", MessageLength );
+    numStack = action->num_stack;
+    delta = action->delta;
+}
+
+void TraceEvent::setJump( const piet_state *state )
+{
+    type = Jump;
+    // as if the step before had just been made
+    executionStep = int( state->exec_step ) - 1;
+    xpos = state->x;
+    ypos = state->y;
+    dp = state->dp;
+    cc = state->cc;
+    numStack = state->num_stack;
+}
+
+
+TraceRing::TraceRing( int capacity, OverflowPolicy policy ) : mPolicy( policy ), mHead( 0 ), mTail( 0 ), mDropped( 0 ), mNotifyPending( 0 )
+{
+    // a power of two, so the slot survives the counters wrapping
+    mCapacity = 1;
+    while ( mCapacity < capacity )
+        mCapacity *= 2;
+    mEvents = new TraceEvent[mCapacity];
+}
+
+TraceRing::~TraceRing()
+{
+    delete[] mEvents;
+}
+
+TraceRing::OverflowPolicy TraceRing::overflowPolicy() const
+{
+    return mPolicy;
+}
+
+void TraceRing::setOverflowPolicy( OverflowPolicy policy )
+{
+    mPolicy = policy;
+}
+
+int TraceRing::capacity() const
+{
+    return mCapacity;
+}
+
+bool TraceRing::isEmpty() const
+{
+    return int( mHead ) == int( mTail );
+}
+
+bool TraceRing::isFull() const
+{
+    return freeSlots() == 0;
+}
+
+int TraceRing::freeSlots() const
+{
+    return mCapacity - int( distance( mTail, mHead ) );
+}
+
+int TraceRing::dropped() const
+{
+    return mDropped;
+}
+
+TraceEvent* TraceRing::reserve()
+{
+    int head = mHead;
+    forever {
+        int tail = mTail.fetchAndAddAcquire( 0 );
+        if ( distance( tail, head ) < unsigned( mCapacity ) )
+            break;
+        if ( mPolicy == Backpressure )
+            return 0;
+        // take the oldest event from the consumer; if it got there first
+        // there is room now
+        if ( mTail.testAndSetOrdered( tail, next( tail ) ) ) {
+            mDropped.ref();
+            break;
+        }
+    }
+    return &mEvents[head & ( mCapacity - 1 )];
+}
+
+void TraceRing::publish()
+{
+    mHead.fetchAndStoreRelease( next( mHead ) );
+}
+
+bool TraceRing::needsNotify()
+{
+    return mNotifyPending.testAndSetOrdered( 0, 1 );
+}
+
+bool TraceRing::pop( TraceEvent &event )
+{
+    forever {
+        int tail = mTail.fetchAndAddAcquire( 0 );
+        int head = mHead.fetchAndAddAcquire( 0 );
+        if ( tail == head )
+            return false;
+
+        event = mEvents[tail & ( mCapacity - 1 )];
+        // if the producer dropped the event meanwhile the copy may be
+        // torn, move on to the next one
+        if ( mTail.testAndSetOrdered( tail, next( tail ) ) )
+            return true;
+    }
+}
+
+void TraceRing::beginDrain()
+{
+    mNotifyPending.fetchAndStoreOrdered( 0 );
+}
+
+void TraceRing::setSnapshot( const QVector<long> &stack )
+{
+    QMutexLocker locker( &mSnapshotMutex );
+    mSnapshot = stack;
+}
+
+QVector<long> TraceRing::snapshot() const
+{
+    QMutexLocker locker( &mSnapshotMutex );
+    return mSnapshot;
+}
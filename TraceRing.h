@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+
+extern "C"
+{
+#include "npiet/npiet_utils.h"
+}
+
+struct piet_state;
+
+/**
+  * A step or an action of the interpreter, copied out of npiet so it
+  * can cross threads. Actions carry the change of the stack, see
+  * StackMirror. A Jump says the debugger went to another step; the
+  * stack is in TraceRing::snapshot() then.
+  */
+struct TraceEvent {
+    enum Type { Step, Action, Jump };
+
+    static const int MessageLength = 64;
+
+    Type type;
+
+    // Step and Jump
+    int executionStep;
+    int xpos, ypos; /**< the codel the step went to */
+    int dp, cc;
+
+    // Action
+    int hueChange, lightChange;
+    int value;
+    char message[MessageLength];
+    int numStack; /**< depth after the action */
+    stack_delta delta;
+
+    void setStep( const trace_step *step );
+    void setAction( const trace_action *action );
+    void setJump( const piet_state *state );
+};
+
+/**
+  * A fixed size single producer, single consumer queue of TraceEvents.
+  * The interpreter thread pushes, the GUI thread pops; neither locks and
+  * no memory is allocated after construction.
+  */
+class TraceRing
+{
+public:
+    enum OverflowPolicy {
+        DropOldest, /**< push always succeeds, the oldest event is lost */
+        Backpressure /**< push fails, the producer should wait; needed when
+                          every event counts, like the stack deltas */
+    };
+
+    explicit TraceRing( int capacity = 256, OverflowPolicy policy = DropOldest );
+    ~TraceRing();
+
+    OverflowPolicy overflowPolicy() const;
+    void setOverflowPolicy( OverflowPolicy policy );
+
+    int capacity() const;
+    bool isEmpty() const;
+    bool isFull() const;
+    int freeSlots() const;
+
+    /** events lost to DropOldest */
+    int dropped() const;
+
+    /**
+      * Producer only: reserve the next slot. Fill it and publish() it,
+      * or get 0 if the ring is full under Backpressure.
+      */
+    TraceEvent* reserve();
+    void publish();
+
+    /**
+      * Producer only: true once per batch of events, when the consumer
+      * should be told to drain the ring.
+      */
+    bool needsNotify();
+
+    /** Consumer only: copy the oldest event into event. */
+    bool pop( TraceEvent &event );
+
+    /**
+      * Consumer only: call before draining, so events published while
+      * draining ask for another notification.
+      */
+    void beginDrain();
+
+    /**
+      * Producer: the whole stack for the next Jump event, set before it
+      * is published. A later jump replaces it, its event comes later too.
+      */
+    void setSnapshot( const QVector<long> &stack );
+    /** Consumer: the stack of the last Jump event */
+    QVector<long> snapshot() const;
+
+private:
+    Q_DISABLE_COPY( TraceRing )
+
+    TraceEvent* mEvents;
+    int mCapacity;
+    OverflowPolicy mPolicy;
+
+    // running counters, the slot is counter % mCapacity
+    QAtomicInt mHead; /**< next slot to write, only the producer moves it */
+    QAtomicInt mTail; /**< oldest unread slot */
+    QAtomicInt mDropped;
+    QAtomicInt mNotifyPending;
+
+    // jumps are rare, their stack is handed over under a lock
+    mutable QMutex mSnapshotMutex;
+    QVector<long> mSnapshot;
+};
+
+#endif // TRACERING_H
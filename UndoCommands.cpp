@@ -21,77 +21,158 @@
 
 #include "ImageModel.h"
 
-#include <QDebug>
+ImageSnapshot::ImageSnapshot()
+{
+}
+
+ImageSnapshot::ImageSnapshot( const QImage& image, const QRegion& changed ) : mSize( image.size() )
+{
+    const QRect bounds = changed.boundingRect() & image.rect();
+    if ( bounds.isEmpty() )
+        return;
+    for ( int ty = bounds.top() / TileSize; ty <= bounds.bottom() / TileSize; ++ty ) {
+        for ( int tx = bounds.left() / TileSize; tx <= bounds.right() / TileSize; ++tx ) {
+            QRect tile = QRect( tx * TileSize, ty * TileSize, TileSize, TileSize ) & image.rect();
+            if ( changed.intersects( tile ) )
+                mTiles.append( qMakePair( tile.topLeft(), image.copy( tile ) ) );
+        }
+    }
+}
+
+QSize ImageSnapshot::size() const
+{
+    return mSize;
+}
 
-EditPixelCommand::EditPixelCommand(int x, int y, QColor old_color, QColor new_color, ImageModel * model, QUndoCommand* parent)
-    : QUndoCommand(parent)
-    , mX(x)
-    , mY(y)
-    , mBefore(old_color)
-    , mAfter(new_color)
-    , mModel(model)
+int ImageSnapshot::tileCount() const
 {
+    return mTiles.size();
+}
 
+void ImageSnapshot::restore( ImageModel* model ) const
+{
+    if ( model->imageSize() != mSize )
+        model->scaleImage( mSize );
+    for ( int i = 0; i < mTiles.size(); ++i )
+        model->setPixels( mTiles.at( i ).second, mTiles.at( i ).first.x(), mTiles.at( i ).first.y() );
 }
 
-void EditPixelCommand::redo()
+StrokeCommand::StrokeCommand( int x, int y, QRgb before, QRgb after, bool continued, ImageModel* model, QUndoCommand* parent )
+    : QUndoCommand( parent )
+    , mAfter( after )
+    , mContinued( continued )
+    , mModel( model )
 {
-    mModel->setData( mModel->index(mY, mX), mAfter, Qt::DisplayRole );
+    append( x, y, before );
 }
 
-void EditPixelCommand::undo()
+void StrokeCommand::redo()
 {
-    qDebug() << "me undo: " << mBefore << mAfter;
-    mModel->setData( mModel->index(mY, mX), mBefore, Qt::DisplayRole );
+    const QColor after( mAfter );
+    for ( int i = 0; i < mRuns.size(); ++i ) {
+        const Run& run = mRuns.at( i );
+        for ( int x = run.x; x < run.x + run.length; ++x )
+            mModel->setData( mModel->index( run.y, x ), after, Qt::DisplayRole );
+    }
 }
 
-bool EditPixelCommand::mergeWith(const QUndoCommand* command)
+void StrokeCommand::undo()
 {
-    const EditPixelCommand *editPixelCommand = static_cast<const EditPixelCommand *>(command);
-    if( editPixelCommand->mX == mX && editPixelCommand->mY == mY )
-        return mAfter == editPixelCommand->mAfter;
+    for ( int i = mRuns.size() - 1; i >= 0; --i ) {
+        const Run& run = mRuns.at( i );
+        const QColor before( run.before );
+        for ( int x = run.x; x < run.x + run.length; ++x )
+            mModel->setData( mModel->index( run.y, x ), before, Qt::DisplayRole );
+    }
+}
+
+bool StrokeCommand::mergeWith( const QUndoCommand* command )
+{
+    const StrokeCommand *stroke = static_cast<const StrokeCommand *>( command );
+    if ( !stroke->mContinued || stroke->mAfter != mAfter )
+        return false;
+    // a pixel painted twice keeps the color it had before the stroke
+    for ( int i = 0; i < stroke->mRuns.size(); ++i ) {
+        const Run& run = stroke->mRuns.at( i );
+        for ( int x = run.x; x < run.x + run.length; ++x ) {
+            if ( !contains( x, run.y ) )
+                append( x, run.y, run.before );
+        }
+    }
+    return true;
+}
+
+bool StrokeCommand::contains( int x, int y ) const
+{
+    for ( int i = 0; i < mRuns.size(); ++i ) {
+        const Run& run = mRuns.at( i );
+        if ( run.y == y && x >= run.x && x < run.x + run.length )
+            return true;
+    }
     return false;
 }
 
-InsertImageCommand::InsertImageCommand(int x, int y, QImage before, QImage imageToInsert, QSize after, ImageModel* model, QUndoCommand* parent)
-    : QUndoCommand(parent)
-    , mX(x)
-    , mY(y)
-    , mBefore(before)
-    , mAfter(after)
-    , mImageToInsert(imageToInsert)
-    , mModel(model)
+void StrokeCommand::append( int x, int y, QRgb before )
+{
+    if ( !mRuns.isEmpty() ) {
+        Run& last = mRuns.last();
+        if ( last.y == y && last.before == before && x == last.x + last.length ) {
+            ++last.length;
+            return;
+        }
+        if ( last.y == y && last.before == before && x == last.x - 1 ) {
+            --last.x;
+            ++last.length;
+            return;
+        }
+    }
+    Run run = { x, y, 1, before };
+    mRuns.append( run );
+}
+
+InsertImageCommand::InsertImageCommand( int x, int y, QImage imageToInsert, QSize after, ImageModel* model, QUndoCommand* parent )
+    : QUndoCommand( parent )
+    , mX( x )
+    , mY( y )
+    , mBefore( model->image(), QRect( QPoint( x, y ), imageToInsert.size() ) )
+    , mImageToInsert( imageToInsert )
+    , mAfter( after )
+    , mModel( model )
 {
 }
 
 void InsertImageCommand::redo()
 {
-    mModel->scaleImage(mAfter);
-    mModel->insertImage(mImageToInsert, mX, mY);
+    if ( mModel->imageSize() != mAfter )
+        mModel->scaleImage( mAfter );
+    mModel->insertImage( mImageToInsert, mX, mY );
 }
 
 void InsertImageCommand::undo()
 {
-    mModel->setImage(mBefore, 1);
+    mBefore.restore( mModel );
 }
 
-ScaleImageCommand::ScaleImageCommand(QImage before, QSize after, ImageModel* model, QUndoCommand* parent)
-    : QUndoCommand(parent)
-    , mBefore(before)
-    , mAfter(after)
-    , mModel(model)
+// only the part of the image that is cut off has to be kept
+static QRegion cutOff( const QImage& image, const QSize& after )
 {
+    return QRegion( image.rect() ) - QRegion( QRect( QPoint( 0, 0 ), after ) );
+}
 
+ScaleImageCommand::ScaleImageCommand( QSize after, ImageModel* model, QUndoCommand* parent )
+    : QUndoCommand( parent )
+    , mBefore( model->image(), cutOff( model->image(), after ) )
+    , mAfter( after )
+    , mModel( model )
+{
 }
 
 void ScaleImageCommand::redo()
 {
-    mModel->scaleImage(mAfter);
+    mModel->scaleImage( mAfter );
 }
 
 void ScaleImageCommand::undo()
 {
-    mModel->setImage(mBefore, 1);
+    mBefore.restore( mModel );
 }
-
-
@@ -19,35 +19,74 @@
 
 #include <QUndoCommand>
 #include <QImage>
-#include <QColor>
+#include <QList>
+#include <QPair>
+#include <QRegion>
+#include <QVector>
 
 class ImageModel;
 
-class EditPixelCommand : public QUndoCommand
+/**
+  * The parts of an image that an operation is about to change. Only the
+  * tiles that intersect the changed region are kept, and a tile is an
+  * implicitly shared QImage, so copies of a snapshot share the pixels
+  * until one of them is written to.
+  */
+class ImageSnapshot
+{
+public:
+    enum { TileSize = 64 };
+    ImageSnapshot();
+    ImageSnapshot( const QImage& image, const QRegion& changed );
+
+    QSize size() const;
+    int tileCount() const;
+
+    /** bring the model back to the size and the pixels of the snapshot */
+    void restore( ImageModel* model ) const;
+private:
+    QSize mSize;
+    QList<QPair<QPoint, QImage> > mTiles;
+};
+
+/**
+  * Pixels painted with one color in a single drag of the mouse. The old
+  * colors are stored as runs of neighbouring pixels in a row, and the
+  * commands of a drag merge into the one started by the press.
+  */
+class StrokeCommand : public QUndoCommand
 {
 public:
     enum { Id = 1 };
-    EditPixelCommand(int x, int y, QColor old_color, QColor new_color, ImageModel* model, QUndoCommand* parent = 0 );
+    StrokeCommand( int x, int y, QRgb before, QRgb after, bool continued, ImageModel* model, QUndoCommand* parent = 0 );
     void undo();
     void redo();
-    bool mergeWith(const QUndoCommand *command);
+    bool mergeWith( const QUndoCommand *command );
     int id() const { return Id; }
 private:
-    int mX, mY;
-    QColor mBefore,mAfter;
+    struct Run {
+        int x, y, length;
+        QRgb before;
+    };
+    bool contains( int x, int y ) const;
+    void append( int x, int y, QRgb before );
+
+    QVector<Run> mRuns;
+    QRgb mAfter;
+    bool mContinued;
     ImageModel *mModel;
-    
 };
 
 class InsertImageCommand : public QUndoCommand
 {
 public:
-    InsertImageCommand(int x, int y, QImage before, QImage imageToInsert, QSize after, ImageModel* model, QUndoCommand* parent = 0 );
+    InsertImageCommand( int x, int y, QImage imageToInsert, QSize after, ImageModel* model, QUndoCommand* parent = 0 );
     void undo();
     void redo();
 private:
     int mX, mY;
-    QImage mBefore,mImageToInsert;
+    ImageSnapshot mBefore;
+    QImage mImageToInsert;
     QSize mAfter;
     ImageModel *mModel;
 };
@@ -55,11 +94,11 @@ private:
 class ScaleImageCommand : public QUndoCommand
 {
 public:
-    ScaleImageCommand(QImage before, QSize after,  ImageModel* model, QUndoCommand* parent = 0);
+    ScaleImageCommand( QSize after, ImageModel* model, QUndoCommand* parent = 0 );
     void undo();
     void redo();
 private:
-    QImage mBefore;
+    ImageSnapshot mBefore;
     QSize mAfter;
     ImageModel *mModel;
 };
@@ -5,7 +5,6 @@
 #include "UndoCommands.h"
 
 #include <QUndoStack>
-#include <QDebug>
 
 UndoHandler::UndoHandler( QUndoStack* undostack, ImageModel* model ) : mUndoStack( undostack ), mModel( model )
 {
@@ -13,33 +12,20 @@ UndoHandler::UndoHandler( QUndoStack* undostack, ImageModel* model ) : mUndoStac
 
 void UndoHandler::createEditPixel(int x, int y, QColor new_color, bool dragging)
 {
-    qDebug() << "createEditPixel" << dragging;
-    EditPixelCommand* parent = 0;
-    if (dragging) {
-        const QUndoCommand* cmd = mUndoStack->command( mUndoStack->index() );
-        const EditPixelCommand* const_parent = dynamic_cast<const EditPixelCommand*>(cmd);
-        qDebug() << const_parent;
-        if( const_parent )
-            parent = const_cast<EditPixelCommand*>(const_parent);
-    }
-    QColor old_color = mModel->data( mModel->index(y, x), Qt::DisplayRole ).value<QColor>();
-    EditPixelCommand *cmd = new EditPixelCommand(x, y, old_color, new_color, mModel, parent );
+    QRgb old_color = mModel->data( mModel->index(y, x), Qt::DisplayRole ).value<QColor>().rgb();
+    // while dragging the command merges into the stroke on top of the stack
+    StrokeCommand *cmd = new StrokeCommand(x, y, old_color, new_color.rgb(), dragging, mModel);
     mUndoStack->push(cmd);
 }
 
 void UndoHandler::insertImage(int x, int y, QImage imageToInsert, QSize scaleAfter)
 {
-    QImage before = mModel->image();
-    InsertImageCommand *cmd = new InsertImageCommand(x,y,before, imageToInsert, scaleAfter, mModel);
+    InsertImageCommand *cmd = new InsertImageCommand(x, y, imageToInsert, scaleAfter, mModel);
     mUndoStack->push(cmd);
 }
 
 void UndoHandler::scaleImage(QSize newSize)
 {
-    QImage before = mModel->image();
-    ScaleImageCommand *cmd = new ScaleImageCommand(before, newSize, mModel);
+    ScaleImageCommand *cmd = new ScaleImageCommand(newSize, mModel);
     mUndoStack->push(cmd);
 }
-
-
-
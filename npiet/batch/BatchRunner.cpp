@@ -0,0 +1,235 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "BatchRunner.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QThreadPool>
+#include <QTime>
+#include <QTextStream>
+
+#include <ctype.h>
+
+extern "C"
+{
+#include "../npiet.h"
+}
+
+static const quint64 FnvOffsetBasis = Q_UINT64_C( 14695981039346656037 );
+static const quint64 FnvPrime = Q_UINT64_C( 1099511628211 );
+
+BatchOptions::BatchOptions() : maxSteps( 0 ), stackLimit( 0 ), codelSize( -1 ), unknownColor( 1 ), version11( false ), toggleBug( false )
+{
+}
+
+BatchResult::BatchResult() : exitReason( piet_exit_none ), steps( 0 ), wallTimeMs( 0 ), peakStack( 0 ), outputHash( FnvOffsetBasis ), outputSize( 0 )
+{
+}
+
+BatchJob::BatchJob( const BatchOptions &options, BatchResult *result ) : mOptions( options ), mResult( result ), mInputPos( 0 )
+{
+}
+
+void BatchJob::run()
+{
+    QTime timer;
+    timer.start();
+
+    if ( !mResult->input.isEmpty() ) {
+        QFile file( mResult->input );
+        if ( file.open( QIODevice::ReadOnly ) )
+            mInput = file.readAll();
+    }
+
+    piet_context *ctx = piet_context_new();
+    ctx->max_exec_step = mOptions.maxSteps;
+    ctx->stack_limit = mOptions.stackLimit;
+    ctx->codel_size = mOptions.codelSize;
+    ctx->unknown_color = mOptions.unknownColor;
+    ctx->version_11 = mOptions.version11;
+    ctx->toggle_bug = mOptions.toggleBug;
+    ctx->quiet = 1;
+
+    piet_ctx_register_readint_callback( ctx, &BatchJob::readInt, this );
+    piet_ctx_register_readchar_callback( ctx, &BatchJob::readChar, this );
+    piet_ctx_register_output_callback( ctx, &BatchJob::output, this );
+
+    if ( load( ctx ) ) {
+        QByteArray log = QFile::encodeName( mResult->log );
+        if ( !log.isEmpty() )
+            piet_ctx_log_open( ctx, log.data() );
+        piet_ctx_run( ctx );
+        piet_ctx_log_close( ctx );
+        mResult->exitReason = ctx->exit_reason;
+        mResult->steps = ctx->exec_step;
+        mResult->peakStack = ctx->peak_stack;
+    } else {
+        mResult->exitReason = BatchResult::Unreadable;
+    }
+
+    piet_context_free( ctx );
+
+    mResult->wallTimeMs = timer.elapsed();
+}
+
+bool BatchJob::load( piet_context *ctx )
+{
+    QByteArray fname = QFile::encodeName( mResult->program );
+
+    if ( piet_ctx_read_png( ctx, fname.data() ) < 0
+            && piet_ctx_read_gif( ctx, fname.data() ) < 0
+            && piet_ctx_read_ppm( ctx, fname.data() ) < 0 )
+        return false;
+
+    if ( ctx->codel_size != 1 && piet_ctx_cleanup_input( ctx ) < 0 )
+        return false;
+
+    return true;
+}
+
+/**
+  * like scanf( "%d" ): skips white space and reads an optional sign
+  * and the digits. there is no way to report a failure to npiet, so
+  * a missing number reads as 0.
+  */
+int BatchJob::readInt( void* object )
+{
+    BatchJob* job = static_cast<BatchJob*>( object );
+    const QByteArray &in = job->mInput;
+    int &pos = job->mInputPos;
+
+    while ( pos < in.size() && isspace( ( unsigned char ) in[pos] ) )
+        ++pos;
+
+    int sign = 1;
+    if ( pos < in.size() && ( in[pos] == '-' || in[pos] == '+' ) ) {
+        sign = in[pos] == '-' ? -1 : 1;
+        ++pos;
+    }
+
+    int val = 0;
+    while ( pos < in.size() && isdigit( ( unsigned char ) in[pos] ) )
+        val = val * 10 + ( in[pos++] - '0' );
+
+    return sign * val;
+}
+
+char BatchJob::readChar( void* object )
+{
+    BatchJob* job = static_cast<BatchJob*>( object );
+    if ( job->mInputPos >= job->mInput.size() )
+        return -1;
+    return job->mInput[job->mInputPos++];
+}
+
+void BatchJob::output( void* object, const char* str, int len )
+{
+    BatchResult* result = static_cast<BatchJob*>( object )->mResult;
+    for ( int i = 0; i < len; ++i ) {
+        result->outputHash ^= ( unsigned char ) str[i];
+        result->outputHash *= FnvPrime;
+    }
+    result->outputSize += len;
+}
+
+
+BatchRunner::BatchRunner( const BatchOptions &options ) : mOptions( options )
+{
+}
+
+void BatchRunner::addProgram( const QString &program, const QString &input )
+{
+    BatchResult result;
+    result.program = program;
+    result.input = input;
+    mResults.append( result );
+}
+
+int BatchRunner::count() const
+{
+    return mResults.size();
+}
+
+void BatchRunner::run( int threads )
+{
+    QThreadPool pool;
+    if ( threads > 0 )
+        pool.setMaxThreadCount( threads );
+
+    // the results do not move from here on, every job owns one slot
+    BatchResult* results = mResults.data();
+    for ( int i = 0; i < mResults.size(); ++i ) {
+        // a/x.png and b/x.png, or x.png and x.gif, would share x.log:
+        // the number of the program in the batch keeps the logs apart
+        if ( !mOptions.logDir.isEmpty() ) {
+            const QString name = QString( "%1-%2.log" ).arg( i + 1 ).arg( QFileInfo( results[i].program ).completeBaseName() );
+            results[i].log = QDir( mOptions.logDir ).filePath( name );
+        }
+        pool.start( new BatchJob( mOptions, &results[i] ) );
+    }
+
+    pool.waitForDone();
+}
+
+const QVector<BatchResult>& BatchRunner::results() const
+{
+    return mResults;
+}
+
+QString BatchRunner::summary() const
+{
+    QString text;
+    QTextStream out( &text );
+
+    out << "#program\texit\tsteps\ttime_ms\tpeak_stack\toutput_bytes\toutput_fnv1a\n";
+    foreach( const BatchResult &r, mResults ) {
+        out << r.program << '\t'
+            << exitReasonName( r.exitReason ) << '\t'
+            << r.steps << '\t'
+            << r.wallTimeMs << '\t'
+            << r.peakStack << '\t'
+            << r.outputSize << '\t'
+            << QString( "%1" ).arg( r.outputHash, 16, 16, QChar( '0' ) ) << '\n';
+    }
+    out.flush();
+    return text;
+}
+
+QString BatchRunner::exitReasonName( int reason )
+{
+    switch ( reason ) {
+    case piet_exit_none:
+        return "running";
+    case piet_exit_end:
+        return "end";
+    case piet_exit_black:
+        return "black";
+    case piet_exit_steps:
+        return "steps";
+    case piet_exit_error:
+        return "error";
+    case piet_exit_stack:
+        return "stack";
+    case BatchResult::Unreadable:
+        return "unreadable";
+    }
+    return "unknown";
+}
@@ -0,0 +1,122 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QRunnable>
+
+struct piet_context;
+
+/**
+  * Interpreter options shared by all programs of a batch.
+  */
+struct BatchOptions {
+    BatchOptions();
+
+    unsigned maxSteps; /**< 0 is unlimited */
+    int stackLimit; /**< values on the stack, 0 is unlimited */
+    int codelSize; /**< -1 guesses it from the input */
+    int unknownColor; /**< white 1, black 0, error -1 */
+    bool version11;
+    bool toggleBug;
+    QString logDir; /**< write <n>-<name>.log execution logs there if set */
+};
+
+/**
+  * The outcome of one program.
+  */
+struct BatchResult {
+    BatchResult();
+
+    /** exitReason if the program could not be read */
+    static const int Unreadable = -1;
+
+    QString program;
+    QString input;
+    QString log; /**< execution log to write, empty for none */
+
+    int exitReason; /**< piet_exit_* or Unreadable */
+    unsigned steps;
+    int wallTimeMs; /**< load and run */
+    int peakStack;
+    quint64 outputHash; /**< 64 bit FNV-1a of the program output */
+    qint64 outputSize;
+};
+
+/**
+  * Runs one program in its own interpreter context. The input is
+  * read from a file up front, the output is hashed on the fly.
+  */
+class BatchJob : public QRunnable
+{
+public:
+    BatchJob( const BatchOptions &options, BatchResult *result );
+
+    void run();
+
+private:
+    static int readInt( void* object );
+    static char readChar( void* object );
+    static void output( void* object, const char* str, int len );
+
+    bool load( piet_context *ctx );
+
+    BatchOptions mOptions;
+    BatchResult* mResult;
+
+    QByteArray mInput;
+    int mInputPos;
+};
+
+/**
+  * Runs a list of programs across a thread pool, one context per
+  * program.
+  */
+class BatchRunner
+{
+public:
+    BatchRunner( const BatchOptions &options );
+
+    void addProgram( const QString &program, const QString &input = QString() );
+    int count() const;
+
+    /**
+      * Runs all programs and blocks until they are done.
+      * @param threads the pool size, 0 means one thread per core
+      */
+    void run( int threads = 0 );
+
+    /** results in the order the programs were added */
+    const QVector<BatchResult>& results() const;
+
+    /** one tab separated line per program, after a header line */
+    QString summary() const;
+
+    static QString exitReasonName( int reason );
+
+private:
+    BatchOptions mOptions;
+    QVector<BatchResult> mResults;
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,181 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "BatchRunner.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+#include <stdlib.h>
+
+static void usage( int rc )
+{
+    QTextStream err( stderr );
+    err << "use: npiet-batch [<options>] <program|directory> ...\n"
+        << "options:\n"
+        << "\t-j <n>     - number of threads (default: one per core)\n"
+        << "\t-e <n>     - execution steps per program (default: unlimited)\n"
+        << "\t-sl <n>    - stack limit in values per program (default: unlimited)\n"
+        << "\t-l <file>  - read programs from file, one per line; an input\n"
+        << "\t             file may follow the program, separated by a tab\n"
+        << "\t-i <dir>   - look up the input <name>.in in dir (default: next\n"
+        << "\t             to the program)\n"
+        << "\t-cs <n>    - codelsize of the input (default: guess)\n"
+        << "\t-log <dir> - write an execution log <n>-<name>.log per program\n"
+        << "\t             to dir, n counting the programs from 1, see\n"
+        << "\t             npiet-trace (default: none)\n"
+        << "\t-ub        - unknown colors are black (default: white)\n"
+        << "\t-uu        - unknown colors give error (default: white)\n"
+        << "\t-dpbug     - model the perl piet interpreter (default: off)\n"
+        << "\t-v11       - model the npiet v1.1 interpreter (default: off)\n"
+        << "\n"
+        << "prints one tab separated line per program: the exit reason\n"
+        << "(end, black, steps, stack, error or unreadable), the steps, the wall\n"
+        << "time, the peak stack depth and a FNV-1a hash of the output.\n";
+    err.flush();
+    exit( rc );
+}
+
+/**
+  * the input for a program: <inputDir>/<name>.in, or <name>.in next to
+  * the program if no directory is given. empty if there is none.
+  */
+static QString inputFor( const QString &program, const QString &inputDir )
+{
+    QFileInfo info( program );
+    QString name = info.completeBaseName() + ".in";
+    QString input = inputDir.isEmpty() ? info.dir().filePath( name ) : QDir( inputDir ).filePath( name );
+    return QFile::exists( input ) ? input : QString();
+}
+
+static void addPath( BatchRunner &runner, const QString &path, const QString &inputDir )
+{
+    QFileInfo info( path );
+    if ( info.isDir() ) {
+        QStringList filters;
+        filters << "*.png" << "*.gif" << "*.ppm";
+        QDir dir( path );
+        foreach( const QString &name, dir.entryList( filters, QDir::Files, QDir::Name ) ) {
+            QString program = dir.filePath( name );
+            runner.addProgram( program, inputFor( program, inputDir ) );
+        }
+    } else {
+        runner.addProgram( path, inputFor( path, inputDir ) );
+    }
+}
+
+static bool addList( BatchRunner &runner, const QString &listFile, const QString &inputDir )
+{
+    QFile file( listFile );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
+        QTextStream( stderr ) << "cannot open " << listFile << "\n";
+        return false;
+    }
+
+    QTextStream in( &file );
+    while ( !in.atEnd() ) {
+        QString line = in.readLine();
+        if ( line.trimmed().isEmpty() || line.startsWith( '#' ) )
+            continue;
+
+        QStringList fields = line.split( '\t' );
+        if ( fields.size() > 1 )
+            runner.addProgram( fields.at( 0 ), fields.at( 1 ) );
+        else
+            addPath( runner, fields.at( 0 ), inputDir );
+    }
+    return true;
+}
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    BatchOptions options;
+    int threads = 0;
+    QString inputDir;
+    QStringList lists;
+    QStringList paths;
+
+    while ( !args.isEmpty() ) {
+        QString arg = args.takeFirst();
+        bool needsValue = arg == "-j" || arg == "-e" || arg == "-sl" || arg == "-l" || arg == "-i" || arg == "-cs" || arg == "-log";
+        if ( needsValue && args.isEmpty() )
+            usage( -1 );
+
+        if ( arg == "-j" ) {
+            threads = args.takeFirst().toInt();
+        } else if ( arg == "-e" ) {
+            options.maxSteps = args.takeFirst().toUInt();
+        } else if ( arg == "-sl" ) {
+            options.stackLimit = args.takeFirst().toInt();
+        } else if ( arg == "-l" ) {
+            lists << args.takeFirst();
+        } else if ( arg == "-i" ) {
+            inputDir = args.takeFirst();
+        } else if ( arg == "-cs" ) {
+            options.codelSize = args.takeFirst().toInt();
+            if ( options.codelSize < 1 )
+                usage( -1 );
+        } else if ( arg == "-log" ) {
+            options.logDir = args.takeFirst();
+        } else if ( arg == "-ub" ) {
+            options.unknownColor = 0;
+        } else if ( arg == "-uu" ) {
+            options.unknownColor = -1;
+        } else if ( arg == "-dpbug" ) {
+            options.toggleBug = true;
+        } else if ( arg == "-v11" ) {
+            options.version11 = true;
+        } else if ( arg.startsWith( '-' ) ) {
+            usage( -1 );
+        } else {
+            paths << arg;
+        }
+    }
+
+    BatchRunner runner( options );
+    foreach( const QString &list, lists ) {
+        if ( !addList( runner, list, inputDir ) )
+            return -2;
+    }
+    foreach( const QString &path, paths )
+        addPath( runner, path, inputDir );
+
+    if ( runner.count() == 0 )
+        usage( -1 );
+
+    runner.run( threads );
+
+    QTextStream out( stdout );
+    out << runner.summary();
+    out.flush();
+
+    foreach( const BatchResult &r, runner.results() ) {
+        if ( r.exitReason == BatchResult::Unreadable )
+            return 1;
+    }
+    return 0;
+}
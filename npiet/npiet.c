@@ -26,8 +26,13 @@
  *	  cc -DHAVE_GD_H -o npiet npiet.c -lgd
  *	  ./npiet -tpic hi.ppm 
  *
+ * a svg trace, painting only the blocks visited, needs no library:
+ *
+ *	  ./npiet -tsvg hi.ppm
+ *
  * reading png is supported if -DHAVE_PNP_H is set
  * and reading gif is supported if -DHAVE_GIF_LIB_H is set.
+ * binary ppm files are mapped into memory if -DHAVE_SYS_MMAN_H is set.
  *
  *
  * but all this is automagically handled by running
@@ -61,14 +66,28 @@ char *version = "v1.2a";
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "npiet.h"
 #include "npiet_utils.h"
+#include "npiet_log.h"
 
 // #ifdef HAVE_CONFIG_H
 # include "config.h"
 // #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 void
 usage (int rc)
 {
@@ -97,6 +116,7 @@ usage (int rc)
   fprintf (stderr, "\t-v         - be verbose (default: off)\n");
   fprintf (stderr, "\t-q         - be quiet (default: off)\n");
   fprintf (stderr, "\t-e <n>     - execution steps (default: unlimited)\n");
+  fprintf (stderr, "\t-sl <n>    - stack limit in values (default: unlimited)\n");
   fprintf (stderr, "\t-t         - trace (default: off)\n");
   fprintf (stderr, "\t-ub        - unknown colors are black "
 	   "(default: white)\n");
@@ -107,11 +127,15 @@ usage (int rc)
   fprintf (stderr, "\t-tpic      - create trace picture (not compiled in)\n");
   fprintf (stderr, "\t-tpf <n>   - trace pixelzoom  (not compiled in)\n");
   fprintf (stderr, "\t-tps       - simple trace pic w/o dp/cc info  (not compiled in)\n");
+  fprintf (stderr, "\t-tpi <n>   - save the trace pic every n steps  (not compiled in)\n");
 #else
   fprintf (stderr, "\t-tpic      - create trace picture  (default: do not)\n");
   fprintf (stderr, "\t-tpf <n>   - trace pixelzoom  (default: 48 or so)\n");
   fprintf (stderr, "\t-tps       - simple trace pic w/o dp/cc info  (default: sho dp/cc info)\n");
+  fprintf (stderr, "\t-tpi <n>   - save the trace pic every n steps with -t  (default: 1000)\n");
 #endif
+  fprintf (stderr, "\t-tsvg      - create svg trace  (default: do not)\n");
+  fprintf (stderr, "\t-tlog      - write a binary execution log  (default: do not)\n");
   fprintf (stderr, "\t-ts <n>    - graphic trace start (default: 0)\n");
   fprintf (stderr, "\t-te <n>    - graphic trace end (default: unlimited)\n");
   fprintf (stderr, "\t-n-str <s> - nase stuff: string-to-command\n");
@@ -122,99 +146,51 @@ usage (int rc)
   exit (rc);
 }
 
-/* be somewhat verbose: */
-int verbose = 0;
-
-/* be quiet - actually only suppresses the prompt when doing input: */
-int quiet = 0;
-
-/* show program execution information: */
-int trace = 0;
-
-/* maximum number of execution steps (0 == unlimited): */
-unsigned max_exec_step = 0;
-
-/* print debugging stuff: */
-int debug = 0;
-
-/* filename to work for: */
-char *input_filename = 0;
-
-/* unknown colors are treated as white, black or error (default 1 is white): */
-int unknown_color = 1;
-
-/* with gd2 lib linked we try to save trace output: */
-int do_gdtrace = 0;
-char *gd_trace_filename = "npiet-trace.png";
-int gd_trace_simple = 0;
-unsigned gd_trace_start = 0;
-unsigned gd_trace_end = 1 << 31;		/* lot's to print */
-
-/* pixelsize when painting graphical trace output: */
-int c_xy = 32;
-
-/* codelsize of the input. -1 means, we try to guess it from the input: */
-int codel_size = -1;
-
-/* trace codelsize threshold for pixel numbers, not tiny strings: */
-int pp_size = 49;
-
-/* work around broken source (wrong assumption about toggle of dp and cc): */
-int toggle_bug = 0;
-
-/* fun-stuff: create commands to print a string: */
-char *do_n_str = 0;
-
-/* fall back to npiet v1.1 behavior (fixed white codel crossing but
- * without trace info: 
- */
-int version_11 = 0;
-
 /* helper: */
-#define dprintf		if (debug) printf
-#define d2printf	if (debug > 1) printf
-#define tprintf		if (trace \
-			    && exec_step >= gd_trace_start \
-                            && exec_step <= gd_trace_end) printf
-#define t2printf	if (trace > 1) printf
-#define vprintf		if (verbose) printf
+#define dprintf		if (ctx->debug) printf
+#define d2printf	if (ctx->debug > 1) printf
+#define tprintf		if (ctx->trace \
+			    && ctx->exec_step >= ctx->gd_trace_start \
+                            && ctx->exec_step <= ctx->gd_trace_end) printf
+#define t2printf	if (ctx->trace > 1) printf
+#define vprintf		if (ctx->verbose) printf
 
 int 
-parse_args (int argc, char **argv)
+parse_args (struct piet_context *ctx, int argc, char **argv)
 {
   while (--argc > 0) {
     argv++;
     if (! strcmp (argv [0], "-v")) {
-      verbose++;
-      vprintf ("info: verbose set to %d\n", verbose);
+      ctx->verbose++;
+      vprintf ("info: verbose set to %d\n", ctx->verbose);
     } else if (! strcmp (argv [0], "-q")) {
-      quiet++;
+      ctx->quiet++;
     } else if (! strcmp (argv [0], "-t")) {
-      trace++;
-      vprintf ("info: trace set to %d\n", trace);
+      ctx->trace++;
+      vprintf ("info: trace set to %d\n", ctx->trace);
     } else if (! strcmp (argv [0], "-d")) {
-      debug++;
-      dprintf ("info: debug set to %d\n", debug);
+      ctx->debug++;
+      dprintf ("info: debug set to %d\n", ctx->debug);
     } else if (! strcmp (argv [0], "-uu")) {
-      unknown_color = -1;
+      ctx->unknown_color = -1;
       vprintf ("info: unknown color set to error\n");
     } else if (! strcmp (argv [0], "-ub")) {
-      unknown_color = 0;
+      ctx->unknown_color = 0;
       vprintf ("info: unknown color set to black\n");
     } else if (! strcmp (argv [0], "-dpbug")) {
       /* just a tbd (how to follow wrong behavior ;-) */
-      toggle_bug = 1;
+      ctx->toggle_bug = 1;
       vprintf ("info: setting toggle bug and white bug behavior\n");
     } else if (! strcmp (argv [0], "-v11")) {
-      version_11 = 1;
+      ctx->version_11 = 1;
       vprintf ("info: setting npiet version 1.1 behavior\n");
     } else if (! strcmp (argv [0], "-tpic")) {
 #ifndef HAVE_GD_H
       printf ("note: no GD support compiled in. the graphical trace "
 	      "feature is not avail\n");
 #else
-      do_gdtrace = 1;
-      vprintf ("info: save trace output to %s\n", gd_trace_filename);
+      ctx->do_gdtrace = 1;
+      vprintf ("info: save trace output to %s\n", ctx->gd_trace_filename);
 #endif
     } else if (argc > 0 && ! strcmp (argv [0], "-tpf")) {
       argc--, argv++;		/* shift */
@@ -222,50 +198,71 @@ parse_args (int argc, char **argv)
       printf ("note: no GD support compiled in. the graphical trace "
 	      "feature is not avail\n");
 #else
-      if ((c_xy = atoi (argv [0])) < 1) {
+      if ((ctx->c_xy = atoi (argv [0])) < 1) {
 	fprintf (stderr, "warning: trace pixelzoom %d is invalid\n",
-		 c_xy);
-	c_xy = 32;
+		 ctx->c_xy);
+	ctx->c_xy = 32;
       } 
-      vprintf ("info: trace pixelzoom set to %d\n", c_xy);
-      do_gdtrace = 1;
+      vprintf ("info: trace pixelzoom set to %d\n", ctx->c_xy);
+      ctx->do_gdtrace = 1;
 #endif
     } else if (! strcmp (argv [0], "-tps")) {
 #ifndef HAVE_GD_H
       printf ("note: no GD support compiled in. the graphical trace "
 	      "feature is not avail\n");
 #else
-      do_gdtrace = 1;
-      gd_trace_simple++;
+      ctx->do_gdtrace = 1;
+      ctx->gd_trace_simple++;
+#endif
+    } else if (! strcmp (argv [0], "-tsvg")) {
+      ctx->do_svgtrace = 1;
+      vprintf ("info: save svg trace output to %s\n", ctx->svg_trace_filename);
+    } else if (! strcmp (argv [0], "-tlog")) {
+      ctx->do_log = 1;
+      vprintf ("info: write execution log to %s\n", ctx->log_filename);
+    } else if (argc > 0 && ! strcmp (argv [0], "-tpi")) {
+      argc--, argv++;		/* shift */
+#ifndef HAVE_GD_H
+      printf ("note: no GD support compiled in. the graphical trace "
+	      "feature is not avail\n");
+#else
+      ctx->gd_save_interval = atoi (argv [0]);
+      vprintf ("info: trace picture saved every %u steps\n", 
+	       ctx->gd_save_interval);
 #endif
     } else if (argc > 0 && ! strcmp (argv [0], "-e")) {
       argc--, argv++;		/* shift */
-      max_exec_step = atoi (argv [0]);
-      vprintf ("info: number of execution steps set to %u\n", max_exec_step);
+      ctx->max_exec_step = atoi (argv [0]);
+      vprintf ("info: number of execution steps set to %u\n", 
+	       ctx->max_exec_step);
+    } else if (argc > 0 && ! strcmp (argv [0], "-sl")) {
+      argc--, argv++;		/* shift */
+      ctx->stack_limit = atoi (argv [0]);
+      vprintf ("info: stack limit set to %d\n", ctx->stack_limit);
     } else if (argc > 0 && ! strcmp (argv [0], "-ts")) {
       argc--, argv++;		/* shift */
-      gd_trace_start = atoi (argv [0]);
-      vprintf ("info: graphical trace start set to %d\n", gd_trace_start);
+      ctx->gd_trace_start = atoi (argv [0]);
+      vprintf ("info: graphical trace start set to %d\n", ctx->gd_trace_start);
     } else if (argc > 0 && ! strcmp (argv [0], "-te")) {
       argc--, argv++;		/* shift */
-      gd_trace_end = atoi (argv [0]);
-      vprintf ("info: graphical trace end set to %d\n", gd_trace_end);
+      ctx->gd_trace_end = atoi (argv [0]);
+      vprintf ("info: graphical trace end set to %d\n", ctx->gd_trace_end);
     } else if (argc > 0 && ! strcmp (argv [0], "-n-str")) {
       argc--, argv++;		/* shift */
-      do_n_str = argv [0];
+      ctx->do_n_str = argv [0];
     } else if (argc > 0 && ! strcmp (argv [0], "-cs")) {
       argc--, argv++;		/* shift */
-      if ((codel_size = atoi (argv [0])) < 1) {
+      if ((ctx->codel_size = atoi (argv [0])) < 1) {
 	fprintf (stderr, "warning: codelsize %d is invalid\n",
-		 codel_size);
-	codel_size = 1;
+		 ctx->codel_size);
+	ctx->codel_size = 1;
       } 
-      vprintf ("info: codelsize set to %d\n", codel_size);
+      vprintf ("info: codelsize set to %d\n", ctx->codel_size);
     } else if (argv [0][0] == '-' && argv [0][1]) {
       usage (-1);
-    } else if (! input_filename) {
-      input_filename = argv [0];
-	vprintf ("info: using file %s\n", input_filename);
+    } else if (! ctx->input_filename) {
+      ctx->input_filename = argv [0];
+	vprintf ("info: using file %s\n", ctx->input_filename);
     } else {
       usage (-1);
     }
@@ -275,14 +272,51 @@ parse_args (int argc, char **argv)
 }
 
 
-extern void alloc_cells (int n_width, int n_height);
+extern void alloc_cells (struct piet_context *ctx, int n_width, int n_height);
+static void piet_update_blocks (struct piet_context *ctx, int x, int y);
+static void watches_reset (struct piet_context *ctx);
+struct piet_transition;
+static void piet_resolve_step (struct piet_context *ctx, int x, int y, 
+			       int dp, int cc, struct piet_transition *t);
 
 
 /*
- * picture storage:
+ * connected color blocks (see piet_ctx_label_blocks):
+ */
+struct piet_block {
+  int size;			/* number of codels in this block */
+  int color;			/* color index of the block */
+  int exit_x [8], exit_y [8];	/* furthest codel per dp / cc */
+};
+
+/*
+ * transition table: the result of leaving a color block with a given
+ * dp and cc (see piet_resolve_step). filled on first use, 8 entries
+ * per block, indexed like the block exits.
  */
-static int *cells = 0;
-static int width = 0, height = 0;
+struct piet_transition {
+  int state;			/* t_unknown, t_move or t_stop */
+  int n_x, n_y;			/* exit codel of the successful try */
+  int a_x, a_y;			/* codel to continue with */
+  int dp, cc;			/* dp and cc after the move */
+  int a_col;			/* color index at a_x, a_y */
+  int num_cells;		/* size of the block left */
+  int white_crossed;		/* white crossed: no command */
+  int hue_change, light_change;	/* the command otherwise */
+  int look_x0, look_y0;		/* box around the codels looked at */
+  int look_x1, look_y1;		/* (see piet_update_blocks) */
+};
+
+#define t_unknown	0
+#define t_move		1
+#define t_stop		2
+
+#define t_look(t, x, y)	do {					\
+    if ((x) < (t)->look_x0) (t)->look_x0 = (x);			\
+    if ((x) > (t)->look_x1) (t)->look_x1 = (x);			\
+    if ((y) < (t)->look_y0) (t)->look_y0 = (y);			\
+    if ((y) > (t)->look_y1) (t)->look_y1 = (y);			\
+  } while (0)
 
 #define adv_col(c, h, l)  (((((c) % 6) + (h)) % 6) \
 				+ (6 * ((((c) / 6) + (l)) % 3)))
@@ -323,10 +357,6 @@ static struct c_color {
 /*
  * execution states:
  */
-int p_dir_pointer;		/* DP: p_{left, right, up, down} */
-int p_codel_chooser;		/* CC: p_left or p_right */
-int p_xpos, p_ypos;		/* execution position */
-
 #define p_left			'l'
 #define p_right			'r'
 #define p_up			'u'
@@ -341,48 +371,84 @@ int p_xpos, p_ypos;		/* execution position */
 #define dp_dx(dp)	((dp) == 'l' ? -1 : ((dp) == 'r' ? 1 : 0))
 #define dp_dy(dp)	((dp) == 'u' ? -1 : ((dp) == 'd' ? 1 : 0))
 
-/* informal step counter: */
-unsigned exec_step = 0;
+/*
+ * reverse n values in place (used by roll):
+ */
+static void
+reverse_stack (long *vals, int n)
+{
+  long *lo = vals, *hi = vals + n - 1;
+
+  while (lo < hi) {
+    long tmp = *lo;
+    *lo++ = *hi;
+    *hi-- = tmp;
+  }
+}
+
 
 /*
  * stack space for runtime action: 
+ *
+ * the stack grows by doubling, so deep stacks cost amortized O(1) per
+ * push, and the space is kept for the next run (see piet_ctx_init).
+ * with a stack_limit set, growing beyond it ends the program.
  */
-long *stack = 0;		/* stack space */
-int num_stack = 0;		/* current number of values on stack */
-int max_stack = 0;		/* max size of stack allocated */
+#define stack_min_alloc		64
 
-void
-alloc_stack_space (int val)
+int
+alloc_stack_space (struct piet_context *ctx, int val)
 {
-  if (val <= max_stack) {
-    return;
-  } else if (! stack) {
-    max_stack = val;
-    stack = (long *) calloc (val, sizeof (long));
-  } else {
-    long *new_stack = (long *) calloc (val, sizeof (long));
-    memcpy (new_stack, stack, num_stack * sizeof (long));
-    free (stack);
-    max_stack = val;
-    stack = new_stack;
+  long *n_stack;
+  int n_max;
+
+  if (val <= ctx->max_stack) {
+    return 0;
+  }
+
+  if (ctx->stack_limit > 0 && val > ctx->stack_limit) {
+    fprintf (stderr, "error: stack limit exceeded (%d values)\n",
+	     ctx->stack_limit);
+    ctx->exit_reason = piet_exit_stack;
+    return -1;
+  }
+
+  n_max = ctx->max_stack < stack_min_alloc ? stack_min_alloc : ctx->max_stack;
+  while (n_max < val) {
+    n_max = n_max > INT_MAX / 2 ? val : n_max * 2;
+  }
+  if (ctx->stack_limit > 0 && n_max > ctx->stack_limit) {
+    n_max = ctx->stack_limit;
+  }
+
+  if (! (n_stack = (long *) realloc (ctx->stack, n_max * sizeof (long)))) {
+    fprintf (stderr, "out of memory: cannot extend the stack to %d values\n",
+	     n_max);
+    ctx->exit_reason = piet_exit_stack;
+    return -1;
   }
+
+  ctx->stack = n_stack;
+  ctx->max_stack = n_max;
+
   dprintf ("deb: stack extended to %d entries (num_stack is %d)\n",
-	   max_stack, num_stack);
+	   ctx->max_stack, ctx->num_stack);
+  return 0;
 }
 
 
 void
-tdump_stack ()
+tdump_stack (struct piet_context *ctx)
 {
   int i;
 
-  if (num_stack == 0) {
+  if (ctx->num_stack == 0) {
     tprintf ("trace: stack is empty");
   } else {
-    tprintf ("trace: stack (%d values):", num_stack);
+    tprintf ("trace: stack (%d values):", ctx->num_stack);
   }
-  for (i = 0; i < num_stack; i++) {
-    tprintf (" %ld", stack [num_stack - i - 1]);
+  for (i = 0; i < ctx->num_stack; i++) {
+    tprintf (" %ld", ctx->stack [ctx->num_stack - i - 1]);
   }
   tprintf ("\n");
 }
@@ -421,17 +487,107 @@ get_light (int val)
 }
 
 
+/*
+ * every channel of a piet color is 0x00, 0xc0 or 0xff. with a two bit
+ * code per channel (3 for anything else) the codes of r, g and b make
+ * a perfect hash of the 20 colors into 64 slots:
+ */
+#define chan_code(v)	((v) == 0x00 ? 0 : (v) == 0xc0 ? 1 : (v) == 0xff ? 2 : 3)
+#define color_key(r, g, b)	\
+  ((chan_code (r) << 4) | (chan_code (g) << 2) | chan_code (b))
+
+static const signed char color_lut [64] = {
+  c_black, 16, 10, -1, 14, 15, -1, -1,
+  8, -1, 9, -1, -1, -1, -1, -1,
+  12, 17, -1, -1, 13, -1, 4, -1,
+  -1, 2, 3, -1, -1, -1, -1, -1,
+  6, -1, 11, -1, -1, 0, 5, -1,
+  7, 1, c_white, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1
+};
+
 int
 get_color_idx (int col)
 {
-  int i;
-  
-  for (i = 0; i < n_colors; i++) {
-    if (col == c_colors [i].col) {
-      return c_colors [i].c_idx;
+  int r = (col >> 16) & 0xff, g = (col >> 8) & 0xff, b = col & 0xff;
+
+  if (col & ~0xffffff) {
+    return -1;
+  }
+  return color_lut [color_key (r, g, b)];
+}
+
+
+int
+piet_classify_row (const void *row, int format, int n, unsigned char *cells)
+{
+  int i = 0, unknown = 0;
+
+  if (format == piet_row_argb32) {
+    const unsigned int *px = (const unsigned int *) row;
+
+#ifdef __SSE2__
+    /*
+     * four pixels at a time: compare all bytes against the three
+     * channel values for the codes, then fold the codes of b, g and
+     * r (bytes 0, 1 and 2 of each word) into the key:
+     */
+    const __m128i v_c0 = _mm_set1_epi8 ((char) 0xc0);
+    const __m128i v_ff = _mm_set1_epi8 ((char) 0xff);
+    const __m128i v_1 = _mm_set1_epi8 (1);
+    const __m128i v_2 = _mm_set1_epi8 (2);
+    const __m128i v_3 = _mm_set1_epi8 (3);
+
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (px + i));
+      __m128i is_c0 = _mm_cmpeq_epi8 (v, v_c0);
+      __m128i is_ff = _mm_cmpeq_epi8 (v, v_ff);
+      __m128i is_00 = _mm_cmpeq_epi8 (v, _mm_setzero_si128 ());
+      __m128i code, key;
+      int keys [4], j;
+
+      code = _mm_or_si128 (_mm_and_si128 (is_c0, v_1), 
+			   _mm_and_si128 (is_ff, v_2));
+      code = _mm_or_si128 (code, 
+			   _mm_andnot_si128 (_mm_or_si128 (_mm_or_si128 (is_c0, 
+									 is_ff),
+							   is_00), v_3));
+      key = _mm_or_si128 (_mm_and_si128 (code, _mm_set1_epi32 (0x03)),
+			  _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (code, 6),
+						       _mm_set1_epi32 (0x0c)),
+					_mm_and_si128 (_mm_srli_epi32 (code, 12),
+						       _mm_set1_epi32 (0x30))));
+      _mm_storeu_si128 ((__m128i *) keys, key);
+
+      for (j = 0; j < 4; j++) {
+	if ((cells [i + j] = color_lut [keys [j]]) == c_unknown) {
+	  unknown++;
+	}
+      }
+    }
+#endif
+
+    for (; i < n; i++) {
+      unsigned int p = px [i];
+      int r = (p >> 16) & 0xff, g = (p >> 8) & 0xff, b = p & 0xff;
+
+      if ((cells [i] = color_lut [color_key (r, g, b)]) == c_unknown) {
+	unknown++;
+      }
+    }
+  } else {
+    const unsigned char *px = (const unsigned char *) row;
+
+    for (; i < n; i++, px += 3) {
+      if ((cells [i] = color_lut [color_key (px [0], px [1], px [2])]) 
+	  == c_unknown) {
+	unknown++;
+      }
     }
   }
-  return -1;
+
+  return unknown;
 }
 
 
@@ -460,65 +616,155 @@ cell2str (int idx)
 }
 
 
+/*
+ * the cells are stored a byte per codel with a ring of black codels
+ * around the picture: a codel next to the picture reads as black
+ * (like the edge), so slides and neighbour tests need no bounds check.
+ * cell_at() is valid for -1 <= x <= width and -1 <= y <= height.
+ */
+#define cell_stride(ctx)	((ctx)->width + 2)
+#define cell_at(ctx, x, y)	\
+  ((ctx)->cells [((y) + 1) * cell_stride (ctx) + (x) + 1])
+
 #ifdef DEBUG
 /*
  * slower call for nicer debugging: 
  */
 int
-cell_idx (int x, int y) 
+cell_idx (struct piet_context *ctx, int x, int y) 
 {
-  if (x < 0 || x >= width || y < 0 || y >= height) {
+  if (x < 0 || x >= ctx->width || y < 0 || y >= ctx->height) {
     return -1;
   }
 
-  return y * width + x;
+  return y * ctx->width + x;
 }
 #else
-# define cell_idx(x, y)		(((x) < 0 || (x) >= width \
-				  || (y) < 0 || (y) >= height) ? -1 : \
-				(y) * width + (x))
+# define cell_idx(ctx, x, y)	(((x) < 0 || (x) >= (ctx)->width \
+				  || (y) < 0 || (y) >= (ctx)->height) ? -1 : \
+				(y) * (ctx)->width + (x))
 #endif
 
 int
-get_cell (int x, int y)
+piet_ctx_get_cell (struct piet_context *ctx, int x, int y)
 {
-  int c_idx = cell_idx (x, y);
-  if (c_idx < 0) {
-    if (debug > 1) printf ("deb: bad index for x=%d, y=%d\n", x, y);
+  if (cell_idx (ctx, x, y) < 0) {
+    if (ctx->debug > 1) printf ("deb: bad index for x=%d, y=%d\n", x, y);
     return -1;
   }
-  return cells [c_idx];
+  return cell_at (ctx, x, y);
 }
 
 
 void
-set_cell (int x, int y, int val)
+piet_ctx_set_cell (struct piet_context *ctx, int x, int y, int val)
 {
-  int c_idx;
-
-  c_idx = cell_idx (x, y);
-  if (c_idx < 0) {
-    alloc_cells (x >= width ? x + 1 : width, y >= height ? y + 1 : height);
+  if (cell_idx (ctx, x, y) < 0) {
+    alloc_cells (ctx, x >= ctx->width ? x + 1 : ctx->width, 
+		 y >= ctx->height ? y + 1 : ctx->height);
   }
 
-  if ((c_idx = cell_idx (x, y)) < 0) {
+  if (cell_idx (ctx, x, y) < 0) {
     exit (-99);			/* internal error */
   }
-  cells [c_idx] = val;
+  if (cell_at (ctx, x, y) != val) {
+    cell_at (ctx, x, y) = val;
+    if (ctx->blocks_valid) {
+      piet_update_blocks (ctx, x, y);
+    }
+    ctx->break_blocks_valid = 0;
+  }
 }
 
 
-void
-alloc_cells (int n_width, int n_height)
+/*
+ * what an unknown color at x,y becomes; -1 if it is an error:
+ */
+static int
+unknown_cell (struct piet_context *ctx, int x, int y, int col, 
+	      unsigned char *cell)
 {
-  int i, j;
-  int *n_cells = (int *) malloc (n_width * n_height * sizeof(int));
+  vprintf ("info: unknown color 0x%06x at %d,%d\n", col, x, y);
+  if (ctx->unknown_color == -1) {
+    /* an error, but leave no bad index behind: */
+    *cell = c_black;
+    return -1;
+  }
+  /* set to black or white: */
+  *cell = (ctx->unknown_color == 0 ? c_black : c_white);
+  return 0;
+}
+
+
+int
+piet_ctx_set_row (struct piet_context *ctx, int y, const void *row, int format)
+{
+  unsigned char *cells;
+  int i, rc = 0;
+
+  if (y < 0 || y >= ctx->height) {
+    return -1;
+  }
+  cells = &cell_at (ctx, 0, y);
+
+  /* block labels are stale now: */
+  ctx->blocks_valid = 0;
+
+  if (piet_classify_row (row, format, ctx->width, cells) == 0) {
+    return 0;
+  }
+
+  for (i = 0; i < ctx->width; i++) {
+    if (cells [i] == c_unknown) {
+      const unsigned char *px = (const unsigned char *) row + 3 * i;
+      int col = (format == piet_row_argb32 
+		 ? (int) (((const unsigned int *) row) [i] & 0xffffff)
+		 : (px [0] << 16) | (px [1] << 8) | px [2]);
+
+      if (unknown_cell (ctx, i, y, col, &cells [i]) < 0) {
+	rc = -1;
+      }
+    }
+  }
+  return rc;
+}
+
+
+/*
+ * like piet_ctx_set_row() for rgb pixel, but take only every step'th
+ * pixel of the row (the first pixel of each codel):
+ */
+static int
+set_codel_row (struct piet_context *ctx, int y, const unsigned char *rgb,
+	       int step)
+{
+  unsigned char *cells;
+  int i, rc = 0;
+
+  if (step == 1) {
+    return piet_ctx_set_row (ctx, y, rgb, piet_row_rgb);
+  }
 
-  for (j = 0; j < n_height; j++) {
-    for (i = 0; i < n_width; i++) {
-      n_cells [j * n_width + i] = c_black;
+  cells = &cell_at (ctx, 0, y);
+  ctx->blocks_valid = 0;
+
+  for (i = 0; i < ctx->width; i++, rgb += 3 * step) {
+    if ((cells [i] = color_lut [color_key (rgb [0], rgb [1], rgb [2])]) 
+	== c_unknown
+	&& unknown_cell (ctx, i, y, (rgb [0] << 16) | (rgb [1] << 8) | rgb [2],
+			 &cells [i]) < 0) {
+      rc = -1;
     }
   }
+  return rc;
+}
+
+
+void
+alloc_cells (struct piet_context *ctx, int n_width, int n_height)
+{
+  int j, n_stride = n_width + 2;
+  unsigned char *n_cells = (unsigned char *) malloc (n_stride * (n_height + 2));
 
   if (! n_cells) {
     fprintf (stderr, "out of memory: cannot allocate %d * %d cells\n",
@@ -526,28 +772,33 @@ alloc_cells (int n_width, int n_height)
     exit (-99);
   }
 
-  if (cells) {
-    for (j = 0; j < height; j++) {
-      for (i = 0; i < width; i++) {
-	n_cells [j * n_width + i] = cells [j * width + i];
-      }
+  /* new cells and the border are black: */
+  memset (n_cells, c_black, n_stride * (n_height + 2));
+
+  if (ctx->cells) {
+    /* keep what fits into the new size: */
+    int w = ctx->width < n_width ? ctx->width : n_width;
+
+    for (j = 0; j < ctx->height && j < n_height; j++) {
+      memcpy (n_cells + (j + 1) * n_stride + 1, &cell_at (ctx, 0, j), w);
     }
-    free (cells);
+    free (ctx->cells);
   }
    
-  cells = n_cells;
-  width = n_width;
-  height = n_height;
+  ctx->cells = n_cells;
+  ctx->width = n_width;
+  ctx->height = n_height;
+  ctx->blocks_valid = 0;
 }
 
 
 void
-dump_cells ()
+dump_cells (struct piet_context *ctx)
 {
   int i, j;
-  for (j = 0; j < height; j++) {
-    for (i = 0; i < width; i++) {
-      int idx = get_cell (i, j);
+  for (j = 0; j < ctx->height; j++) {
+    for (i = 0; i < ctx->width; i++) {
+      int idx = cell_at (ctx, i, j);
       printf ("%3s", cell2str (idx));
     }
     printf ("\n");
@@ -568,12 +819,14 @@ dump_cells ()
 /*
  * without support, make dummy substitutions avail:
  */
-#define gd_init()  
-#define gd_save()
+#define gd_init(ctx)  
+#define gd_save(ctx)
+#define gd_update(ctx)
+#define gd_free(ctx)
 #define gd_trace() 
-#define gd_try_init()
-#define gd_try_step(a1,a2,a3,a4,a5,a6)
-#define gd_action(a1,a2,a3,a4,a5,a6,a7)
+#define gd_try_init(ctx)
+#define gd_try_step(ctx,a1,a2,a3,a4,a5,a6)
+#define gd_action(ctx,a1,a2,a3,a4,a5,a6,a7)
 
 #else
 
@@ -581,45 +834,73 @@ dump_cells ()
 #include <gdfonts.h>
 #include <gdfontt.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #define i_sign(x)    ((x) < 0 ? -1 : ((x) > 0 ? 1 : 0))
 #define i_abs(x)     ((x) < 0 ? -(x) : (x))
 #define i_max(x, y)  ((x) > (y) ? (x) : (y))
 
-gdImagePtr im;
-int gd_col [n_colors];
-int gd_white;
-int gd_black;
-int gd_nase;
-int gd_step;
-int gd_grey [8];		/* grey indices */
-
-gdFontPtr gdft, gdfs;
-
 /*
- * if a ongoing try hits the same cell, we will change the print offset
- * to get at least a clue with the overwritten strings:
+ * the trace picture of a context:
  */
-int gd_try_xoff = 0;
-int gd_try_yoff = 0;
-int gd_try_dcol = 0;
+struct piet_gd {
+  gdImagePtr im;
+  int col [n_colors];
+  int white;
+  int black;
+  int nase;
+  int step;
+  int grey [8];			/* grey indices */
+
+  gdFontPtr ft, fs;
+
+  /*
+   * if a ongoing try hits the same cell, we will change the print offset
+   * to get at least a clue with the overwritten strings:
+   */
+  int try_xoff;
+  int try_yoff;
+  int try_dcol;
+
+  unsigned saved_step;		/* step of the last intermediate save */
+
+#ifdef HAVE_PTHREAD_H
+  /*
+   * intermediate pictures are encoded and written by a thread of their
+   * own, from a copy handed over in `pending':
+   */
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int has_writer;
+  int writer_busy;
+  int writer_quit;
+  gdImagePtr pending;
+  const char *filename;
+#endif
+};
 
 
 void
-gd_try_init ()
+gd_try_init (struct piet_context *ctx)
 {
-  gd_try_xoff = 0;
-  gd_try_yoff = 0;
-  gd_try_dcol = 0;
+  struct piet_gd *gd = ctx->gd;
+  gd->try_xoff = 0;
+  gd->try_yoff = 0;
+  gd->try_dcol = 0;
 }
 
 
 void
-gd_arrow_pp (int x1, int y1, int dp, int gd_col)
+gd_arrow_pp (struct piet_context *ctx, int x1, int y1, int dp, int gd_col)
 {
+  struct piet_gd *gd = ctx->gd;
   int i;
 
   for (i = 0; i < 3; i++) {
-    gdImageLine (im, x1 - i * dp_dx(dp) + i * dp_dy(dp),
+    gdImageLine (gd->im, x1 - i * dp_dx(dp) + i * dp_dy(dp),
 		 y1 + i * dp_dx(dp) - i * dp_dy(dp),
 		 x1 - i * dp_dx(dp) - i * dp_dy(dp),
 		 y1 - i * dp_dx(dp) - i * dp_dy(dp), gd_col);
@@ -629,15 +910,17 @@ gd_arrow_pp (int x1, int y1, int dp, int gd_col)
 
 
 void
-gd_arrow (int x1, int y1, int x2, int y2, int dp, int gd_col)
+gd_arrow (struct piet_context *ctx, int x1, int y1, int x2, int y2, int dp, 
+	  int gd_col)
 {
+  struct piet_gd *gd = ctx->gd;
 #if 0
   int i;
 
-  gdImageLine (im, x1, y1, x2, y2, gd_col);
+  gdImageLine (gd->im, x1, y1, x2, y2, gd_col);
   
   for (i = 0; i < 3; i++) {
-  gdImageLine (im, x2 - i * dp_dx(dp) + i * dp_dy(dp),
+  gdImageLine (gd->im, x2 - i * dp_dx(dp) + i * dp_dy(dp),
 	       y2 + i * dp_dx(dp) - i * dp_dy(dp),
 	       x2 - i * dp_dx(dp) - i * dp_dy(dp),
 	       y2 - i * dp_dx(dp) - i * dp_dy(dp), gd_col);
@@ -648,7 +931,7 @@ gd_arrow (int x1, int y1, int x2, int y2, int dp, int gd_col)
   gdPoint pts [3];
 
   /* base line: */
-  gdImageLine (im, x1, y1, x2, y2, gd_col);
+  gdImageLine (gd->im, x1, y1, x2, y2, gd_col);
 
   pts [0].x = x2;
   pts [0].y = y2;
@@ -658,7 +941,7 @@ gd_arrow (int x1, int y1, int x2, int y2, int dp, int gd_col)
   pts [2].y = (y2 + y1) / 2 + 2 * dp_dx(dp);
 
   /* arrow head: */
-  gdImageFilledPolygon (im, pts, 3, gd_col);
+  gdImageFilledPolygon (gd->im, pts, 3, gd_col);
 #endif
 }
 
@@ -715,8 +998,9 @@ int num_pts_plen [10] = { 12, 5, 8, 8, 9, 8, 10, 6, 13, 11 };
 
 
 void
-gd_paint_ch (int x1, int y1, int ch, int gd_col)
+gd_paint_ch (struct piet_context *ctx, int x1, int y1, int ch, int gd_col)
 {
+  struct piet_gd *gd = ctx->gd;
   gdPoint *pts;
   int i, n_pts;
 
@@ -724,7 +1008,7 @@ gd_paint_ch (int x1, int y1, int ch, int gd_col)
   n_pts = gd_ch_plen (ch);
 
   for (i = 0; i < n_pts; i++) {
-    gdImageSetPixel (im, x1 + pts [i].x, y1 + pts [i].y, gd_col);
+    gdImageSetPixel (gd->im, x1 + pts [i].x, y1 + pts [i].y, gd_col);
   }
 
 }
@@ -732,8 +1016,9 @@ gd_paint_ch (int x1, int y1, int ch, int gd_col)
 
 
 void
-gd_paint_num (int x1, int y1, int num, int gd_col)
+gd_paint_num (struct piet_context *ctx, int x1, int y1, int num, int gd_col)
 {
+  struct piet_gd *gd = ctx->gd;
   gdPoint *pts;
   int len, div, n, i, w, n_pts;
 
@@ -754,7 +1039,7 @@ gd_paint_num (int x1, int y1, int num, int gd_col)
     w = gd_ch_pw(n);
     
     for (i = 0; i < n_pts; i++) {
-      gdImageSetPixel (im, x1 + pts [i].x, y1 + pts [i].y, gd_col);
+      gdImageSetPixel (gd->im, x1 + pts [i].x, y1 + pts [i].y, gd_col);
     }
     x1 += w + 1;
   }
@@ -763,11 +1048,12 @@ gd_paint_num (int x1, int y1, int num, int gd_col)
 
 
 void
-gd_step_num_pp (int x, int y)
+gd_step_num_pp (struct piet_context *ctx, int x, int y)
 {
-  if (c_xy <= pp_size) {
+  struct piet_gd *gd = ctx->gd;
+  if (ctx->c_xy <= ctx->pp_size) {
     /* only pixl numbers if we are low on space: */
-    gd_paint_num (x, y, exec_step, gd_step);
+    gd_paint_num (ctx, x, y, ctx->exec_step, gd->step);
   }
 }
 
@@ -789,57 +1075,245 @@ gd_alloc_piet_colors (gdImagePtr im, int *col)
 
 
 void
-gd_init ()
+gd_init (struct piet_context *ctx)
 {
+  struct piet_gd *gd;
   int i, j;
 
-  im = gdImageCreate (width * c_xy, height * c_xy);
+  if (! (gd = ctx->gd)) {
+    gd = ctx->gd = (struct piet_gd *) calloc (1, sizeof (struct piet_gd));
+  } else if (gd->im) {
+    gdImageDestroy (gd->im);
+  }
+
+  gd->im = gdImageCreate (ctx->width * ctx->c_xy, ctx->height * ctx->c_xy);
 
   /* background color: */
-  gdImageColorAllocate (im, 255, 255, 255);
+  gdImageColorAllocate (gd->im, 255, 255, 255);
 
-  gd_alloc_piet_colors (im, gd_col);
+  gd_alloc_piet_colors (gd->im, gd->col);
 
-  gd_black = gd_col [c_black];
-  gd_white = gd_col [c_white];
-  gd_step = gdImageColorAllocate (im, 180, 180, 180);
-  gd_nase = gdImageColorAllocate (im, 85, 75, 255);
+  gd->black = gd->col [c_black];
+  gd->white = gd->col [c_white];
+  gd->step = gdImageColorAllocate (gd->im, 180, 180, 180);
+  gd->nase = gdImageColorAllocate (gd->im, 85, 75, 255);
 
-  gdft = gdFontTiny;
-  gdfs = gdFontSmall;
+  gd->ft = gdFontTiny;
+  gd->fs = gdFontSmall;
 
   /* create some grey values: maybe helpful... */
   for (i = 0; i < 8; i++) {
     int c = 72 + (48 / 8) * i;
-    gd_grey [i] = gdImageColorAllocate (im, c, c, c);
+    gd->grey [i] = gdImageColorAllocate (gd->im, c, c, c);
   }
 
-  for (j = 0; j < height; j++) {
-    for (i = 0; i < width; i++) {
-      gdImageFilledRectangle (im, i * c_xy, j * c_xy, (i + 1) * c_xy - 1,
-			      (j + 1) * c_xy - 1, gd_col [get_cell (i, j)]);
+  for (j = 0; j < ctx->height; j++) {
+    for (i = 0; i < ctx->width; i++) {
+      gdImageFilledRectangle (gd->im, i * ctx->c_xy, j * ctx->c_xy, 
+			      (i + 1) * ctx->c_xy - 1, (j + 1) * ctx->c_xy - 1, 
+			      gd->col [cell_at (ctx, i, j)]);
     }
   }
 
   /* start circle: */
-  gdImageArc (im, c_xy / 2, c_xy / 2, c_xy / 7, c_xy / 7, 0, 360, gd_black);
+  gdImageArc (gd->im, ctx->c_xy / 2, ctx->c_xy / 2, 
+	      ctx->c_xy / 7, ctx->c_xy / 7,
+	      0, 360, gd->black);
 }
 
 
-void
-gd_save ()
+static int
+gd_write (gdImagePtr im, const char *filename)
 {
   FILE *pngout;
-  
-  if (! (pngout = fopen (gd_trace_filename, "wb"))) {
+
+  if (! (pngout = fopen (filename, "wb"))) {
     fprintf (stderr, "cannot open %s for writing; reason: %s\n",
-	     gd_trace_filename, strerror (errno));
-    do_gdtrace = 0;
-    return;
+	     filename, strerror (errno));
+    return -1;
   }
   
   gdImagePng (im, pngout);
   fclose (pngout);
+  return 0;
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+static void *
+gd_writer (void *arg)
+{
+  struct piet_gd *gd = (struct piet_gd *) arg;
+  gdImagePtr im;
+
+  pthread_mutex_lock (&gd->lock);
+  while (1) {
+    while (! gd->pending && ! gd->writer_quit) {
+      pthread_cond_wait (&gd->wake, &gd->lock);
+    }
+    if (gd->writer_quit) {
+      break;
+    }
+
+    im = gd->pending;
+    gd->pending = 0;
+    gd->writer_busy = 1;
+    pthread_mutex_unlock (&gd->lock);
+
+    gd_write (im, gd->filename);
+    gdImageDestroy (im);
+
+    pthread_mutex_lock (&gd->lock);
+    gd->writer_busy = 0;
+  }
+  pthread_mutex_unlock (&gd->lock);
+
+  return 0;
+}
+
+
+/*
+ * end the writer; a picture it has not started on is dropped:
+ */
+static void
+gd_stop_writer (struct piet_gd *gd)
+{
+  if (! gd->has_writer) {
+    return;
+  }
+
+  pthread_mutex_lock (&gd->lock);
+  gd->writer_quit = 1;
+  if (gd->pending) {
+    gdImageDestroy (gd->pending);
+    gd->pending = 0;
+  }
+  pthread_cond_signal (&gd->wake);
+  pthread_mutex_unlock (&gd->lock);
+
+  pthread_join (gd->writer, 0);
+  pthread_cond_destroy (&gd->wake);
+  pthread_mutex_destroy (&gd->lock);
+  gd->has_writer = 0;
+}
+
+
+/*
+ * a copy of the palette picture, for the writer to encode while the
+ * interpreter paints on:
+ */
+static gdImagePtr
+gd_copy (gdImagePtr im)
+{
+  gdImagePtr copy = gdImageCreate (gdImageSX (im), gdImageSY (im));
+  int i;
+
+  if (! copy) {
+    return 0;
+  }
+  for (i = 0; i < gdImageColorsTotal (im); i++) {
+    gdImageColorAllocate (copy, gdImageRed (im, i), gdImageGreen (im, i),
+			  gdImageBlue (im, i));
+  }
+  for (i = 0; i < gdImageSY (im); i++) {
+    memcpy (copy->pixels [i], im->pixels [i], gdImageSX (im));
+  }
+  return copy;
+}
+
+#endif /* pthread */
+
+
+/*
+ * write the picture as it is, waiting for a save in the background
+ * to end first. this is the save at the end of a run (or on ^C):
+ */
+void
+gd_save (struct piet_context *ctx)
+{
+  struct piet_gd *gd = ctx->gd;
+
+  if (! gd) {
+    /* nothing painted yet: */
+    return;
+  }
+  
+#ifdef HAVE_PTHREAD_H
+  gd_stop_writer (gd);
+#endif
+
+  if (gd_write (gd->im, ctx->gd_trace_filename) < 0) {
+    ctx->do_gdtrace = 0;
+  }
+}
+
+
+/*
+ * keep the picture up-to-date while tracing: every gd_save_interval
+ * steps it is handed to the writer thread, unless that is still busy
+ * with the last one; then the next step tries again. a step never
+ * waits for png encoding or the disk.
+ */
+void
+gd_update (struct piet_context *ctx)
+{
+  struct piet_gd *gd = ctx->gd;
+
+  if (! gd || ctx->exec_step - gd->saved_step < ctx->gd_save_interval) {
+    return;
+  }
+
+#ifndef HAVE_PTHREAD_H
+  gd->saved_step = ctx->exec_step;
+  if (gd_write (gd->im, ctx->gd_trace_filename) < 0) {
+    ctx->do_gdtrace = 0;
+  }
+#else
+  if (! gd->has_writer) {
+    gd->filename = ctx->gd_trace_filename;
+    gd->writer_quit = 0;
+    gd->writer_busy = 0;
+    gd->pending = 0;
+    pthread_mutex_init (&gd->lock, 0);
+    pthread_cond_init (&gd->wake, 0);
+    if (pthread_create (&gd->writer, 0, gd_writer, gd) != 0) {
+      pthread_cond_destroy (&gd->wake);
+      pthread_mutex_destroy (&gd->lock);
+      /* no thread, save right here: */
+      gd->saved_step = ctx->exec_step;
+      if (gd_write (gd->im, ctx->gd_trace_filename) < 0) {
+	ctx->do_gdtrace = 0;
+      }
+      return;
+    }
+    gd->has_writer = 1;
+  }
+
+  if (pthread_mutex_trylock (&gd->lock) != 0) {
+    return;
+  }
+  if (! gd->writer_busy && ! gd->pending 
+      && (gd->pending = gd_copy (gd->im)) != 0) {
+    gd->saved_step = ctx->exec_step;
+    pthread_cond_signal (&gd->wake);
+  }
+  pthread_mutex_unlock (&gd->lock);
+#endif
+}
+
+
+void
+gd_free (struct piet_context *ctx)
+{
+  if (ctx->gd) {
+#ifdef HAVE_PTHREAD_H
+    gd_stop_writer (ctx->gd);
+#endif
+    gdImageDestroy (ctx->gd->im);
+    free (ctx->gd);
+    ctx->gd = 0;
+  }
 }
 
 
@@ -847,15 +1321,17 @@ gd_save ()
  * like gd_try_step but with p(ixel)p(ainting) for smaller output size:
  */
 void
-gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
+gd_try_step_pp (struct piet_context *ctx, int try, int n_x, int n_y, 
+		int dp, int cc)
 {
-  int x1 = n_x * c_xy;
-  int y1 = n_y * c_xy;
+  struct piet_gd *gd = ctx->gd;
+  int x1 = n_x * ctx->c_xy;
+  int y1 = n_y * ctx->c_xy;
   int x2, y2, x3, y3;
 
   if (dp_dx(dp) < 0) {
     /* left: */
-    y1 += c_xy - 3;
+    y1 += ctx->c_xy - 3;
     if (cc == 'r') {
       y1 -= 6;
     }
@@ -865,7 +1341,7 @@ gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
     y2 = y3;
   } else if (dp_dx(dp) > 0) {
     /* right: */
-    x1 += c_xy - 1;
+    x1 += ctx->c_xy - 1;
     y1 += 3;
     if (cc == 'r') {
       y1 += 6;
@@ -886,8 +1362,8 @@ gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
     y2 = y3 + 5;
   } else {
     /* down: */
-    x1 += c_xy - 1;
-    y1 += c_xy - 1;
+    x1 += ctx->c_xy - 1;
+    y1 += ctx->c_xy - 1;
     x1 -= 3;
     if (cc == 'r') {
       x1 -= 6;
@@ -898,13 +1374,14 @@ gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
     y2 = y3 - 6;
   } 
 
-  gd_arrow_pp (x1 + gd_try_xoff, y1 + gd_try_yoff,  dp, gd_grey [gd_try_dcol]);
+  gd_arrow_pp (ctx, x1 + gd->try_xoff, y1 + gd->try_yoff,  dp, 
+	       gd->grey [gd->try_dcol]);
 
-  gd_paint_ch (x3, y3, dp, gd_grey [gd_try_dcol]);
-  gd_paint_ch (x3 + 3 + (dp == 'u' ? 1 : 0), y3 + 2, cc, 
-	       gd_grey [gd_try_dcol]);
+  gd_paint_ch (ctx, x3, y3, dp, gd->grey [gd->try_dcol]);
+  gd_paint_ch (ctx, x3 + 3 + (dp == 'u' ? 1 : 0), y3 + 2, cc, 
+	       gd->grey [gd->try_dcol]);
 
-  gd_paint_num (x2, y2, try, gd_grey [gd_try_dcol]);
+  gd_paint_num (ctx, x2, y2, try, gd->grey [gd->try_dcol]);
 
 
   /* experimental: add some increment: */
@@ -912,7 +1389,7 @@ gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
       gd_try_yoff += 5; 
   **/
   /* experimental: increment color value: */
-  gd_try_dcol = (gd_try_dcol + 1) % 8;
+  gd->try_dcol = (gd->try_dcol + 1) % 8;
 }
 
 
@@ -920,21 +1397,22 @@ gd_try_step_pp (int try, int n_x, int n_y, int dp, int cc)
  * paint trace info about this try:
  */
 void
-gd_try_step (int exec_step, int tries, int n_x, int n_y,
-	    int dp, int cc)
+gd_try_step (struct piet_context *ctx, int exec_step, int tries, 
+	     int n_x, int n_y, int dp, int cc)
 {
+  struct piet_gd *gd = ctx->gd;
   char tmp [128];
-  int a_len = i_max((c_xy * 1) / 4, 6);
+  int a_len = i_max((ctx->c_xy * 1) / 4, 6);
 
-  int x1 = (n_x * c_xy) + c_xy / 2 + dp_dx(dp) * a_len;
-  int y1 = (n_y * c_xy) + c_xy / 2 + dp_dy(dp) * a_len;
-  int x2 = (n_x * c_xy) + c_xy / 2 + dp_dx(dp) * (c_xy / 2 - 2);
-  int y2 = (n_y * c_xy) + c_xy / 2 + dp_dy(dp) * (c_xy / 2 - 2);
+  int x1 = (n_x * ctx->c_xy) + ctx->c_xy / 2 + dp_dx(dp) * a_len;
+  int y1 = (n_y * ctx->c_xy) + ctx->c_xy / 2 + dp_dy(dp) * a_len;
+  int x2 = (n_x * ctx->c_xy) + ctx->c_xy / 2 + dp_dx(dp) * (ctx->c_xy / 2 - 2);
+  int y2 = (n_y * ctx->c_xy) + ctx->c_xy / 2 + dp_dy(dp) * (ctx->c_xy / 2 - 2);
   int x3, y3;
 
-  if (c_xy < pp_size) {
+  if (ctx->c_xy < ctx->pp_size) {
     /* try pixel painting: */
-    gd_try_step_pp (tries, n_x, n_y, dp, cc);
+    gd_try_step_pp (ctx, tries, n_x, n_y, dp, cc);
     return;
   }
 
@@ -943,106 +1421,109 @@ gd_try_step (int exec_step, int tries, int n_x, int n_y,
   if (dp_dx(dp) < 0) {
     /* left: */
     if (cc == 'r') {
-      y1 -= gdft->h * 2 + 1;
-      y2 -= gdft->h * 2 + 1;
+      y1 -= gd->ft->h * 2 + 1;
+      y2 -= gd->ft->h * 2 + 1;
     }
-    y1 += (c_xy / 2) - 5;
-    y2 += (c_xy / 2) - 5;
+    y1 += (ctx->c_xy / 2) - 5;
+    y2 += (ctx->c_xy / 2) - 5;
     x3 = x2;
-    y3 = y2 - 2 * gdft->h;
+    y3 = y2 - 2 * gd->ft->h;
   } else if (dp_dx(dp) > 0) {
     /* right: */
     if (cc == 'r') {
-      y1 += gdft->h * 2 + 1;
-      y2 += gdft->h * 2 + 1;
+      y1 += gd->ft->h * 2 + 1;
+      y2 += gd->ft->h * 2 + 1;
     }
-    y1 -= (c_xy / 2) - 5;
-    y2 -= (c_xy / 2) - 5;
-    x3 = x2 - strlen (tmp) * gdft->w;
+    y1 -= (ctx->c_xy / 2) - 5;
+    y2 -= (ctx->c_xy / 2) - 5;
+    x3 = x2 - strlen (tmp) * gd->ft->w;
     y3 = y1 + 2;
   } else if (dp_dy(dp) < 0) {
     /* up: */
     if (cc == 'r') {
-      x1 += gdft->w * strlen (tmp) + 3;
-      x2 += gdft->w * strlen (tmp) + 3;
+      x1 += gd->ft->w * strlen (tmp) + 3;
+      x2 += gd->ft->w * strlen (tmp) + 3;
     }
-    x1 -= (c_xy / 2) - 5;
-    x2 -= (c_xy / 2) - 5;
+    x1 -= (ctx->c_xy / 2) - 5;
+    x2 -= (ctx->c_xy / 2) - 5;
     x3 = x2 + 3;
     y3 = y2;
   } else {
     /* down: */
     if (cc == 'r') {
-      x1 -= gdft->w * strlen (tmp) + 3;
-      x2 -= gdft->w * strlen (tmp) + 3;
+      x1 -= gd->ft->w * strlen (tmp) + 3;
+      x2 -= gd->ft->w * strlen (tmp) + 3;
     }
-    x1 += (c_xy / 2) - 5;
-    x2 += (c_xy / 2) - 5;
-    x3 = x1 - strlen (tmp) * gdft->w - 2;
-    y3 = y2 - 2 * gdft->h + 2;
+    x1 += (ctx->c_xy / 2) - 5;
+    x2 += (ctx->c_xy / 2) - 5;
+    x3 = x1 - strlen (tmp) * gd->ft->w - 2;
+    y3 = y2 - 2 * gd->ft->h + 2;
   } 
 
-  gd_arrow (x1 + gd_try_xoff, y1 + gd_try_yoff, 
-	    x2 + gd_try_xoff, y2 + gd_try_yoff, dp, gd_grey [gd_try_dcol]);
+  gd_arrow (ctx, x1 + gd->try_xoff, y1 + gd->try_yoff, 
+	    x2 + gd->try_xoff, y2 + gd->try_yoff, dp, gd->grey [gd->try_dcol]);
 
-  gdImageString (im, gdft, x3 + gd_try_xoff, y3 + gd_try_yoff, 
+  gdImageString (gd->im, gd->ft, x3 + gd->try_xoff, y3 + gd->try_yoff, 
 		 (unsigned char *) tmp, 
-		 gd_grey [gd_try_dcol]);
+		 gd->grey [gd->try_dcol]);
 
 #if 0
-  gd_paint_dpcc (x1, y1, dp, cc, gd_grey [gd_try_dcol]);
+  gd_paint_dpcc (x1, y1, dp, cc, gd->grey [gd->try_dcol]);
 #else
   sprintf (tmp, "%c/%c", dp, cc);
-  gdImageString (im, gdft, x3 + gd_try_xoff, y3 + gd_try_yoff + gdft->h - 1,
+  gdImageString (gd->im, gd->ft, x3 + gd->try_xoff, 
+		 y3 + gd->try_yoff + gd->ft->h - 1,
 		 (unsigned char *) tmp,
-		 gd_grey [gd_try_dcol]);
+		 gd->grey [gd->try_dcol]);
 #endif
 
-  gd_try_dcol = (gd_try_dcol + 1) % 8;
+  gd->try_dcol = (gd->try_dcol + 1) % 8;
 }
 
 
 void
-gd_action (int p_x, int p_y, int n_x, int n_y, int a_x, int a_y, char *msg)
-{
-  int x1 = (p_x * c_xy) + c_xy / 2;
-  int y1 = (p_y * c_xy) + c_xy / 2;
-  int x2 = (n_x * c_xy) + c_xy / 2;
-  int y2 = (n_y * c_xy) + c_xy / 2;
-  int x3 = (a_x * c_xy) + c_xy / 2;
-  int y3 = (a_y * c_xy) + c_xy / 2;
+gd_action (struct piet_context *ctx, int p_x, int p_y, int n_x, int n_y, 
+	   int a_x, int a_y, char *msg)
+{
+  struct piet_gd *gd = ctx->gd;
+  int x1 = (p_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y1 = (p_y * ctx->c_xy) + ctx->c_xy / 2;
+  int x2 = (n_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y2 = (n_y * ctx->c_xy) + ctx->c_xy / 2;
+  int x3 = (a_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y3 = (a_y * ctx->c_xy) + ctx->c_xy / 2;
   int x4 = x3 - 6;
   int y4 = y3 - 7;
 
   /* in the block: */
-  gdImageLine (im, x1, y1, x2, y2, gd_black);
+  gdImageLine (gd->im, x1, y1, x2, y2, gd->black);
   /* step into new block: */
-  gdImageLine (im, x2, y2, x3, y3, gd_black);
+  gdImageLine (gd->im, x2, y2, x3, y3, gd->black);
 
   /* step circle: */
-  gdImageArc (im, x3, y3, c_xy / 7, c_xy / 7, 0, 360, gd_black);
+  gdImageArc (gd->im, x3, y3, ctx->c_xy / 7, ctx->c_xy / 7, 0, 360, gd->black);
 
-  if (gd_trace_simple && c_xy < 11) {
+  if (ctx->gd_trace_simple && ctx->c_xy < 11) {
     /* makes no sense to print additional info: */
     return;
   }
 
   /* step number: */
-  gd_step_num_pp (x4, y4);
+  gd_step_num_pp (ctx, x4, y4);
 
   /* action string: */
   if (x2 < x3) {
-    x3 = (x2 + x3) / 2 - (strlen(msg) * gdft->w) / 2;
+    x3 = (x2 + x3) / 2 - (strlen(msg) * gd->ft->w) / 2;
     y3 = (y2 + y3) / 2 + 1;
   } else if (x2 > x3) {
-    x3 = (x2 + x3) / 2 - (strlen(msg) * gdft->w) / 2;
-    y3 = (y2 + y3) / 2 - gdft->h;
+    x3 = (x2 + x3) / 2 - (strlen(msg) * gd->ft->w) / 2;
+    y3 = (y2 + y3) / 2 - gd->ft->h;
   } else {
-    x3 = (x2 + x3) / 2 - (strlen(msg) * gdft->w) / 2 + 1;
-    y3 = (y2 + y3) / 2 - gdft->h / 2 - 1;
+    x3 = (x2 + x3) / 2 - (strlen(msg) * gd->ft->w) / 2 + 1;
+    y3 = (y2 + y3) / 2 - gd->ft->h / 2 - 1;
   }
 
-  gdImageString (im, gdft, x3, y3, (unsigned char *) msg, gd_black);
+  gdImageString (gd->im, gd->ft, x3, y3, (unsigned char *) msg, gd->black);
 }
 
 #endif /* GD */
@@ -1050,34 +1531,365 @@ gd_action (int p_x, int p_y, int n_x, int n_y, int a_x, int a_y, char *msg)
 
 
 /*
- * png read support:
+ * svg trace output:
+ *
+ * the gd trace picture covers the whole program with c_xy pixels per
+ * codel, far too much for big programs. the svg trace needs no library
+ * and is streamed to the file while the program runs: a color block is
+ * painted when the execution enters it the first time, the tries and
+ * actions are drawn like gd_try_step and gd_action do. so the file grows
+ * with the area visited and beside the stdio buffer only a flag per
+ * block is kept.
  */
 
-#ifndef HAVE_PNG_H
+#define svg_font_w	5		/* like the tiny gd font */
+#define svg_font_h	8
 
-/*
- * without support, make dummy substitution avail:
+struct piet_svg {
+  FILE *out;
+  unsigned char *seen;		/* blocks painted so far */
+  int max_seen;
+  int started;			/* start circle drawn */
+  int try_dcol;			/* grey of the next try */
+};
+
+
+static void
+svg_text (FILE *out, int x, int y, int rgb, const char *s)
+{
+  /* like gdImageString, y is the top of the text: */
+  fprintf (out, "<text x=\"%d\" y=\"%d\" fill=\"#%06x\">", 
+	   x, y + svg_font_h - 1, rgb);
+  for (; *s; s++) {
+    if (*s == '<') {
+      fputs ("&lt;", out);
+    } else if (*s == '>') {
+      fputs ("&gt;", out);
+    } else if (*s == '&') {
+      fputs ("&amp;", out);
+    } else {
+      putc (*s, out);
+    }
+  }
+  fputs ("</text>\n", out);
+}
+
+
+static void
+svg_arrow (FILE *out, int x1, int y1, int x2, int y2, int dp, int rgb)
+{
+  int mx = (x2 + x1) / 2, my = (y2 + y1) / 2;
+
+  fprintf (out, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" "
+	   "stroke=\"#%06x\"/>\n", x1, y1, x2, y2, rgb);
+  fprintf (out, "<polygon points=\"%d,%d %d,%d %d,%d\" fill=\"#%06x\"/>\n",
+	   x2, y2, mx - 2 * dp_dy(dp), my - 2 * dp_dx(dp),
+	   mx + 2 * dp_dy(dp), my + 2 * dp_dx(dp), rgb);
+}
+
+
+/*
+ * paint the block of codel x,y, unless done before. the block exits
+ * give its bounding box (dp right, down, left and up), the codels are
+ * painted as runs per row.
+ */
+static void
+svg_paint_block (struct piet_context *ctx, int x, int y)
+{
+  struct piet_svg *svg = ctx->svg;
+  struct piet_block *b;
+  int *map;
+  int n, i, j, x0, x1, y0, y1;
+
+  if (x < 0 || y < 0 || x >= ctx->width || y >= ctx->height
+      || ! ctx->block_map) {
+    return;
+  }
+
+  n = ctx->block_map [y * ctx->width + x];
+  if (n >= svg->max_seen) {
+    int max = ctx->max_blocks > n ? ctx->max_blocks : n + 1;
+
+    if (! (svg->seen = (unsigned char *) realloc (svg->seen, max))) {
+      fprintf (stderr, "out of memory: cannot trace %d blocks\n", max);
+      exit (-99);
+    }
+    memset (svg->seen + svg->max_seen, 0, max - svg->max_seen);
+    svg->max_seen = max;
+  }
+  if (svg->seen [n]) {
+    return;
+  }
+  svg->seen [n] = 1;
+
+  b = &ctx->blocks [n];
+  x1 = b->exit_x [0];
+  y1 = b->exit_y [2];
+  x0 = b->exit_x [4];
+  y0 = b->exit_y [6];
+
+  fprintf (svg->out, "<g fill=\"#%06x\">\n", c_colors [b->color].col);
+  for (j = y0; j <= y1; j++) {
+    map = ctx->block_map + j * ctx->width;
+    for (i = x0; i <= x1; i++) {
+      int k = i;
+
+      while (k <= x1 && map [k] == n) {
+	k++;
+      }
+      if (k > i) {
+	fprintf (svg->out, "<rect x=\"%d\" y=\"%d\" width=\"%d\" "
+		 "height=\"%d\"/>\n", i * ctx->c_xy, j * ctx->c_xy, 
+		 (k - i) * ctx->c_xy, ctx->c_xy);
+	i = k;
+      }
+    }
+  }
+  fputs ("</g>\n", svg->out);
+}
+
+
+/*
+ * a new step: paint the block we are in (and the start circle, if this
+ * is the first step traced).
+ */
+static void
+svg_try_init (struct piet_context *ctx)
+{
+  struct piet_svg *svg = ctx->svg;
+
+  svg->try_dcol = 0;
+  svg_paint_block (ctx, ctx->p_xpos, ctx->p_ypos);
+
+  if (! svg->started) {
+    fprintf (svg->out, "<circle cx=\"%d\" cy=\"%d\" r=\"%g\" fill=\"none\" "
+	     "stroke=\"black\"/>\n", ctx->p_xpos * ctx->c_xy + ctx->c_xy / 2,
+	     ctx->p_ypos * ctx->c_xy + ctx->c_xy / 2, ctx->c_xy / 14.0);
+    svg->started = 1;
+  }
+}
+
+
+/*
+ * trace info about this try, placed like gd_try_step does:
+ */
+static void
+svg_try_step (struct piet_context *ctx, int exec_step, int tries, 
+	      int n_x, int n_y, int dp, int cc)
+{
+  struct piet_svg *svg = ctx->svg;
+  char tmp [128];
+  int a_len = ctx->c_xy / 4 > 6 ? ctx->c_xy / 4 : 6;
+  int grey = (72 + 6 * svg->try_dcol) * 0x010101;
+
+  int x1 = (n_x * ctx->c_xy) + ctx->c_xy / 2 + dp_dx(dp) * a_len;
+  int y1 = (n_y * ctx->c_xy) + ctx->c_xy / 2 + dp_dy(dp) * a_len;
+  int x2 = (n_x * ctx->c_xy) + ctx->c_xy / 2 + dp_dx(dp) * (ctx->c_xy / 2 - 2);
+  int y2 = (n_y * ctx->c_xy) + ctx->c_xy / 2 + dp_dy(dp) * (ctx->c_xy / 2 - 2);
+  int x3, y3, len;
+
+  sprintf (tmp, "%d.%d", exec_step, tries);
+  len = strlen (tmp);
+
+  if (dp_dx(dp) < 0) {
+    /* left: */
+    if (cc == 'r') {
+      y1 -= svg_font_h * 2 + 1;
+      y2 -= svg_font_h * 2 + 1;
+    }
+    y1 += (ctx->c_xy / 2) - 5;
+    y2 += (ctx->c_xy / 2) - 5;
+    x3 = x2;
+    y3 = y2 - 2 * svg_font_h;
+  } else if (dp_dx(dp) > 0) {
+    /* right: */
+    if (cc == 'r') {
+      y1 += svg_font_h * 2 + 1;
+      y2 += svg_font_h * 2 + 1;
+    }
+    y1 -= (ctx->c_xy / 2) - 5;
+    y2 -= (ctx->c_xy / 2) - 5;
+    x3 = x2 - len * svg_font_w;
+    y3 = y1 + 2;
+  } else if (dp_dy(dp) < 0) {
+    /* up: */
+    if (cc == 'r') {
+      x1 += svg_font_w * len + 3;
+      x2 += svg_font_w * len + 3;
+    }
+    x1 -= (ctx->c_xy / 2) - 5;
+    x2 -= (ctx->c_xy / 2) - 5;
+    x3 = x2 + 3;
+    y3 = y2;
+  } else {
+    /* down: */
+    if (cc == 'r') {
+      x1 -= svg_font_w * len + 3;
+      x2 -= svg_font_w * len + 3;
+    }
+    x1 += (ctx->c_xy / 2) - 5;
+    x2 += (ctx->c_xy / 2) - 5;
+    x3 = x1 - len * svg_font_w - 2;
+    y3 = y2 - 2 * svg_font_h + 2;
+  } 
+
+  svg_arrow (svg->out, x1, y1, x2, y2, dp, grey);
+  svg_text (svg->out, x3, y3, grey, tmp);
+  sprintf (tmp, "%c/%c", dp, cc);
+  svg_text (svg->out, x3, y3 + svg_font_h - 1, grey, tmp);
+
+  svg->try_dcol = (svg->try_dcol + 1) % 8;
+}
+
+
+/*
+ * the step from p_x,p_y over the exit n_x,n_y into a_x,a_y, as
+ * gd_action paints it:
+ */
+static void
+svg_action (struct piet_context *ctx, int p_x, int p_y, int n_x, int n_y, 
+	    int a_x, int a_y, char *msg)
+{
+  struct piet_svg *svg = ctx->svg;
+  int x1 = (p_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y1 = (p_y * ctx->c_xy) + ctx->c_xy / 2;
+  int x2 = (n_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y2 = (n_y * ctx->c_xy) + ctx->c_xy / 2;
+  int x3 = (a_x * ctx->c_xy) + ctx->c_xy / 2;
+  int y3 = (a_y * ctx->c_xy) + ctx->c_xy / 2;
+  int w = strlen (msg) * svg_font_w;
+
+  /* both blocks go below the lines: */
+  svg_paint_block (ctx, p_x, p_y);
+  svg_paint_block (ctx, a_x, a_y);
+
+  /* in the block and into the new block: */
+  fprintf (svg->out, "<polyline points=\"%d,%d %d,%d %d,%d\" fill=\"none\" "
+	   "stroke=\"black\"/>\n", x1, y1, x2, y2, x3, y3);
+
+  /* step circle: */
+  fprintf (svg->out, "<circle cx=\"%d\" cy=\"%d\" r=\"%g\" fill=\"none\" "
+	   "stroke=\"black\"/>\n", x3, y3, ctx->c_xy / 14.0);
+
+  if (ctx->gd_trace_simple && ctx->c_xy < 11) {
+    /* makes no sense to print additional info: */
+    return;
+  }
+
+  if (ctx->c_xy <= ctx->pp_size) {
+    /* step number, as the small pictures of the gd trace have it: */
+    char tmp [32];
+
+    sprintf (tmp, "%u", ctx->exec_step);
+    svg_text (svg->out, x3 - 6, y3 - 7 - svg_font_h, 0xb4b4b4, tmp);
+  }
+
+  /* action string: */
+  if (x2 < x3) {
+    x3 = (x2 + x3) / 2 - w / 2;
+    y3 = (y2 + y3) / 2 + 1;
+  } else if (x2 > x3) {
+    x3 = (x2 + x3) / 2 - w / 2;
+    y3 = (y2 + y3) / 2 - svg_font_h;
+  } else {
+    x3 = (x2 + x3) / 2 - w / 2 + 1;
+    y3 = (y2 + y3) / 2 - svg_font_h / 2 - 1;
+  }
+
+  svg_text (svg->out, x3, y3, 0x000000, msg);
+}
+
+
+int
+piet_ctx_svg_open (struct piet_context *ctx, const char *filename)
+{
+  struct piet_svg *svg;
+  FILE *out;
+
+  piet_ctx_svg_close (ctx);
+
+  if (! (out = fopen (filename, "w"))) {
+    fprintf (stderr, "cannot open %s for writing; reason: %s\n",
+	     filename, strerror (errno));
+    return -1;
+  }
+  if (! (svg = (struct piet_svg *) calloc (1, sizeof (struct piet_svg)))) {
+    fprintf (stderr, "out of memory: cannot trace to %s\n", filename);
+    fclose (out);
+    return -1;
+  }
+  svg->out = out;
+  setvbuf (out, 0, _IOFBF, 64 * 1024);
+
+  /* the codels not visited stay grey: */
+  fprintf (out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	   "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+	   "width=\"%d\" height=\"%d\" font-family=\"monospace\" "
+	   "font-size=\"%d\">\n"
+	   "<rect width=\"100%%\" height=\"100%%\" fill=\"#a0a0a0\"/>\n",
+	   ctx->width * ctx->c_xy, ctx->height * ctx->c_xy, svg_font_h);
+
+  ctx->svg = svg;
+  vprintf ("info: svg trace output to %s\n", filename);
+  return 0;
+}
+
+
+void
+piet_ctx_svg_close (struct piet_context *ctx)
+{
+  struct piet_svg *svg = ctx->svg;
+
+  if (! svg) {
+    return;
+  }
+
+  fputs ("</svg>\n", svg->out);
+  if (fclose (svg->out) != 0) {
+    fprintf (stderr, "cannot write the svg trace; reason: %s\n",
+	     strerror (errno));
+  }
+  free (svg->seen);
+  free (svg);
+  ctx->svg = 0;
+}
+
+
+
+/*
+ * png read support:
+ */
+
+#ifndef HAVE_PNG_H
+
+/*
+ * without support, make dummy substitution avail:
  */
-#define read_png(f)	(-1)
+#define piet_ctx_read_png(ctx, f)	(-1)
 
 #else
 
 #include <png.h>
 #include <math.h>
+#include <setjmp.h>
 
-png_byte bit_depth;
-
-png_structp png_ptr;
-png_infop info_ptr;
-int number_of_passes;
-png_bytep * row_pointers;
-
+/*
+ * the png is decoded row by row, every row is classified right away
+ * (only every codel_size'th row and pixel, if the codel size is known),
+ * so beside the cells only a row is kept. interlaced pictures come
+ * complete with the last pass only and are decoded as a whole.
+ */
 int
-read_png (char *fname)
+piet_ctx_read_png (struct piet_context *ctx, char *fname)
 {
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_bytep volatile data = 0;
+  png_bytep * volatile row_pointers = 0;
   char header [8];
   FILE *in;
-  int i, j, ncol, rc;
+  int j, w, h, passes, step, rc;
+  size_t row_bytes;
 
   if (! strcmp (fname, "-")) {
     /* read from stdin: */
@@ -1093,62 +1905,103 @@ read_png (char *fname)
 
   if (! in || (rc = fread (header, 1, 8, in)) != 8
       || png_sig_cmp ((unsigned char *) header, 0, 8) != 0) {
+    fclose (in);
     return -1;
   }
 
   if (! (png_ptr = png_create_read_struct (PNG_LIBPNG_VER_STRING, 0, 0, 0))
       || ! (info_ptr = png_create_info_struct (png_ptr))) {
+    fclose (in);
+    return -1;
+  }
+
+  if (setjmp (png_jmpbuf (png_ptr))) {
+    /* libpng complained already: */
+    free (row_pointers);
+    free (data);
+    png_destroy_read_struct (&png_ptr, &info_ptr, 0);
+    fclose (in);
     return -1;
   }
 
   png_init_io (png_ptr, in);
   png_set_sig_bytes (png_ptr, 8);
-  
-  png_read_png (png_ptr, info_ptr, 
-		PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_STRIP_ALPHA
-		| PNG_TRANSFORM_EXPAND, NULL);
-  /**		| PNG_TRANSFORM_PACKING | PNG_TRANSFORM_SHIFT **/
+  png_read_info (png_ptr, info_ptr);
 
-  row_pointers = png_get_rows (png_ptr, info_ptr);
+  w = png_get_image_width (png_ptr, info_ptr);
+  h = png_get_image_height (png_ptr, info_ptr);
 
-  width = png_get_image_width(png_ptr, info_ptr);
-  height = png_get_image_height(png_ptr, info_ptr);
-  ncol = 2 << (png_get_bit_depth(png_ptr, info_ptr) - 1);
+  vprintf ("info: got %d x %d pixel with %d bit\n", w, h, 
+	   png_get_bit_depth (png_ptr, info_ptr));
 
-  vprintf ("info: got %d x %d pixel with %d cols\n", width, height, ncol);
+  /* 8 bit rgb, whatever the file holds: */
+  png_set_expand (png_ptr);
+  png_set_strip_16 (png_ptr);
+  png_set_strip_alpha (png_ptr);
+  if (! (png_get_color_type (png_ptr, info_ptr) & PNG_COLOR_MASK_COLOR)) {
+    png_set_gray_to_rgb (png_ptr);
+  }
+  passes = png_set_interlace_handling (png_ptr);
+  png_read_update_info (png_ptr, info_ptr);
+  row_bytes = png_get_rowbytes (png_ptr, info_ptr);
+
+  step = 1;
+  if (ctx->codel_size > 1) {
+    step = ctx->codel_size;
+    if (0 != w % step || 0 != h % step) {
+      fprintf (stderr, "error: codelsize %d does not match %d x %d pixel\n",
+	       step, w, h);
+      png_destroy_read_struct (&png_ptr, &info_ptr, 0);
+      fclose (in);
+      return -1;
+    }
+    /* one pixel per codel from now on: */
+    ctx->codel_size = 1;
+  }
 
-  alloc_cells (width, height);
+  data = (png_bytep) malloc (row_bytes * (passes > 1 ? h : 1));
+  if (passes > 1) {
+    row_pointers = (png_bytep *) malloc (h * sizeof (png_bytep));
+  }
+  if (! data || (passes > 1 && ! row_pointers)) {
+    fprintf (stderr, "out of memory: cannot read %d x %d pixel\n", w, h);
+    exit (-99);
+  }
 
-  for (j = 0; j < height; j++) {
-    png_byte *row = row_pointers [j];
-    for (i = 0; i < width; i++) {
+  if (passes > 1) {
+    for (j = 0; j < h; j++) {
+      row_pointers [j] = data + j * row_bytes;
+    }
+    png_read_image (png_ptr, row_pointers);
+  }
 
-      png_byte *ptr = & row [i * 3];
+  alloc_cells (ctx, w / step, h / step);
 
-      /* ncol always 256 ? */
-      int r = (ptr [0] * 256) / ncol;
-      int g = (ptr [1] * 256) / ncol;
-      int b = (ptr [2] * 256) / ncol;
+  rc = 0;
+  for (j = 0; j < h; j++) {
+    png_bytep row = data;
 
-      int col = ((r * 256 + g) * 256) + b;
-      int col_idx = get_color_idx (col);
+    if (passes > 1) {
+      row = row_pointers [j];
+    } else {
+      png_read_row (png_ptr, row, 0);
+    }
 
-      if (col_idx < 0) {
-	if (unknown_color == -1) {
-	  fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
-		   fname);
-	  return -1;
-	} else {
-	  /* set to black or white: */
-	  col_idx = (unknown_color == 0 ? c_black : c_white);
-	}
-      }
-      
-      set_cell (i, j, col_idx);
+    if (j % step == 0 
+	&& set_codel_row (ctx, j / step, row, step) < 0) {
+      fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
+	       fname);
+      rc = -1;
+      break;
     }
   }
 
-  return 0;
+  free (row_pointers);
+  free (data);
+  png_destroy_read_struct (&png_ptr, &info_ptr, 0);
+  fclose (in);
+
+  return rc;
 }
 
 #endif /* PNG */
@@ -1163,19 +2016,20 @@ read_png (char *fname)
 /*
  * without support, make dummy substitution avail:
  */
-#define read_gif(f)	(-1)
+#define piet_ctx_read_gif(ctx, f)	(-1)
 
 #else
 
 #include <gif_lib.h>
 
 int
-read_gif (char *fname) 
+piet_ctx_read_gif (struct piet_context *ctx, char *fname) 
 {
   GifFileType *gif;
   GifRecordType rtype;
   GifColorType *gcol;
-  int i, j, width, height, col_idx;
+  unsigned char *line, *rgb;
+  int i, j, width, height;
 
   if (! strcmp (fname, "-")) {
     /* read from stdin: */
@@ -1219,50 +2073,41 @@ read_gif (char *fname)
  
   vprintf ("info: got gif image with %d x %d pixel\n", width, height);
 
-  alloc_cells (width, height);
+  alloc_cells (ctx, width, height);
 
   /* color map pointer: */
   gcol = gif->Image.ColorMap ? gif->Image.ColorMap->Colors 
     : gif->SColorMap->Colors;
 
+  if (! (line = malloc (width)) || ! (rgb = malloc (3 * width))) {
+    fprintf (stderr, "error: out of memory reading gif - exiting\n");
+    exit (-1);
+  }
+
   for (j = 0; j < height; j++) {
     
-    unsigned char *line;
-    
-    if (! (line = malloc (width))) {
-      fprintf (stderr, "error: out of memory reading gif - exiting\n");
-      exit (-1);
-    }
-
     DGifGetLine (gif, line, width);
 	
     for (i = 0; i < width; i++) {
-      
-      int col = line [i];
-      GifColorType *gctype = gcol + col;
-      int r = gctype->Red;
-      int g = gctype->Green;
-      int b = gctype->Blue;
-      
-      col = (r * 256 + g) * 256 + b;
-      col_idx = get_color_idx (col);
-	
-      if (col_idx < 0) {
-	vprintf ("info: unknown color 0x%06x at %d,%d\n", col, i, j);
-	if (unknown_color == -1) {
-	  fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
-		   fname);
-	  return -1;
-	} else {
-	  /* set to black or white: */
-	  col_idx = (unknown_color == 0 ? c_black : c_white);
-	}
-      }
-	  
-      set_cell (i, j, col_idx);
+      GifColorType *gctype = gcol + line [i];
+
+      rgb [3 * i] = gctype->Red;
+      rgb [3 * i + 1] = gctype->Green;
+      rgb [3 * i + 2] = gctype->Blue;
+    }
+
+    if (piet_ctx_set_row (ctx, j, rgb, piet_row_rgb) < 0) {
+      fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
+	       fname);
+      free (line);
+      free (rgb);
+      DGifCloseFile (gif);
+      return -1;
     }
   }
 
+  free (line);
+  free (rgb);
   DGifCloseFile (gif);
 
   return 0;
@@ -1274,13 +2119,159 @@ read_gif (char *fname)
 #endif /* gif */
 
 
+#ifndef HAVE_SYS_MMAN_H
+
+/*
+ * without mmap, read everything through stdio:
+ */
+#define read_ppm_mapped(ctx, f)	(1)
+
+#else
+
+/*
+ * the next number of a ppm header, skipping white space and comments;
+ * -1 if there is none:
+ */
+static int
+ppm_number (const unsigned char *p, size_t len, size_t *pos)
+{
+  long val = 0;
+  size_t i = *pos;
+
+  for (;;) {
+    if (i < len && p [i] == '#') {
+      while (i < len && p [i] != '\n') {
+	i++;
+      }
+    } else if (i < len && (p [i] == ' ' || p [i] == '\t' 
+			   || p [i] == '\r' || p [i] == '\n')) {
+      i++;
+    } else {
+      break;
+    }
+  }
+
+  if (i >= len || p [i] < '0' || p [i] > '9') {
+    return -1;
+  }
+  while (i < len && p [i] >= '0' && p [i] <= '9') {
+    val = val * 10 + (p [i++] - '0');
+    if (val > INT_MAX) {
+      return -1;
+    }
+  }
+
+  *pos = i;
+  return (int) val;
+}
+
+
+/*
+ * read a binary ppm with 255 colors straight from the mapped file:
+ * the rows are classified where they are, and with a known codel size
+ * only the first pixel of each codel is looked at, so the picture
+ * comes out shrunk already.
+ *
+ * returns 1, if the file is left to the stdio reader (no regular file,
+ * no P6 with 255 colors).
+ */
+static int
+read_ppm_mapped (struct piet_context *ctx, char *fname)
+{
+  const unsigned char *map;
+  struct stat st;
+  size_t len, pos = 2, stride;
+  int fd, j, width, height, ncol, step, rc = 0;
+
+  if ((fd = open (fname, O_RDONLY)) < 0) {
+    fprintf (stderr, "cannot open `%s'; reason: %s\n", fname,
+	     strerror (errno));
+    return -1;
+  }
+  if (fstat (fd, &st) < 0 || ! S_ISREG (st.st_mode) || st.st_size < 2) {
+    close (fd);
+    return 1;
+  }
+
+  len = (size_t) st.st_size;
+  map = (const unsigned char *) mmap (0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == (const unsigned char *) MAP_FAILED) {
+    return 1;
+  }
+
+  if (map [0] != 'P' || map [1] != '6'
+      || (width = ppm_number (map, len, &pos)) < 0
+      || (height = ppm_number (map, len, &pos)) < 0
+      || (ncol = ppm_number (map, len, &pos)) != 255
+      || pos >= len) {
+    /* let the stdio reader complain or convert: */
+    munmap ((void *) map, len);
+    return 1;
+  }
+
+  /* a single white space ends the header: */
+  pos++;
+  stride = 3 * (size_t) width;
+
+  vprintf ("info: got ppm image with %d x %d pixel and %d cols\n", 
+	   width, height, ncol);
+
+  if (width < 1 || height < 1 || (len - pos) / stride < (size_t) height) {
+    fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
+	     width < 1 || height < 1 ? "unknown width height" : "EOF");
+    munmap ((void *) map, len);
+    return -1;
+  }
+
+#ifdef MADV_SEQUENTIAL
+  madvise ((void *) map, len, MADV_SEQUENTIAL);
+#endif
+
+  step = 1;
+  if (ctx->codel_size > 1) {
+    step = ctx->codel_size;
+    if (0 != width % step || 0 != height % step) {
+      fprintf (stderr, "error: codelsize %d does not match %d x %d pixel\n",
+	       step, width, height);
+      munmap ((void *) map, len);
+      return -1;
+    }
+    /* one pixel per codel from now on: */
+    ctx->codel_size = 1;
+  }
+
+  alloc_cells (ctx, width / step, height / step);
+
+  for (j = 0; j < ctx->height; j++) {
+    if (set_codel_row (ctx, j, map + pos + j * step * stride, step) < 0) {
+      fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
+	       fname);
+      rc = -1;
+      break;
+    }
+  }
+
+  munmap ((void *) map, len);
+  return rc;
+}
+
+#endif /* mmap */
+
+
 int
-read_ppm (char *fname)
+piet_ctx_read_ppm (struct piet_context *ctx, char *fname)
 {
   FILE *in;
   char line [1024];
+  unsigned char *rgb;
   int ppm_type = 0;
-  int i, j, width, height, ncol;
+  int i, j, width, height, ncol, rc;
+
+  if (strcmp (fname, "-") 
+      && (rc = read_ppm_mapped (ctx, fname)) <= 0) {
+    return rc;
+  }
 
   if (! strcmp (fname, "-")) {
     /* read from stdin: */
@@ -1337,45 +2328,68 @@ read_ppm (char *fname)
   vprintf ("info: got ppm image with %d x %d pixel and %d cols\n", 
 	   width, height, ncol);
 
-  alloc_cells (width, height);
+  alloc_cells (ctx, width, height);
 
-  for (j = 0; j < height; j++) {
-    for (i = 0; i < width; i++) {
+  if (! (rgb = malloc (3 * width))) {
+    fprintf (stderr, "out of memory: cannot read a row of %d pixel\n", width);
+    exit (-99);
+  }
 
-      int r, g, b, col, col_idx;
+  for (j = 0; j < height; j++) {
 
-      if (ppm_type == 6) {
-	if ((r = fgetc (in)) < 0 
-	    || (g = fgetc (in)) < 0 
-	    || (b = fgetc (in)) < 0) {
-	  fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
-		   strerror (errno));
-	  return -1;
-	}
-      } else if (ppm_type == 3) {
-	if (3 != fscanf (in, "%d %d %d", &r, &g, &b)) {
-	  fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
-		   strerror (errno));
-	  return -1;
-	}
+    if (ppm_type == 6 && ncol == 255) {
+      /* the row is what we want already: */
+      if (fread (rgb, 3, width, in) != (size_t) width) {
+	fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
+		 strerror (errno));
+	free (rgb);
+	return -1;
       }
-
-      col = ((r * (ncol + 1) + g) * (ncol + 1)) + b;
-      col_idx = get_color_idx (col);
-      if (col_idx < 0) {
-	vprintf ("info: unknown color 0x%06x at %d,%d\n", col, i, j);
-	if (unknown_color == -1) {
-	  fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
-		   fname);
-	  return -1;
-	} else {
-	  /* set to black or white: */
-	  col_idx = (unknown_color == 0 ? c_black : c_white);
+    } else {
+      for (i = 0; i < width; i++) {
+
+	int r, g, b, col;
+
+	if (ppm_type == 6) {
+	  if ((r = fgetc (in)) < 0 
+	      || (g = fgetc (in)) < 0 
+	      || (b = fgetc (in)) < 0) {
+	    fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
+		     strerror (errno));
+	    free (rgb);
+	    return -1;
+	  }
+	} else if (ppm_type == 3) {
+	  if (3 != fscanf (in, "%d %d %d", &r, &g, &b)) {
+	    fprintf (stderr, "cannot read from `%s'; reason: %s\n", fname,
+		     strerror (errno));
+	    free (rgb);
+	    return -1;
+	  }
+	}
+
+	col = ((r * (ncol + 1) + g) * (ncol + 1)) + b;
+	if (col & ~0xffffff) {
+	  /* no piet color: */
+	  col = 0x010101;
 	}
+	rgb [3 * i] = col >> 16;
+	rgb [3 * i + 1] = (col >> 8) & 0xff;
+	rgb [3 * i + 2] = col & 0xff;
       }
-      
-      set_cell (i, j, col_idx);
     }
+
+    if (piet_ctx_set_row (ctx, j, rgb, piet_row_rgb) < 0) {
+      fprintf (stderr, "cannot read from `%s'; reason: invalid color found\n",
+	       fname);
+      free (rgb);
+      return -1;
+    }
+  }
+
+  free (rgb);
+  if (in != stdin) {
+    fclose (in);
   }
 
   return 0;
@@ -1409,199 +2423,459 @@ c_check (int i, int c, int *last_c, int *last_p, int *min_w)
  * if we should guess the size, look about the smallest continuous 
  * pixels.  this works quite good and is really helpful.
  */
-void
-cleanup_input ()
+int
+piet_ctx_cleanup_input (struct piet_context *ctx)
 {
   int i, j, last_c, last_p;
-  int min_w = width + 1;
-  int *o_cells;
+  int min_w = ctx->width + 1;
+  int o_stride = ctx->width + 2;
+  unsigned char *o_cells;
 
-  if (codel_size < 0) {
+  if (ctx->codel_size < 0) {
     /* scan input: */
 
     /* left to right: */
-    for (j = 0; j < height; j++) {
-      for (i = 0; i < width; i++) {
-	c_check (i, cells [j * width + i], &last_c, &last_p, &min_w);
+    for (j = 0; j < ctx->height; j++) {
+      for (i = 0; i < ctx->width; i++) {
+	c_check (i, cell_at (ctx, i, j), &last_c, &last_p, &min_w);
       }
       c_check (i, c_mark_index, &last_c, &last_p, &min_w);
     }
 
     /* top to bottom: */
-    for (i = 0; i < width; i++) {
-      for (j = 0; j < height; j++) {
-	c_check (j, cells [j * width + i], &last_c, &last_p, &min_w);
+    for (i = 0; i < ctx->width; i++) {
+      for (j = 0; j < ctx->height; j++) {
+	c_check (j, cell_at (ctx, i, j), &last_c, &last_p, &min_w);
       }
       c_check (j, c_mark_index, &last_c, &last_p, &min_w);
     }
   
     vprintf ("info: codelsize guessed is %d pixel\n", min_w);
-    codel_size = min_w;
+    ctx->codel_size = min_w;
   }
 
-  if (0 != (width % codel_size)) {
+  if (0 != (ctx->width % ctx->codel_size)) {
     fprintf (stderr, "error: codelsize %d does not match width of %d pixel\n",
-	     codel_size, width);
-    exit (-5);
+	     ctx->codel_size, ctx->width);
+    return -1;
   } 
-  if (0 != (height % codel_size)) {
+  if (0 != (ctx->height % ctx->codel_size)) {
     fprintf (stderr, "error: codelsize %d does not match height of %d pixel\n",
-	     codel_size, width);
-    exit (-5);
+	     ctx->codel_size, ctx->width);
+    return -1;
   } 
 
   /* make a copy: */
-  o_cells = (int *) malloc (width * height * sizeof(int));
-  memcpy (o_cells, cells, width * height * sizeof(int));
+  o_cells = (unsigned char *) malloc (o_stride * (ctx->height + 2));
+  if (! o_cells) {
+    fprintf (stderr, "out of memory: cannot allocate %d * %d cells\n",
+	     ctx->height, ctx->width);
+    exit (-99);
+  }
+  memcpy (o_cells, ctx->cells, o_stride * (ctx->height + 2));
 
   /* now reduce to single dot size: */
-  width = width / codel_size;
-  height = height / codel_size;
+  ctx->width = ctx->width / ctx->codel_size;
+  ctx->height = ctx->height / ctx->codel_size;
   
-  alloc_cells (width, height);
+  alloc_cells (ctx, ctx->width, ctx->height);
 
-  for (j = 0; j < height; j++) {
-    for (i = 0; i < width; i++) {
-      set_cell (i, j, o_cells [(j * codel_size) * (width * codel_size)
-			       + (i * codel_size)]);
+  for (j = 0; j < ctx->height; j++) {
+    for (i = 0; i < ctx->width; i++) {
+      cell_at (ctx, i, j) = o_cells [(j * ctx->codel_size + 1) * o_stride
+				     + i * ctx->codel_size + 1];
     }
   }
 
   free (o_cells);
+
+  return 0;
 }
 
 /*
- * to find a edge in dp / cc direction we simple use a recursive 
- * fill-algorithm. 
- * to avoid makeing a copy, we fill it twice: first with a 
- * internal color index and then with the original color.
+ * color block labeling:
+ *
+ * to find a edge in dp / cc direction we used to flood-fill the
+ * current block on every step (and fill it twice to avoid a copy).
+ * now all connected blocks are labeled once before execution and the
+ * furthest codel for every dp / cc combination is remembered, so the
+ * border walk is a simple table lookup and the cells stay untouched.
  */
-int 
-check_connected_cell (int x, int y, int c_idx, int c_mark, 
-		      int *n_x, int *n_y, int *num_cells)
-{
-  int c, found;
 
-  c = get_cell (x, y);
+/* dp and cc as table index (dp in clockwise order, like turn_dp): */
+#define dp_idx(dp)	((dp) == 'r' ? 0 : ((dp) == 'd' ? 1 : \
+			 ((dp) == 'l' ? 2 : 3)))
+#define cc_idx(cc)	((cc) == 'l' ? 0 : 1)
+#define exit_idx(dp, cc)	(dp_idx (dp) * 2 + cc_idx (cc))
 
-  if (c < 0 || c != c_idx || c == c_mark_index) {
-    /* invalid cell reached: */
-    return -1;
+static char idx_dp [4] = { p_right, p_down, p_left, p_up };
+static char idx_cc [2] = { p_left, p_right };
+
+
+/*
+ * look, if codel x,y is further in dp and cc direction than n_x,n_y:
+ */
+static int
+exit_better (int dp, int cc, int x, int y, int n_x, int n_y)
+{
+  if (dp == 'l' && x <= n_x) {			/* left */
+    return x < n_x || (cc == 'l' && y > n_y) || (cc == 'r' && y < n_y);
+  } else if (dp == 'r' && x >= n_x) {		/* right */
+    return x > n_x || (cc == 'l' && y < n_y) || (cc == 'r' && y > n_y);
+  } else if (dp == 'u' && y <= n_y) {		/* up */
+    return y < n_y || (cc == 'l' && x < n_x) || (cc == 'r' && x > n_x);
+  } else if (dp == 'd' && y >= n_y) {		/* down */
+    return y > n_y || (cc == 'l' && x > n_x) || (cc == 'r' && x < n_x);
   }
+  return 0;
+}
 
-  dprintf ("deb: check_connected_cell %d,%d (c %d col_idx %d)\n",
-	   x, y, c, c_idx);
-  
-  /*
-   * look, if this codel is the furthest in dp and cc direction: 
-   */
-  found = 0;
 
-  if (p_dir_pointer == 'l' && x <= *n_x) {		/* left */
-    if (x < *n_x 
-	|| (p_codel_chooser == 'l' && y > *n_y)
-	|| (p_codel_chooser == 'r' && y < *n_y)) {
-      found = 1;
+/*
+ * a new, empty block for codels of the given color starting at x,y:
+ * reuse a number freed by an edit or grow the tables. while labeling
+ * the whole picture the transition table is left alone, it is
+ * allocated (cleared) at the end.
+ */
+static int
+alloc_block (struct piet_context *ctx, int color, int x, int y)
+{
+  struct piet_block *b;
+  int k, n;
+
+  if (ctx->num_free_blocks > 0) {
+    n = ctx->free_blocks [--ctx->num_free_blocks];
+  } else {
+    if (ctx->num_blocks >= ctx->max_blocks) {
+      int max = ctx->max_blocks > 0 ? 2 * ctx->max_blocks : 64;
+
+      ctx->blocks = (struct piet_block *) 
+	realloc (ctx->blocks, max * sizeof (struct piet_block));
+      ctx->free_blocks = (int *) realloc (ctx->free_blocks, max * sizeof (int));
+      if (ctx->blocks_valid) {
+	ctx->transitions = (struct piet_transition *) 
+	  realloc (ctx->transitions, 
+		   max * 8 * sizeof (struct piet_transition));
+      }
+      if (! ctx->blocks || ! ctx->free_blocks 
+	  || (ctx->blocks_valid && ! ctx->transitions)) {
+	fprintf (stderr, "out of memory: cannot label %d * %d cells\n",
+		 ctx->height, ctx->width);
+	exit (-99);
+      }
+      ctx->max_blocks = max;
     }
+    n = ctx->num_blocks++;
+  }
+
+  b = &ctx->blocks [n];
+  b->size = 0;
+  b->color = color;
+  for (k = 0; k < 8; k++) {
+    b->exit_x [k] = x;
+    b->exit_y [k] = y;
+  }
+
+  if (ctx->blocks_valid) {
+    /* nothing is resolved yet: */
+    memset (&ctx->transitions [n * 8], 0, 
+	    8 * sizeof (struct piet_transition));
+  }
+
+  if (ctx->svg && n < ctx->svg->max_seen) {
+    /* a new block, paint it again when visited: */
+    ctx->svg->seen [n] = 0;
+  }
+
+  return n;
+}
+
+
+static void
+free_block (struct piet_context *ctx, int n)
+{
+  ctx->blocks [n].size = 0;
+  ctx->free_blocks [ctx->num_free_blocks++] = n;
+  memset (&ctx->transitions [n * 8], 0, 8 * sizeof (struct piet_transition));
+}
+
 
-  } else if (p_dir_pointer == 'r' && x >= *n_x) {	/* right */
-    if (x > *n_x 
-	|| (p_codel_chooser == 'l' && y < *n_y)
-	|| (p_codel_chooser == 'r' && y > *n_y)) {	  
-      found = 1;
+/*
+ * add codel x,y to the block:
+ */
+static void
+block_add (struct piet_block *b, int x, int y)
+{
+  int k;
+
+  b->size++;
+  for (k = 0; k < 8; k++) {
+    if (exit_better (idx_dp [k / 2], idx_cc [k % 2], x, y,
+		     b->exit_x [k], b->exit_y [k])) {
+      b->exit_x [k] = x;
+      b->exit_y [k] = y;
     }
+  }
+}
+
 
-  } else if (p_dir_pointer == 'u' && y <= *n_y) {	/* up */
-    if (y < *n_y 
-	|| (p_codel_chooser == 'l' && x < *n_x)
-	|| (p_codel_chooser == 'r' && x > *n_x)) {	  
-      found = 1;
+/*
+ * move the codels labeled from, that are connected to cell c and have
+ * its color, into block to.
+ *
+ * the fill uses a explicit stack instead of recursion, so large
+ * blocks cannot blow up the c-stack.
+ */
+static void
+fill_block (struct piet_context *ctx, int c, int from, int to)
+{
+  struct piet_block *b = &ctx->blocks [to];
+  int w = ctx->width, h = ctx->height, top = 0;
+  int color = cell_at (ctx, c % w, c / w);
+
+  ctx->block_map [c] = to;
+  ctx->fill_stack [top++] = c;
+
+  while (top > 0) {
+    int x, y;
+
+    c = ctx->fill_stack [--top];
+    x = c % w;
+    y = c / w;
+    block_add (b, x, y);
+
+    if (top + 4 > ctx->fill_stack_size) {
+      ctx->fill_stack_size *= 2;
+      ctx->fill_stack = (int *) 
+	realloc (ctx->fill_stack, ctx->fill_stack_size * sizeof (int));
+      if (! ctx->fill_stack) {
+	fprintf (stderr, "out of memory: cannot label %d * %d cells\n",
+		 ctx->height, ctx->width);
+	exit (-99);
+      }
     }
 
-  } else if (p_dir_pointer == 'd' && y >= *n_y) {	/* down */
-    if (y > *n_y 
-	|| (p_codel_chooser == 'l' && x > *n_x)
-	|| (p_codel_chooser == 'r' && x < *n_x)) {	  
-      found = 1;
+    /* push the neighbour cells of the same color: */
+    if (x + 1 < w && ctx->block_map [c + 1] == from 
+	&& cell_at (ctx, x + 1, y) == color) {
+      ctx->block_map [c + 1] = to;
+      ctx->fill_stack [top++] = c + 1;
     }
-    
-  } 
+    if (y + 1 < h && ctx->block_map [c + w] == from 
+	&& cell_at (ctx, x, y + 1) == color) {
+      ctx->block_map [c + w] = to;
+      ctx->fill_stack [top++] = c + w;
+    }
+    if (x > 0 && ctx->block_map [c - 1] == from 
+	&& cell_at (ctx, x - 1, y) == color) {
+      ctx->block_map [c - 1] = to;
+      ctx->fill_stack [top++] = c - 1;
+    }
+    if (y > 0 && ctx->block_map [c - w] == from 
+	&& cell_at (ctx, x, y - 1) == color) {
+      ctx->block_map [c - w] = to;
+      ctx->fill_stack [top++] = c - w;
+    }
+  }
+}
 
-  if (found) {
-    dprintf ("deb: new best: dp=%c, cc=%c:  going from %d,%d -> %d,%d\n",
-	      p_dir_pointer, p_codel_chooser, *n_x, *n_y, x, y);
-    *n_x = x;
-    *n_y = y;
-  } 
 
-  /* set other color dot: */
-  set_cell (x, y, c_mark);
+/*
+ * label all connected color blocks of the picture.
+ */
+void
+piet_ctx_label_blocks (struct piet_context *ctx)
+{
+  int i, n = ctx->width * ctx->height;
+
+  free (ctx->block_map);
+  free (ctx->transitions);
+  ctx->block_map = 0;
+  ctx->transitions = 0;
+  ctx->num_blocks = 0;
+  ctx->num_free_blocks = 0;
+  ctx->num_resolved = 0;
+  ctx->blocks_valid = 0;
+  ctx->break_blocks_valid = 0;
+
+  if (n <= 0) {
+    return;
+  }
+
+  ctx->block_map = (int *) malloc (n * sizeof (int));
+  if (! ctx->fill_stack) {
+    ctx->fill_stack_size = 1024;
+    ctx->fill_stack = (int *) malloc (ctx->fill_stack_size * sizeof (int));
+  }
+  if (! ctx->block_map || ! ctx->fill_stack) {
+    fprintf (stderr, "out of memory: cannot label %d * %d cells\n",
+	     ctx->height, ctx->width);
+    exit (-99);
+  }
 
-  /* increment number of cells in this block found: */
-  *num_cells = *num_cells + 1;
+  for (i = 0; i < n; i++) {
+    ctx->block_map [i] = -1;
+  }
 
-  /* recurse over neighbour cells: */
-  check_connected_cell (x + 1, y + 0, c_idx, c_mark, n_x, n_y, num_cells);
-  check_connected_cell (x + 0, y + 1, c_idx, c_mark, n_x, n_y, num_cells);
-  check_connected_cell (x - 1, y + 0, c_idx, c_mark, n_x, n_y, num_cells);
-  check_connected_cell (x + 0, y - 1, c_idx, c_mark, n_x, n_y, num_cells);
+  for (i = 0; i < n; i++) {
+    int x = i % ctx->width, y = i / ctx->width;
 
-  return 0;
+    if (ctx->block_map [i] < 0) {
+      fill_block (ctx, i, -1, alloc_block (ctx, cell_at (ctx, x, y), x, y));
+    }
+  }
+
+  /* nothing is resolved yet: */
+  ctx->transitions = (struct piet_transition *)
+    calloc (ctx->max_blocks * 8, sizeof (struct piet_transition));
+  if (! ctx->transitions) {
+    fprintf (stderr, "out of memory: cannot allocate %d transitions\n",
+	     ctx->max_blocks * 8);
+    exit (-99);
+  }
+
+  ctx->blocks_valid = 1;
+
+  dprintf ("deb: labeled %d color blocks\n", ctx->num_blocks);
 }
 
 
-int 
-reset_check_connected_cell (int x, int y, int c_idx, int c_mark)
+/*
+ * codel x,y changed its color (and the blocks are labeled): split the
+ * block it left into the parts still connected and join the blocks of
+ * the new color around it. only these blocks are relabeled and lose
+ * their transitions; of the other blocks only the resolved transitions
+ * that looked at the codel are forgotten.
+ */
+static void
+piet_update_blocks (struct piet_context *ctx, int x, int y)
 {
-  int c;
+  static const int dx [4] = { 1, 0, -1, 0 }, dy [4] = { 0, 1, 0, -1 };
+  int w = ctx->width, h = ctx->height, c = y * w + x;
+  int old = ctx->block_map [c], color = cell_at (ctx, x, y);
+  int joined [4], seeds [4], num_joined = 0, into = -1, i, k;
 
-  c = get_cell (x, y);
+  /* keep the codel out of the fills: */
+  ctx->block_map [c] = -2;
 
-  if (c < 0 || c != c_mark || c == c_idx) {
-    /* invalid cell reached: */
-    return -1;
+  for (k = 0; k < 4; k++) {
+    int nx = x + dx [k], ny = y + dy [k];
+
+    if (nx >= 0 && nx < w && ny >= 0 && ny < h 
+	&& ctx->block_map [ny * w + nx] == old) {
+      i = alloc_block (ctx, ctx->blocks [old].color, nx, ny);
+      fill_block (ctx, ny * w + nx, old, i);
+    }
   }
-  
-  /* set old color dot: */
-  set_cell (x, y, c_idx);
+  free_block (ctx, old);
 
-  /* recurse over neighbour cells: */
-  reset_check_connected_cell (x + 1, y + 0, c_idx, c_mark);
-  reset_check_connected_cell (x + 0, y + 1, c_idx, c_mark);
-  reset_check_connected_cell (x - 1, y + 0, c_idx, c_mark);
-  reset_check_connected_cell (x + 0, y - 1, c_idx, c_mark);
+  for (k = 0; k < 4; k++) {
+    int nx = x + dx [k], ny = y + dy [k], b;
 
-  return 0;
+    if (nx < 0 || nx >= w || ny < 0 || ny >= h 
+	|| cell_at (ctx, nx, ny) != color) {
+      continue;
+    }
+    b = ctx->block_map [ny * w + nx];
+    for (i = 0; i < num_joined && joined [i] != b; i++) {
+      ;
+    }
+    if (i == num_joined) {
+      joined [num_joined] = b;
+      seeds [num_joined++] = ny * w + nx;
+      if (into < 0 || ctx->blocks [b].size > ctx->blocks [into].size) {
+	into = b;
+      }
+    }
+  }
+
+  if (into < 0) {
+    into = alloc_block (ctx, color, x, y);
+  } else {
+    /* the largest block takes in the others: */
+    for (i = 0; i < num_joined; i++) {
+      if (joined [i] != into) {
+	fill_block (ctx, seeds [i], joined [i], into);
+	free_block (ctx, joined [i]);
+      }
+    }
+    memset (&ctx->transitions [into * 8], 0, 
+	    8 * sizeof (struct piet_transition));
+  }
+  ctx->block_map [c] = into;
+  block_add (&ctx->blocks [into], x, y);
+
+  /* drop the stale and the forgotten ones from the resolved list: */
+  for (i = k = 0; i < ctx->num_resolved; i++) {
+    struct piet_transition *t = &ctx->transitions [ctx->resolved [i]];
+
+    if (x >= t->look_x0 && x <= t->look_x1
+	&& y >= t->look_y0 && y <= t->look_y1) {
+      t->state = t_unknown;
+    }
+    if (t->state != t_unknown) {
+      ctx->resolved [k++] = ctx->resolved [i];
+    }
+  }
+  ctx->num_resolved = k;
 }
 
 
-int
-piet_walk_border_do (int *n_x, int *n_y, int *num_cells)
+/*
+ * the transition table entry for leaving the block at x,y with dp and
+ * cc, resolved on first use:
+ */
+static struct piet_transition *
+piet_transition (struct piet_context *ctx, int x, int y, int dp, int cc)
 {
-  int rc, c_idx;
+  int n = ctx->block_map [y * ctx->width + x] * 8 + exit_idx (dp, cc);
+  struct piet_transition *t = &ctx->transitions [n];
+
+  if (t->state == t_unknown) {
+    piet_resolve_step (ctx, x, y, dp, cc, t);
+
+    /* remember it, so an edit finds it (see piet_update_blocks): */
+    if (ctx->num_resolved >= ctx->max_resolved) {
+      ctx->max_resolved = ctx->max_resolved > 0 ? 2 * ctx->max_resolved : 64;
+      ctx->resolved = (int *) 
+	realloc (ctx->resolved, ctx->max_resolved * sizeof (int));
+      if (! ctx->resolved) {
+	fprintf (stderr, "out of memory: cannot allocate %d transitions\n",
+		 ctx->max_resolved);
+	exit (-99);
+      }
+    }
+    ctx->resolved [ctx->num_resolved++] = n;
+  }
+  return t;
+}
 
-  /* store current color index: */
-  c_idx = get_cell (p_xpos, p_ypos);
-  
-  /* count connected cells found: */
-  *num_cells = 0;
 
-  /* we fill the area with another color and check the border: */
-  rc = check_connected_cell (p_xpos, p_ypos, c_idx, c_mark_index,
-			     n_x, n_y, num_cells);
-  
-  dprintf ("DEB: after check: rc is %d (num_cells = %d)\n", rc, *num_cells);
+/*
+ * furthest codel of the block at x,y in dp / cc direction:
+ */
+static void
+block_exit (struct piet_context *ctx, int x, int y, int dp, int cc, 
+	    int *n_x, int *n_y, int *num_cells)
+{
+  struct piet_block *b;
+  int c_idx, k;
 
-  if (rc >= 0) {
-    /* reset: */
-    reset_check_connected_cell (p_xpos, p_ypos, c_idx, c_mark_index);
+  if (! ctx->blocks_valid) {
+    piet_ctx_label_blocks (ctx);
   }
 
-  if (debug) {
-    dump_cells ();
+  if ((c_idx = cell_idx (ctx, x, y)) < 0) {
+    fprintf (stderr, "internal error... - exiting\n");
+    exit (-99);
   }
-  
-  return rc;
+
+  b = &ctx->blocks [ctx->block_map [c_idx]];
+  k = exit_idx (dp, cc);
+
+  *n_x = b->exit_x [k];
+  *n_y = b->exit_y [k];
+  *num_cells = b->size;
 }
 
 
@@ -1612,48 +2886,43 @@ piet_walk_border_do (int *n_x, int *n_y, int *num_cells)
  * return the coordinates of the new codel and the new directions.
  */
 int
-piet_walk_border (int *n_x, int *n_y, int *num_cells)
+piet_ctx_walk_border (struct piet_context *ctx, 
+		      int *n_x, int *n_y, int *num_cells)
 {
-  int rc;
-
   dprintf ("info: walk_border 1: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
-	    *n_x, *n_y, p_dir_pointer, p_codel_chooser);
+	    *n_x, *n_y, ctx->p_dir_pointer, ctx->p_codel_chooser);
 
-  rc = piet_walk_border_do (n_x, n_y, num_cells);
-
-  if (rc < 0) {
-    fprintf (stderr, "internal error... - exiting\n");
-    exit (-99);
-  }
+  block_exit (ctx, ctx->p_xpos, ctx->p_ypos, 
+	      ctx->p_dir_pointer, ctx->p_codel_chooser, n_x, n_y, num_cells);
 
   dprintf ("info: walk_border 2: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
-	    *n_x, *n_y, p_dir_pointer, p_codel_chooser);
+	    *n_x, *n_y, ctx->p_dir_pointer, ctx->p_codel_chooser);
 
   return 0; 
 }
 
 int
-piet_walk_white (int *n_x, int *n_y)
+piet_walk_white (struct piet_context *ctx, int *n_x, int *n_y)
 {
   int c_col, a_x = *n_x, a_y = *n_y;
 
   dprintf ("info: walk_white 1: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
-	   *n_x, *n_y, p_dir_pointer, p_codel_chooser);
+	   *n_x, *n_y, ctx->p_dir_pointer, ctx->p_codel_chooser);
   
-  c_col = get_cell (p_xpos, p_ypos);
+  c_col = piet_ctx_get_cell (ctx, ctx->p_xpos, ctx->p_ypos);
 
   while (c_col == c_white) {
     dprintf ("deb: white cell passed to %d, %d\n", a_x, a_y);
-    a_x += dp_dx (p_dir_pointer);
-    a_y += dp_dy (p_dir_pointer);
-    c_col = get_cell (a_x, a_y);
+    a_x += dp_dx (ctx->p_dir_pointer);
+    a_y += dp_dy (ctx->p_dir_pointer);
+    c_col = cell_at (ctx, a_x, a_y);
   }
 
   *n_x = a_x;
   *n_y = a_y;
 
   dprintf ("info: walk_border 2: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
-	    *n_x, *n_y, p_dir_pointer, p_codel_chooser);
+	    *n_x, *n_y, ctx->p_dir_pointer, ctx->p_codel_chooser);
 
   return 0; 
 }
@@ -1661,21 +2930,265 @@ piet_walk_white (int *n_x, int *n_y)
 
 
 void
-piet_init ()
+piet_ctx_init (struct piet_context *ctx)
 {
-  p_dir_pointer = p_right;
-  p_codel_chooser = p_left;
-  p_xpos = p_ypos = 0;
+  ctx->p_dir_pointer = p_right;
+  ctx->p_codel_chooser = p_left;
+  ctx->p_xpos = ctx->p_ypos = 0;
+
+  /* the picture is complete now - find the color blocks: */
+  if (! ctx->blocks_valid) {
+    piet_ctx_label_blocks (ctx);
+  }
 
   /* init anyway: */
-  exec_step = 0;
+  ctx->exec_step = 0;
+  ctx->exit_reason = piet_exit_none;
+
+  /* reset stack, but keep the space: */
+  ctx->num_stack = 0;
+  ctx->peak_stack = 0;
+  ctx->peak_stack_step = 0;
+
+  watches_reset (ctx);
+}
+
+
+void
+piet_ctx_get_state (struct piet_context *ctx, struct piet_state *state)
+{
+  state->exec_step = ctx->exec_step;
+  state->x = ctx->p_xpos;
+  state->y = ctx->p_ypos;
+  state->dp = ctx->p_dir_pointer;
+  state->cc = ctx->p_codel_chooser;
+  state->num_stack = ctx->num_stack;
+  state->stack = ctx->stack;
+}
+
+
+int
+piet_ctx_set_state (struct piet_context *ctx, const struct piet_state *state)
+{
+  if (alloc_stack_space (ctx, state->num_stack) < 0) {
+    return -1;
+  }
+  if (state->num_stack > 0 && state->stack != ctx->stack) {
+    memmove (ctx->stack, state->stack, state->num_stack * sizeof (long));
+  }
+  ctx->num_stack = state->num_stack;
+
+  ctx->exec_step = state->exec_step;
+  ctx->p_xpos = state->x;
+  ctx->p_ypos = state->y;
+  ctx->p_dir_pointer = state->dp;
+  ctx->p_codel_chooser = state->cc;
+  /* a run that ended goes on again: */
+  ctx->exit_reason = piet_exit_none;
+  watches_reset (ctx);
+
+  return 0;
+}
+
+
+/*
+ * breakpoints and watchpoints:
+ *
+ * the codels with a breakpoint are kept as they are, the blocks
+ * entered are looked up in a bitmap over the block numbers, built
+ * again after the blocks changed.
+ */
+struct piet_watch {
+  int kind;			/* piet_watch_* */
+  long value;
+  int was;			/* true after the step before */
+};
+
+
+static int
+watch_true (struct piet_context *ctx, struct piet_watch *w, int command)
+{
+  switch (w->kind) {
+  case piet_watch_depth:
+    return ctx->num_stack > w->value;
+  case piet_watch_top:
+    return ctx->num_stack > 0 && ctx->stack [ctx->num_stack - 1] == w->value;
+  case piet_watch_command:
+    return command == w->value;
+  }
+  return 0;
+}
+
+
+/* what the watches were before the next step: */
+static void
+watches_reset (struct piet_context *ctx)
+{
+  int i;
+
+  for (i = 0; i < ctx->num_watches; i++) {
+    ctx->watches [i].was = watch_true (ctx, &ctx->watches [i], -1);
+  }
+}
+
+
+static void
+build_break_blocks (struct piet_context *ctx)
+{
+  int i, size = (ctx->max_blocks + 7) / 8;
+
+  if (ctx->break_blocks_size < ctx->max_blocks) {
+    ctx->break_blocks = (unsigned char *) realloc (ctx->break_blocks, size);
+    if (! ctx->break_blocks) {
+      fprintf (stderr, "out of memory: cannot allocate %d breakpoints\n",
+	       ctx->max_blocks);
+      exit (-99);
+    }
+    ctx->break_blocks_size = size * 8;
+  }
+  memset (ctx->break_blocks, 0, size);
+
+  for (i = 0; i < ctx->num_break_codels; i++) {
+    int x = ctx->break_codels [2 * i], y = ctx->break_codels [2 * i + 1];
+    int b;
+
+    if (x < ctx->width && y < ctx->height) {
+      b = ctx->block_map [y * ctx->width + x];
+      ctx->break_blocks [b >> 3] |= 1 << (b & 7);
+    }
+  }
+  ctx->break_blocks_valid = 1;
+}
+
+
+/*
+ * after a step that made command (-1: none): return piet_step_break
+ * if it hit a breakpoint or a watchpoint.
+ */
+static int
+piet_check_break (struct piet_context *ctx, int command)
+{
+  int i, hit = 0;
+
+  if (ctx->num_break_codels > 0 && ctx->blocks_valid) {
+    int b;
+
+    if (! ctx->break_blocks_valid || ctx->break_blocks_size < ctx->max_blocks) {
+      build_break_blocks (ctx);
+    }
+    b = ctx->block_map [ctx->p_ypos * ctx->width + ctx->p_xpos];
+    if (ctx->break_blocks [b >> 3] & (1 << (b & 7))) {
+      ctx->break_watch = -1;
+      hit = 1;
+    }
+  }
+
+  /* every watch looks, to know what it was for the next step: */
+  for (i = 0; i < ctx->num_watches; i++) {
+    struct piet_watch *w = &ctx->watches [i];
+    int now = watch_true (ctx, w, command);
+
+    if (now && ! w->was && ! hit) {
+      ctx->break_watch = i;
+      hit = 1;
+    }
+    /* a command stops every time it is made: */
+    w->was = w->kind == piet_watch_command ? 0 : now;
+  }
+
+  if (hit) {
+    tprintf ("trace: break after step %u (%s %d)\n", ctx->exec_step - 1,
+	     ctx->break_watch < 0 ? "breakpoint" : "watch", ctx->break_watch);
+    return piet_step_break;
+  }
+  return 0;
+}
+
+
+void
+piet_ctx_set_breakpoint (struct piet_context *ctx, int x, int y, int on)
+{
+  int i;
+
+  if (x < 0 || y < 0) {
+    return;
+  }
+  for (i = 0; i < ctx->num_break_codels; i++) {
+    if (ctx->break_codels [2 * i] == x && ctx->break_codels [2 * i + 1] == y) {
+      break;
+    }
+  }
+
+  if (on && i == ctx->num_break_codels) {
+    if (ctx->num_break_codels >= ctx->max_break_codels) {
+      int max = ctx->max_break_codels > 0 ? 2 * ctx->max_break_codels : 16;
+
+      ctx->break_codels = (int *) realloc (ctx->break_codels, 
+					   2 * max * sizeof (int));
+      if (! ctx->break_codels) {
+	fprintf (stderr, "out of memory: cannot allocate %d breakpoints\n",
+		 max);
+	exit (-99);
+      }
+      ctx->max_break_codels = max;
+    }
+    ctx->break_codels [2 * i] = x;
+    ctx->break_codels [2 * i + 1] = y;
+    ctx->num_break_codels++;
+  } else if (! on && i < ctx->num_break_codels) {
+    /* the last one takes its place: */
+    ctx->num_break_codels--;
+    ctx->break_codels [2 * i] = ctx->break_codels [2 * ctx->num_break_codels];
+    ctx->break_codels [2 * i + 1] 
+      = ctx->break_codels [2 * ctx->num_break_codels + 1];
+  }
+  ctx->break_blocks_valid = 0;
+}
+
+
+void
+piet_ctx_clear_breakpoints (struct piet_context *ctx)
+{
+  ctx->num_break_codels = 0;
+  ctx->break_blocks_valid = 0;
+}
+
+
+int
+piet_ctx_add_watch (struct piet_context *ctx, int kind, long value)
+{
+  struct piet_watch *w;
+
+  if (kind < piet_watch_depth || kind > piet_watch_command) {
+    fprintf (stderr, "error: unknown watchpoint %d\n", kind);
+    return -1;
+  }
+  if (ctx->num_watches >= ctx->max_watches) {
+    int max = ctx->max_watches > 0 ? 2 * ctx->max_watches : 8;
+
+    w = (struct piet_watch *) realloc (ctx->watches, 
+				       max * sizeof (struct piet_watch));
+    if (! w) {
+      fprintf (stderr, "out of memory: cannot allocate %d watchpoints\n",
+	       max);
+      return -1;
+    }
+    ctx->watches = w;
+    ctx->max_watches = max;
+  }
 
-  /* reset stack */
-  if( stack )
-      free( stack );
-  stack = 0;
-  num_stack = 0;
-  max_stack = 0;
+  w = &ctx->watches [ctx->num_watches];
+  w->kind = kind;
+  w->value = value;
+  w->was = watch_true (ctx, w, -1);
+  return ctx->num_watches++;
+}
+
+
+void
+piet_ctx_clear_watches (struct piet_context *ctx)
+{
+  ctx->num_watches = 0;
 }
 
 
@@ -1697,29 +3210,44 @@ piet_init ()
  */
 
 int
-piet_action (int c_col, int a_col, int num_cells, char *msg)
+piet_ctx_action (struct piet_context *ctx, 
+		 int c_col, int a_col, int num_cells, char *msg)
 {
-  int notify_value;
-  int val_set = 0;
-  char notify_msg[BUF_LEN];
   int hue_change;
   int light_change; 
 
-  memset(notify_msg,'\0', BUF_LEN);
-
-  notify_stack_before( stack, num_stack );
-  
   hue_change = ((get_hue (a_col) - get_hue (c_col)) + n_hue) % n_hue;
   light_change = ((get_light (a_col) - get_light (c_col)) + n_light) % n_light;
 
-  strcpy (msg, "unknown");
-
   t2printf ("action: c_col=%s, a_col=%s -> hue_change %d - %d = %d, "
 	    "light_change %d - %d = %d\n", 
 	    cell2str (c_col), cell2str (a_col),
 	    get_hue (a_col), get_hue (c_col), hue_change,
 	    get_light (a_col), get_light (c_col), light_change);
-  
+
+  return piet_ctx_command (ctx, hue_change, light_change, num_cells, msg);
+}
+
+
+/*
+ * execute the command given by the hue and lightness change
+ * (see piet_action).
+ */
+int
+piet_ctx_command (struct piet_context *ctx, 
+		  int hue_change, int light_change, int num_cells, char *msg)
+{
+  int notify_value;
+  int val_set = 0;
+  int rc = 0;
+  char notify_msg[BUF_LEN];
+
+  memset(notify_msg,'\0', BUF_LEN);
+
+  notify_stack_before( ctx, ctx->stack, ctx->num_stack );
+
+  strcpy (msg, "unknown");
+
   switch (hue_change) {
 
   case 0:
@@ -1737,7 +3265,7 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 pushed on to the stack - this push operation must be explicitly
 	 carried out.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "pu");
       } else {
 	sprintf (msg, "push(%d)", num_cells);
@@ -1745,27 +3273,31 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
       notify_value = num_cells;
       val_set = 1;
       tprintf ("action: push, value %d\n", num_cells);
-      alloc_stack_space (num_stack + 1);
-      stack [num_stack++] = num_cells;
-      tdump_stack ();
+      if (alloc_stack_space (ctx, ctx->num_stack + 1) < 0) {
+	strncpy(notify_msg, "push failed: stack limit exceeded\n", BUF_LEN);
+	rc = -1;
+	break;
+      }
+      ctx->stack [ctx->num_stack++] = num_cells;
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
          pop: Pops the top value off the stack and discards it.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "po");
       } else {
 	strcpy (msg, "pop");
       }
       tprintf ("action: pop\n");
-      if (num_stack > 0) {
-	num_stack--;
+      if (ctx->num_stack > 0) {
+	ctx->num_stack--;
       } else {
 		  strncpy(notify_msg, "pop failed: stack underflow\n", BUF_LEN);
 	tprintf ("info: pop failed: stack underflow\n");
       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
 
     break;
@@ -1777,20 +3309,21 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
          add: Pops the top two values off the stack, adds them, and pushes
 	 the result back on the stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "+");
       } else {
 	strcpy (msg, "add");
       }
       tprintf ("action: add\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
         strncpy(notify_msg, "add failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: add failed: stack underflow \n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] + stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] + ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 1) {
       /*
@@ -1798,40 +3331,42 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 value from the second top value, and pushes the result back on the
 	 stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "-");
       } else {
 	strcpy (msg, "sub");
       }
       tprintf ("action: sub\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
         strncpy(notify_msg, "sub failed: stack underflow\n", BUF_LEN);
 	tprintf ("info: sub failed: stack underflow \n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] - stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] - ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
          multiply: Pops the top two values off the stack, multiplies them,
 	 and pushes the result back on the stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "*");
       } else {
 	strcpy (msg, "mul");
       }
       tprintf ("action: multiply\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
           strncpy(notify_msg, "multiply failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: multiply failed: stack underflow \n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] * stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] * ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
     break;
 
@@ -1843,26 +3378,27 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 integer division of the second top value by the top value, and
 	 pushes the result back on the stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "/");
       } else {
 	strcpy (msg, "div");
       }
       tprintf ("action: divide\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
           strncpy(notify_msg, "divide failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: divide failed: stack underflow \n");
-      } else if (stack [num_stack - 1] == 0) {
+      } else if (ctx->stack [ctx->num_stack - 1] == 0) {
  	/* try to put a undefined, but visible value on stack: */
-	stack [num_stack - 2] = 99999999;
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 99999999;
+	ctx->num_stack--;
         strncpy(notify_msg, "divide failed: division by zero\n", BUF_LEN);
 	tprintf ("info: divide failed: division by zero\n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] / stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] / ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 1) {
       /*
@@ -1870,39 +3406,46 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 top value modulo the top value, and pushes the result back on the
 	 stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "%");
       } else {
 	strcpy (msg, "mod");
       }
       tprintf ("action: mod\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
           strncpy(notify_msg, "mod failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: mod failed: stack underflow \n");
+      } else if (ctx->stack [ctx->num_stack - 1] == 0) {
+ 	/* like divide: a undefined, but visible value on stack: */
+	ctx->stack [ctx->num_stack - 2] = 99999999;
+	ctx->num_stack--;
+        strncpy(notify_msg, "mod failed: division by zero\n", BUF_LEN);
+	tprintf ("info: mod failed: division by zero\n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] % stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] % ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
          not: Replaces the top value of the stack with 0 if it is non-zero,
 	 and 1 if it is zero.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "!");
       } else {
 	strcpy (msg, "not");
       }
       tprintf ("action: not\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "not failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: not failed: stack underflow \n");
       } else {
-	stack [num_stack - 1] = ! stack [num_stack - 1];
+	ctx->stack [ctx->num_stack - 1] = ! ctx->stack [ctx->num_stack - 1];
       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
 
     break;
@@ -1916,20 +3459,21 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 the stack if the second top value is greater than the top value,
 	 and pushes 0 if it is not greater.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, ">");
       } else {
 	strcpy (msg, "gt");
       }
       tprintf ("action: greater\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
           strncpy(notify_msg, "greater failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: greater failed: stack underflow \n");
       } else {
-	stack [num_stack - 2] = stack [num_stack - 2] > stack [num_stack - 1];
-	num_stack--;
+	ctx->stack [ctx->num_stack - 2] = 
+	  ctx->stack [ctx->num_stack - 2] > ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 1) {
       /*
@@ -1940,26 +3484,26 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 
       strcpy (msg, "dp");
       tprintf ("action: pointer\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "info: pointer failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: pointer failed: stack underflow \n");
       } else {
-	val = stack [num_stack - 1];
+	val = ctx->stack [ctx->num_stack - 1];
 
 	for (i = 0; val > 0 && i < (val % 4); i++) {
-	  p_dir_pointer = turn_dp (p_dir_pointer);
+	  ctx->p_dir_pointer = turn_dp (ctx->p_dir_pointer);
 	}
 	for (i = 0; val < 0 && i > ((-1 * val) % 4); i++) {
-	  p_dir_pointer = turn_dp_inv (p_dir_pointer);
+	  ctx->p_dir_pointer = turn_dp_inv (ctx->p_dir_pointer);
 	}
-	num_stack--;
+	ctx->num_stack--;
 
-	if (! gd_trace_simple) {
+	if (! ctx->gd_trace_simple) {
 	  /* add param to msg: */
 	  sprintf (msg, "dp(%d)", val);
 	}
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
@@ -1970,24 +3514,24 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 
       strcpy (msg, "cc");
       tprintf ("action: switch\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "switch failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: switch failed: stack underflow \n");
       } else {
-	val = stack [num_stack - 1];
+	val = ctx->stack [ctx->num_stack - 1];
 
 	for (i = 0; i < val; i++) {
-	  p_codel_chooser = toggle_cc (p_codel_chooser);
+	  ctx->p_codel_chooser = toggle_cc (ctx->p_codel_chooser);
 	}
-	num_stack--;
-	tdump_stack ();
+	ctx->num_stack--;
+	tdump_stack (ctx);
 	
-	if (! gd_trace_simple) {
+	if (! ctx->gd_trace_simple) {
 	  /* add param to msg: */
 	  sprintf (msg, "cc(%d)", val);
 	}
       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
 
     break;
@@ -1999,21 +3543,23 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
          duplicate: Pushes a copy of the top value on the stack on to the
 	 stack.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "du");
       } else {
 	strcpy (msg, "dup");
       }
       tprintf ("action: duplicate\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "duplicate failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: duplicate failed: stack underflow \n");
+      } else if (alloc_stack_space (ctx, ctx->num_stack + 1) < 0) {
+	strncpy(notify_msg, "duplicate failed: stack limit exceeded\n", BUF_LEN);
+	rc = -1;
       } else {
-	alloc_stack_space (num_stack + 1);
-	stack [num_stack] = stack [num_stack - 1];
-	num_stack++;
+	ctx->stack [ctx->num_stack] = ctx->stack [ctx->num_stack - 1];
+	ctx->num_stack++;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 1) {
       /*
@@ -2027,48 +3573,47 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
        */
       int roll, depth;
 
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "ro");
       } else {
 	strcpy (msg, "roll");
       }
       tprintf ("action: roll\n");
-      if (num_stack < 2) {
+      if (ctx->num_stack < 2) {
           strncpy(notify_msg, "roll failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: roll failed: stack underflow \n");
       } else {
-	roll = stack [num_stack - 1];
-	depth = stack [num_stack - 2];
-	num_stack -= 2;
+	roll = ctx->stack [ctx->num_stack - 1];
+	depth = ctx->stack [ctx->num_stack - 2];
+	ctx->num_stack -= 2;
 
 	if (depth < 0) {
             strncpy(notify_msg, "roll failed: negative depth \n", BUF_LEN);
 	  tprintf ("info: roll failed: negative depth \n");
-	} else if (num_stack < depth) {
+	} else if (ctx->num_stack < depth) {
             strncpy(notify_msg, "roll failed: stack underflow \n", BUF_LEN);
 	  tprintf ("info: roll failed: stack underflow \n");
-	} else {
-	  int i;
-	  /* roll is positive: */
-	  for (i = 0; i < roll && roll > 0; i++) {
-	    int j, val = stack [num_stack - 1];
-	    for (j = 0; j < depth - 1; j++) {
-	      stack [num_stack - j - 1] = stack [num_stack - j - 2];
-	    }
-	    stack [num_stack - depth] = val;
+	} else if (depth > 1) {
+	  /*
+	   * n rolls are one rotation of the top depth entries by
+	   * n mod depth places, so the count does not matter:
+	   */
+	  long *base = ctx->stack + ctx->num_stack - depth;
+	  int n = roll % depth;
+
+	  if (n < 0) {
+	    n += depth;
 	  }
-	  /* roll is negative: */
-	  for (i = 0; i > roll && roll < 0; i--) {
-	    int j, val = stack [num_stack - depth];
-	    for (j = 0; j < depth - 1; j++) {
-	      stack [num_stack - depth + j ] = 
-		stack [num_stack - depth + j + 1];
-	    }
-	    stack [num_stack - 1] = val;
+	  if (n > 0) {
+	    /* rotate up by n: */
+	    notify_stack_roll (ctx, depth, n);
+	    reverse_stack (base, depth);
+	    reverse_stack (base, n);
+	    reverse_stack (base + n, depth - n);
 	  }
 	}
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
@@ -2078,27 +3623,32 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
        */
       int c;
 
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "iN");
       } else {
 	strcpy (msg, "inN");
       }
       tprintf ("action: in(number)\n");
-      alloc_stack_space (num_stack + 1);
+      if (alloc_stack_space (ctx, ctx->num_stack + 1) < 0) {
+	strncpy(notify_msg, "in(number) failed: stack limit exceeded\n", 
+		BUF_LEN);
+	rc = -1;
+	break;
+      }
 
 //       if (! quiet) {
 	/* show a prompt: */
 // 	printf ("? "); fflush (stdout);
 //       }
-      c = read_int();
+      c = read_int(ctx);
 //       if (1 != scanf (stdin, "%d", &c)) {
 //           strncpy(notify_msg, "cannot read int from stdin", BUF_LEN);
 // 	tprintf ("info: cannot read int from stdin; reason: %s\n",
 // 		 strerror (errno));
 //       } else {
-	stack [num_stack++] = c;
+	ctx->stack [ctx->num_stack++] = c;
 //       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
     
     break;
@@ -2114,26 +3664,30 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
        */
       int c;
 
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "iC");
       } else {
 	strcpy (msg, "inC");
       }
       tprintf ("action: in(char)\n");
-      alloc_stack_space (num_stack + 1);
+      if (alloc_stack_space (ctx, ctx->num_stack + 1) < 0) {
+	strncpy(notify_msg, "in(char) failed: stack limit exceeded\n", BUF_LEN);
+	rc = -1;
+	break;
+      }
 
-      if (! quiet) {
+      if (! ctx->quiet) {
 	/* show a prompt: */
 // 	printf ("? "); fflush (stdout);
       }
-      if ((c = /*getchar*/ read_char()) < 0) {
+      if ((c = /*getchar*/ read_char(ctx)) < 0) {
           strncpy(notify_msg, "cannot read char from stdin", BUF_LEN);
 	tprintf ("info: cannot read char from stdin; reason: %s\n",
 		 strerror (errno));
       } else {
-	stack [num_stack++] = c % 0xff;
+	ctx->stack [ctx->num_stack++] = c % 0xff;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 1) {
       /*
@@ -2141,24 +3695,26 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 either a number or character, depending on the particular
 	 incarnation of this command.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "oN");
       } else {
 	strcpy (msg, "outN");
       }
       tprintf ("action: out(number)\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "out(number) failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: out(number) failed: stack underflow \n");
       } else {
-	printf ("%ld", stack [num_stack - 1]); fflush (stdout);
-	if (trace || debug) {
+	char num [32];
+	sprintf (num, "%ld", ctx->stack [ctx->num_stack - 1]);
+	write_output (ctx, num, strlen (num));
+	if (ctx->trace || ctx->debug) {
 	  /* increase readability: */
 	  tprintf ("\n");
 	}
-	num_stack--;
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
 
     } else if (light_change == 2) {
       /*
@@ -2166,59 +3722,63 @@ piet_action (int c_col, int a_col, int num_cells, char *msg)
 	 either a number or character, depending on the particular
 	 incarnation of this command.
        */
-      if (gd_trace_simple) {
+      if (ctx->gd_trace_simple) {
 	strcpy (msg, "oC");
       } else {
 	strcpy (msg, "outC");
       }
       tprintf ("action: out(char)\n");
-      if (num_stack < 1) {
+      if (ctx->num_stack < 1) {
           strncpy(notify_msg, "out(char) failed: stack underflow \n", BUF_LEN);
 	tprintf ("info: out(char) failed: stack underflow \n");
       } else {
-	printf ("%c", (int) (stack [num_stack - 1] & 0xff));
-	fflush (stdout);
-	if (trace || debug) {
+	char c = (char) (ctx->stack [ctx->num_stack - 1] & 0xff);
+	write_output (ctx, &c, 1);
+	if (ctx->trace || ctx->debug) {
 	  /* increase readability: */
 	  tprintf ("\n");
 	}
-	num_stack--;
+	ctx->num_stack--;
       }
-      tdump_stack ();
+      tdump_stack (ctx);
     }
 
     break;
   }
-  notify_stack_after( stack, num_stack );
-  notify_action( hue_change, light_change, notify_value, notify_msg );
-  return 0;
+  if (ctx->num_stack > ctx->peak_stack) {
+    ctx->peak_stack = ctx->num_stack;
+    ctx->peak_stack_step = ctx->exec_step;
+  }
+  notify_stack_after( ctx, ctx->stack, ctx->num_stack );
+  notify_action( ctx, hue_change, light_change, notify_value, notify_msg );
+  return rc;
 }
 
 
-int 
-piet_step ()
+/*
+ * find the way out of the block at x,y for the given dp and cc.
+ *
+ * this is the try / retry part of a step; it does not change any
+ * execution state, so the result can be remembered in the transition
+ * table.
+ */
+static void
+piet_resolve_step (struct piet_context *ctx, int x, int y, int dp, int cc, 
+		   struct piet_transition *t)
 {
-  int rc, tries, n_x, n_y, a_x, a_y, pre_dp, pre_cc;
-  int pre_xpos, pre_ypos;
-  int c_col, a_col, num_cells;
-  char msg [128];
+  int tries, n_x, n_y, a_x, a_y;
+  int c_col, a_col, num_cells = 1;
   // a noop from a white codel:
   int white_crossed = 0;
   // flag about white to white crossing:
   int in_white = 0;
 
-  /* hmm - maybe we can simulate other piet dialect this way: */
-  static int p_toggle = 0;
-
-  if (max_exec_step > 0 && exec_step >= max_exec_step) {
-    fprintf (stderr, "error: configured execution steps exceeded (%d steps)\n",
-	     exec_step);
-    return -1;
-  }
-
-  
   /* current cell col_idx: */
-  c_col = get_cell (p_xpos, p_ypos);
+  c_col = piet_ctx_get_cell (ctx, x, y);
+
+  /* the codels looked at, so an edit can tell if the result is stale: */
+  t->look_x0 = t->look_x1 = x;
+  t->look_y0 = t->look_y1 = y;
 
   /*
    * toggle cc first, then alternate with dp, because so say the spec:
@@ -2235,35 +3795,19 @@ piet_step ()
    *    there is no way out and the program terminates.
    * 
    */
-  if (! toggle_bug) {
-    p_toggle = 0;
+  if (! ctx->toggle_bug) {
+    ctx->p_toggle = 0;
   }
 
   white_crossed = (c_col == c_white);
 
-  /* save for trace output: */
-  pre_xpos = p_xpos;
-  pre_ypos = p_ypos;
-  pre_dp = p_dir_pointer;
-  pre_cc = p_codel_chooser;
-
-  if (do_gdtrace) {
-    gd_try_init ();
-  }
-
-  if (c_col == c_black) {
-    /* we are lost in a black hole: */
-    tprintf ("trace: special case: we started at a black cell - exiting...\n");
-    return -1;
-  }
-
   /*
    * now try to find a way to continue:
    */
   for (tries = 0; tries < 8; tries++) {
 
-    n_x = p_xpos;
-    n_y = p_ypos;
+    n_x = x;
+    n_y = y;
 
     if (c_col == c_white) {
 
@@ -2275,22 +3819,32 @@ piet_step ()
       num_cells = 1;
     } else {
       /* find dp/cc edge and codel: */
-      piet_walk_border (&n_x, &n_y, &num_cells);
+      dprintf ("info: walk_border 1: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
+	       n_x, n_y, dp, cc);
+      block_exit (ctx, x, y, dp, cc, &n_x, &n_y, &num_cells);
+      dprintf ("info: walk_border 2: n_x=%d, n_y=%d, n_dp=%c, n_cc=%c\n",
+	       n_x, n_y, dp, cc);
     }
     
     /* find adjacent cell to border and dir: */
-    a_x = n_x + dp_dx (p_dir_pointer);
-    a_y = n_y + dp_dy (p_dir_pointer);
-    a_col = get_cell (a_x, a_y);
+    a_x = n_x + dp_dx (dp);
+    a_y = n_y + dp_dy (dp);
+    a_col = cell_at (ctx, a_x, a_y);
+    t_look (t, a_x, a_y);
 
     dprintf ("deb: try %d: testing cell %d, %d (col_idx %d) "
 	     "with dp='%c', cc='%c'\n",
-	     tries, a_x, a_y, a_col, p_dir_pointer, p_codel_chooser);
+	     tries, a_x, a_y, a_col, dp, cc);
 
-    if (do_gdtrace && ! gd_trace_simple
-	&& exec_step >= gd_trace_start && exec_step <= gd_trace_end) {
-      gd_try_step (exec_step, tries, n_x, n_y, 
-		   p_dir_pointer, p_codel_chooser);
+    if (ctx->do_gdtrace && ! ctx->gd_trace_simple
+	&& ctx->exec_step >= ctx->gd_trace_start 
+	&& ctx->exec_step <= ctx->gd_trace_end) {
+      gd_try_step (ctx, ctx->exec_step, tries, n_x, n_y, dp, cc);
+    }
+    if (ctx->svg && ! ctx->gd_trace_simple
+	&& ctx->exec_step >= ctx->gd_trace_start 
+	&& ctx->exec_step <= ctx->gd_trace_end) {
+      svg_try_step (ctx, ctx->exec_step, tries, n_x, n_y, dp, cc);
     }
 
     /*
@@ -2316,9 +3870,10 @@ piet_step ()
       while (a_col == c_white) {
 	dprintf ("deb: white cell passed to %d, %d (now col_idx %d)\n",
 		 a_x, a_y, a_col);
-	a_x += dp_dx (p_dir_pointer);
-	a_y += dp_dy (p_dir_pointer);
-	a_col = get_cell (a_x, a_y);
+	a_x += dp_dx (dp);
+	a_y += dp_dy (dp);
+	a_col = cell_at (ctx, a_x, a_y);
+	t_look (t, a_x, a_y);
       }
       
       if (a_col >= 0 && a_col != c_black) {
@@ -2332,7 +3887,7 @@ piet_step ()
          * the Perl Piet interpreter sets the white block as the current
          * block. The Tower of Hanoi example relies on this behaviour.
          */
-	if (version_11) {
+	if (ctx->version_11) {
 	  /*
 	   * patch from Yusuke ENDOH <mame@tsg.ne.jp>
 	   *
@@ -2346,44 +3901,49 @@ piet_step ()
 	  white_crossed = 1;
 	  while (a_col < 0 || a_col == c_black) {
 	    a_col = c_white;
-	    a_x -= dp_dx (p_dir_pointer);
-	    a_y -= dp_dy (p_dir_pointer);
+	    a_x -= dp_dx (dp);
+	    a_y -= dp_dy (dp);
 	    tprintf("trace: hitting black block when sliding at %d,%d %c %c\n",
-		    a_x, a_y, p_codel_chooser, p_dir_pointer);
+		    a_x, a_y, cc, dp);
 
-	    p_codel_chooser = toggle_cc(p_codel_chooser);
-	    p_dir_pointer = turn_dp(p_dir_pointer);
+	    cc = toggle_cc(cc);
+	    dp = turn_dp(dp);
 
 	    for (i = 0; i < visited_len; i++) {
 	      if (visited[i * 4 + 0] == a_x &&
 		  visited[i * 4 + 1] == a_y &&
-		  visited[i * 4 + 2] == p_codel_chooser &&
-		  visited[i * 4 + 3] == p_dir_pointer) {
-		return -1;
+		  visited[i * 4 + 2] == cc &&
+		  visited[i * 4 + 3] == dp) {
+		free (visited);
+		t->state = t_stop;
+		t->dp = dp;
+		t->cc = cc;
+		return;
 	      }
 	    }
 
 	    visited = realloc(visited, 4 * (visited_len + 1) * sizeof(int));
 	    visited[i * 4 + 0] = a_x;
 	    visited[i * 4 + 1] = a_y;
-	    visited[i * 4 + 2] = p_codel_chooser;
-	    visited[i * 4 + 3] = p_dir_pointer;
+	    visited[i * 4 + 2] = cc;
+	    visited[i * 4 + 3] = dp;
 	    visited_len++;
 
 	    while (a_col == c_white) {
 	      dprintf ("deb: white cell passed to %d, %d (now col_idx %d)\n",
 		       a_x, a_y, a_col);
-	      a_x += dp_dx (p_dir_pointer);
-	      a_y += dp_dy (p_dir_pointer);
-	      a_col = get_cell (a_x, a_y);
+	      a_x += dp_dx (dp);
+	      a_y += dp_dy (dp);
+	      a_col = cell_at (ctx, a_x, a_y);
+	      t_look (t, a_x, a_y);
 	    }
 	  }
 	  if (visited) free(visited);
 	} else {
           white_crossed = 1;
           a_col = c_white;
-          a_x -= dp_dx (p_dir_pointer);
-          a_y -= dp_dy (p_dir_pointer);
+          a_x -= dp_dx (dp);
+          a_y -= dp_dy (dp);
           tprintf("trace: entering white block at %d,%d (like the perl "
                   "interpreter would)...\n", a_x, a_y);
         }
@@ -2396,101 +3956,253 @@ piet_step ()
        */
       if (c_col == c_white || in_white) {
 	// toggle dp and cc:
-	p_codel_chooser = toggle_cc(p_codel_chooser);
-	p_dir_pointer = turn_dp(p_dir_pointer);
+	cc = toggle_cc(cc);
+	dp = turn_dp(dp);
 	dprintf ("deb: in white codel - toggle both dp and cc\n");
-	dprintf ("deb: toggle cc to '%c'\n", p_codel_chooser);
-	dprintf ("deb: toggle dp to '%c'\n", p_dir_pointer);
+	dprintf ("deb: toggle cc to '%c'\n", cc);
+	dprintf ("deb: toggle dp to '%c'\n", dp);
       } else {
-	if ((p_toggle % 2) == 0) {
-	  p_codel_chooser = toggle_cc(p_codel_chooser);
-	  dprintf ("deb: toggle cc to '%c'\n", p_codel_chooser);
+	if ((ctx->p_toggle % 2) == 0) {
+	  cc = toggle_cc(cc);
+	  dprintf ("deb: toggle cc to '%c'\n", cc);
 	} else {
-	  p_dir_pointer = turn_dp(p_dir_pointer);
-	  dprintf ("deb: toggle dp to '%c'\n", p_dir_pointer);
+	  dp = turn_dp(dp);
+	  dprintf ("deb: toggle dp to '%c'\n", dp);
 	}
       }
-      p_toggle++;
+      ctx->p_toggle++;
 
     } else {
-      tprintf ("\ntrace: step %d  (%d,%d/%c,%c %s -> %d,%d/%c,%c %s):\n",
-	       exec_step, p_xpos, p_ypos, pre_dp, pre_cc,
-	       cell2str (get_cell (p_xpos, p_ypos)),
-	       a_x, a_y, p_dir_pointer, p_codel_chooser,
-	       cell2str (get_cell (a_x, a_y)));
-      notify_step( exec_step, p_xpos, p_ypos, pre_dp, pre_cc, c_col,
-                   a_x, a_y, p_dir_pointer, p_codel_chooser, a_col );
+      /* found a way: */
+      t->state = t_move;
+      t->n_x = n_x;
+      t->n_y = n_y;
+      t->a_x = a_x;
+      t->a_y = a_y;
+      t->dp = dp;
+      t->cc = cc;
+      t->a_col = a_col;
+      t->num_cells = num_cells;
+      t->white_crossed = white_crossed;
+      if (! white_crossed) {
+	t->hue_change = ((get_hue (a_col) - get_hue (c_col)) + n_hue) % n_hue;
+	t->light_change = ((get_light (a_col) - get_light (c_col)) 
+			   + n_light) % n_light;
+      }
+      return;
+    }
+  }
 
-      exec_step++;
+  /* tries exausted, no way to step on: */
+  t->state = t_stop;
+  t->dp = dp;
+  t->cc = cc;
+}
 
-      if (white_crossed) {
-	/* no command is executed - anything is fine: */
 
-	if (gd_trace_simple) {
-	  strcpy (msg, "no");
-	} else {
-	  strcpy (msg, "noop");
-	}
-	t2printf ("action: none\n");
+int 
+piet_ctx_step (struct piet_context *ctx)
+{
+  struct piet_transition live, *t;
+  int rc, pre_dp, pre_cc;
+  int pre_xpos, pre_ypos;
+  int c_col;
+  char msg [128];
 
-	rc = 0;
-      } else {
-	/* make a program step: */
-	rc = piet_action (c_col, a_col, num_cells, msg);
-      } 
-      
-      if (do_gdtrace 
-	  && exec_step >= gd_trace_start && exec_step <= gd_trace_end) {
-	/* graphical trace output: */	
-	gd_action (pre_xpos, pre_ypos, n_x, n_y, a_x, a_y, msg);
-      }
+  if (ctx->max_exec_step > 0 && ctx->exec_step >= ctx->max_exec_step) {
+    fprintf (stderr, "error: configured execution steps exceeded (%d steps)\n",
+	     ctx->exec_step);
+    ctx->exit_reason = piet_exit_steps;
+    return -1;
+  }
 
-      if (rc < 0) {
-	/* we had an error: */
-	return -1;
-      }
+  /* current cell col_idx: */
+  c_col = piet_ctx_get_cell (ctx, ctx->p_xpos, ctx->p_ypos);
 
-      t2printf ("step done: continuing at %d,%d...\n", a_x, a_y);
-      p_xpos = a_x;
-      p_ypos = a_y;
-      
-      return 0;
+  /* save for trace output: */
+  pre_xpos = ctx->p_xpos;
+  pre_ypos = ctx->p_ypos;
+  pre_dp = ctx->p_dir_pointer;
+  pre_cc = ctx->p_codel_chooser;
+
+  if (ctx->do_gdtrace) {
+    gd_try_init (ctx);
+  }
+
+  if (c_col == c_black) {
+    /* we are lost in a black hole: */
+    tprintf ("trace: special case: we started at a black cell - exiting...\n");
+    ctx->exit_reason = piet_exit_black;
+    return -1;
+  }
+
+  if (! ctx->blocks_valid) {
+    piet_ctx_label_blocks (ctx);
+  }
+
+  if (ctx->svg
+      && ctx->exec_step >= ctx->gd_trace_start 
+      && ctx->exec_step <= ctx->gd_trace_end) {
+    svg_try_init (ctx);
+  }
+  if (ctx->log) {
+    piet_log_begin_step (ctx->log, ctx);
+  }
+
+  /* (the simple svg trace shows no tries, the table will do) */
+  if (c_col != c_white && ! ctx->trace && ! ctx->debug 
+      && ! ctx->do_gdtrace && (! ctx->svg || ctx->gd_trace_simple)
+      && ! ctx->toggle_bug) {
+    /*
+     * leaving a color block depends on the block, dp and cc only;
+     * resolve it once and use the transition table from then on:
+     */
+    t = piet_transition (ctx, ctx->p_xpos, ctx->p_ypos, 
+			 ctx->p_dir_pointer, ctx->p_codel_chooser);
+  } else {
+    /* white codels, tracing and the dpbug mode take the long way: */
+    t = &live;
+    piet_resolve_step (ctx, ctx->p_xpos, ctx->p_ypos, 
+		       ctx->p_dir_pointer, ctx->p_codel_chooser, t);
+  }
+
+  ctx->p_dir_pointer = t->dp;
+  ctx->p_codel_chooser = t->cc;
+
+  if (t->state != t_move) {
+    /* tries exausted, no way to step on: */
+    ctx->exit_reason = piet_exit_end;
+    return -1;
+  }
+
+  tprintf ("\ntrace: step %d  (%d,%d/%c,%c %s -> %d,%d/%c,%c %s):\n",
+	   ctx->exec_step, ctx->p_xpos, ctx->p_ypos, pre_dp, pre_cc,
+	   cell2str (c_col),
+	   t->a_x, t->a_y, ctx->p_dir_pointer, ctx->p_codel_chooser,
+	   cell2str (t->a_col));
+  notify_step( ctx, ctx->exec_step, ctx->p_xpos, ctx->p_ypos, 
+	       pre_dp, pre_cc, c_col,
+	       t->a_x, t->a_y, ctx->p_dir_pointer, ctx->p_codel_chooser, t->a_col );
+
+  ctx->exec_step++;
+
+  if (t->white_crossed) {
+    /* no command is executed - anything is fine: */
+
+    if (ctx->gd_trace_simple) {
+      strcpy (msg, "no");
+    } else {
+      strcpy (msg, "noop");
     }
+    t2printf ("action: none\n");
+
+    rc = 0;
+  } else if (t == &live) {
+    /* make a program step: */
+    rc = piet_ctx_action (ctx, c_col, t->a_col, t->num_cells, msg);
+  } else {
+    /* make a program step, the command is known already: */
+    rc = piet_ctx_command (ctx, t->hue_change, t->light_change, 
+			   t->num_cells, msg);
+  } 
+  
+  if (ctx->do_gdtrace 
+      && ctx->exec_step >= ctx->gd_trace_start 
+      && ctx->exec_step <= ctx->gd_trace_end) {
+    /* graphical trace output: */	
+    gd_action (ctx, pre_xpos, pre_ypos, t->n_x, t->n_y, t->a_x, t->a_y, msg);
+  }
+  if (ctx->svg
+      && ctx->exec_step >= ctx->gd_trace_start 
+      && ctx->exec_step <= ctx->gd_trace_end) {
+    svg_action (ctx, pre_xpos, pre_ypos, t->n_x, t->n_y, t->a_x, t->a_y, msg);
+  }
+  if (ctx->log) {
+    /* after an error we stay where we are: */
+    piet_log_end_step (ctx->log, ctx, 
+		       ctx->block_map [pre_ypos * ctx->width + pre_xpos],
+		       t->white_crossed ? piet_log_noop 
+		       : t->hue_change * n_light + t->light_change,
+		       rc < 0 ? pre_xpos : t->a_x, rc < 0 ? pre_ypos : t->a_y);
   }
 
-  /* tries exausted, no way to step on: */
-  return -1;
+  if (rc < 0) {
+    /* we had an error: */
+    if (ctx->exit_reason == piet_exit_none) {
+      ctx->exit_reason = piet_exit_error;
+    }
+    return -1;
+  }
+
+  t2printf ("step done: continuing at %d,%d...\n", t->a_x, t->a_y);
+  ctx->p_xpos = t->a_x;
+  ctx->p_ypos = t->a_y;
+
+  if (ctx->num_break_codels > 0 || ctx->num_watches > 0) {
+    return piet_check_break (ctx, t->white_crossed ? -1 
+			     : t->hue_change * n_light + t->light_change);
+  }
+  
+  return 0;
 }
 
 
 
+/* set by do_signal on ^C; the run saves its traces and exits: */
+static volatile sig_atomic_t interrupted = 0;
+
+
 int 
-piet_run ()
+piet_ctx_run (struct piet_context *ctx)
 {
-  if (width <= 0 || height <= 0) {
+  if (ctx->width <= 0 || ctx->height <= 0) {
     fprintf (stderr, "nothing to execute...\n");
+    ctx->exit_reason = piet_exit_error;
     return -1;
   }
 
-  piet_init ();
+  piet_ctx_init (ctx);
+
+  return piet_ctx_continue (ctx);
+}
+
+
+int
+piet_ctx_continue (struct piet_context *ctx)
+{
+  int rc;
 
   while (1) {
 
+    if (interrupted) {
+      gd_save (ctx);
+      piet_ctx_svg_close (ctx);
+      piet_ctx_log_close (ctx);
+      exit (-6);
+    }
+
     t2printf ("trace:  pos=%d,%d dp=%c cc=%c\n",
-	      p_xpos, p_ypos, p_dir_pointer, p_codel_chooser);
+	      ctx->p_xpos, ctx->p_ypos, ctx->p_dir_pointer, ctx->p_codel_chooser);
 
-    if (piet_step () < 0) {
+    if ((rc = piet_ctx_step (ctx)) < 0) {
       vprintf ("\ninfo: program end\n");
+      vprintf ("info: stack peak was %d values at step %u "
+	       "(%d values allocated)\n",
+	       ctx->peak_stack, ctx->peak_stack_step, ctx->max_stack);
       break;
     }
+    if (rc == piet_step_break) {
+      vprintf ("info: break at step %u (%d,%d)\n", 
+	       ctx->exec_step, ctx->p_xpos, ctx->p_ypos);
+      return piet_step_break;
+    }
 
-    if (do_gdtrace && trace) {
+    if (ctx->do_gdtrace && ctx->trace) {
       /* 
-       * in case of additional tracing, make sure we always have
-       * an up-to-date picture; it's way expensive, so it may be
-       * get an extra option...
+       * in case of additional tracing, keep the picture on disk
+       * up-to-date (written in the background, see gd_update):
        */
-      gd_save ();
+      gd_update (ctx);
     }
   }
 
@@ -2697,13 +4409,13 @@ do_n_str_cmd (char *do_n_str)
 
 
 /*
- * save a trace picture on ^C too:
+ * save a trace picture on ^C too (not from here: saving locks and
+ * waits for the writer thread, piet_ctx_continue does it between steps):
  */
 void
 do_signal ()
 {
-  gd_save ();
-  exit (-6);
+  interrupted = 1;
 }
 
 
@@ -2713,52 +4425,284 @@ do_signal ()
 // int
 // main (int argc, char *argv[])
 // {
+//   struct piet_context *ctx = piet_context_default ();
 //   int rc;
 // 
-//   if (parse_args (argc, argv) < 0) {
+//   if (parse_args (ctx, argc, argv) < 0) {
 //     usage (-1);
 //   }
 // 
-//   if (do_n_str) {
-//     do_n_str_cmd (do_n_str);
+//   if (ctx->do_n_str) {
+//     do_n_str_cmd (ctx->do_n_str);
 //     exit (0);
 //   }
 // 
-//   if (! input_filename) {
+//   if (! ctx->input_filename) {
 //     usage (-1);
 //   }
 // 
-//   if (read_png (input_filename) < 0
-//       && read_gif (input_filename) < 0
-//       && read_ppm (input_filename) < 0) {
+//   if (piet_ctx_read_png (ctx, ctx->input_filename) < 0
+//       && piet_ctx_read_gif (ctx, ctx->input_filename) < 0
+//       && piet_ctx_read_ppm (ctx, ctx->input_filename) < 0) {
 //     exit (-2);
-//   } else if (codel_size != 1) {
-//     cleanup_input ();
+//   } else if (ctx->codel_size != 1 && piet_ctx_cleanup_input (ctx) < 0) {
+//     exit (-5);
 //   }
 //   
-//   if (debug) {
-//     dump_cells ();
+//   if (ctx->debug) {
+//     dump_cells (ctx);
 //   }
 //   
-//   if (do_gdtrace) {
-//     gd_init ();
+//   if (ctx->do_gdtrace) {
+//     gd_init (ctx);
 // 
 //     /* save a pic on ctrl-c: */
 //     signal (SIGINT, do_signal);
 //   }
 // 
-//   rc = piet_run ();
+//   if (ctx->do_svgtrace 
+//       && piet_ctx_svg_open (ctx, ctx->svg_trace_filename) == 0) {
+//     signal (SIGINT, do_signal);
+//   }
+// 
+//   if (ctx->do_log 
+//       && piet_ctx_log_open (ctx, ctx->log_filename) == 0) {
+//     signal (SIGINT, do_signal);
+//   }
+// 
+//   rc = piet_ctx_run (ctx);
 //   
-//   if (do_gdtrace) {
-//     gd_save ();
+//   if (ctx->do_gdtrace) {
+//     gd_save (ctx);
 //   }
+//   piet_ctx_svg_close (ctx);
+//   piet_ctx_log_close (ctx);
 //   
 //   return rc;
 // }
 
-int set_image(int w, int h)
+int
+piet_ctx_set_image (struct piet_context *ctx, int w, int h)
+{
+  alloc_cells (ctx, w, h);
+  return 0;
+}
+
+
+/*
+ * interpreter contexts:
+ */
+
+struct piet_context *
+piet_context_new ()
+{
+  struct piet_context *ctx;
+
+  if (! (ctx = (struct piet_context *) calloc (1, sizeof (*ctx)))) {
+    return 0;
+  }
+
+  /* unknown colors are treated as white: */
+  ctx->unknown_color = 1;
+
+  /* with gd2 lib linked we try to save trace output: */
+  ctx->gd_trace_filename = "npiet-trace.png";
+  ctx->gd_trace_start = 0;
+  ctx->gd_trace_end = 1 << 31;		/* lot's to print */
+
+  /* the svg trace goes along: */
+  ctx->svg_trace_filename = "npiet-trace.svg";
+  ctx->log_filename = "npiet-trace.log";
+
+  /* steps between the pictures saved while tracing: */
+  ctx->gd_save_interval = 1000;
+
+  /* pixelsize when painting graphical trace output: */
+  ctx->c_xy = 32;
+
+  /* codelsize of the input. -1 means, we try to guess it from the input: */
+  ctx->codel_size = -1;
+
+  /* trace codelsize threshold for pixel numbers, not tiny strings: */
+  ctx->pp_size = 49;
+
+  ctx->p_dir_pointer = p_right;
+  ctx->p_codel_chooser = p_left;
+
+  return ctx;
+}
+
+
+void
+piet_context_free (struct piet_context *ctx)
+{
+  if (! ctx) {
+    return;
+  }
+
+  gd_free (ctx);
+  piet_ctx_svg_close (ctx);
+  piet_ctx_log_close (ctx);
+
+  free (ctx->cells);
+  free (ctx->block_map);
+  free (ctx->blocks);
+  free (ctx->transitions);
+  free (ctx->free_blocks);
+  free (ctx->fill_stack);
+  free (ctx->resolved);
+  free (ctx->stack);
+  free (ctx->break_codels);
+  free (ctx->break_blocks);
+  free (ctx->watches);
+  free (ctx);
+}
+
+
+/*
+ * the one context behind the classic interface (not thread safe,
+ * like the globals it replaces):
+ */
+static struct piet_context *default_ctx = 0;
+
+struct piet_context *
+piet_context_default ()
+{
+  if (! default_ctx && ! (default_ctx = piet_context_new ())) {
+    fprintf (stderr, "out of memory: cannot allocate a context\n");
+    exit (-99);
+  }
+  return default_ctx;
+}
+
+
+int
+set_image (int w, int h)
+{
+  return piet_ctx_set_image (piet_context_default (), w, h);
+}
+
+int
+read_ppm (char *fname)
+{
+  return piet_ctx_read_ppm (piet_context_default (), fname);
+}
+
+int
+read_png (char *fname)
+{
+  return piet_ctx_read_png (piet_context_default (), fname);
+}
+
+void
+set_cell (int x, int y, int val)
+{
+  piet_ctx_set_cell (piet_context_default (), x, y, val);
+}
+
+int
+set_row (int y, const void *row, int format)
+{
+  return piet_ctx_set_row (piet_context_default (), y, row, format);
+}
+
+int
+get_cell (int x, int y)
+{
+  return piet_ctx_get_cell (piet_context_default (), x, y);
+}
+
+void
+cleanup_input ()
+{
+  if (piet_ctx_cleanup_input (piet_context_default ()) < 0) {
+    exit (-5);
+  }
+}
+
+void
+piet_label_blocks ()
+{
+  piet_ctx_label_blocks (piet_context_default ());
+}
+
+int
+piet_run ()
+{
+  return piet_ctx_run (piet_context_default ());
+}
+
+int
+piet_continue ()
+{
+  return piet_ctx_continue (piet_context_default ());
+}
+
+void
+piet_init ()
+{
+  piet_ctx_init (piet_context_default ());
+}
+
+int
+piet_step ()
+{
+  return piet_ctx_step (piet_context_default ());
+}
+
+void
+piet_get_state (struct piet_state *state)
+{
+  piet_ctx_get_state (piet_context_default (), state);
+}
+
+int
+piet_set_state (const struct piet_state *state)
+{
+  return piet_ctx_set_state (piet_context_default (), state);
+}
+
+void
+piet_set_breakpoint (int x, int y, int on)
+{
+  piet_ctx_set_breakpoint (piet_context_default (), x, y, on);
+}
+
+void
+piet_clear_breakpoints ()
+{
+  piet_ctx_clear_breakpoints (piet_context_default ());
+}
+
+int
+piet_add_watch (int kind, long value)
+{
+  return piet_ctx_add_watch (piet_context_default (), kind, value);
+}
+
+void
+piet_clear_watches ()
+{
+  piet_ctx_clear_watches (piet_context_default ());
+}
+
+int
+piet_walk_border (int *n_x, int *n_y, int *num_cells)
+{
+  return piet_ctx_walk_border (piet_context_default (), 
+			       n_x, n_y, num_cells);
+}
+
+int
+piet_action (int c_col, int a_col, int num_cells, char *msg)
+{
+  return piet_ctx_action (piet_context_default (), 
+			  c_col, a_col, num_cells, msg);
+}
+
+int
+piet_command (int hue_change, int light_change, int num_cells, char *msg)
 {
-    height = h;
-    width = w;
-    alloc_cells (width, height);
+  return piet_ctx_command (piet_context_default (), 
+			   hue_change, light_change, num_cells, msg);
 }
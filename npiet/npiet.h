@@ -41,17 +41,280 @@
 #define n_colors        (c_black + 1)
 /* internal used index for filling areas: */
 #define c_mark_index    9999
+/* a byte cell of piet_classify_row without a color: */
+#define c_unknown       0xff
 
+#include "npiet_utils.h"
+
+/* why the last step stopped the program (see piet_context): */
+#define piet_exit_none		0	/* still running */
+#define piet_exit_end		1	/* no way out of a block: the end */
+#define piet_exit_black		2	/* started on a black codel */
+#define piet_exit_steps		3	/* max_exec_step exceeded */
+#define piet_exit_error		4	/* nothing to execute or error */
+#define piet_exit_stack		5	/* stack_limit exceeded */
+
+/* piet_ctx_step: the step hit a breakpoint or a watchpoint (see below): */
+#define piet_step_break		1
+
+/* watchpoints: */
+#define piet_watch_depth	0	/* more than value values on the stack */
+#define piet_watch_top		1	/* value on top of the stack */
+#define piet_watch_command	2	/* command value made, as hue change
+					   * n_light + lightness change */
+
+struct piet_block;
+struct piet_transition;
+struct piet_gd;
+struct piet_svg;
+struct piet_watch;
+struct piet_log_writer;
+
+/*
+ * the complete state of one interpreter: options, picture, color
+ * blocks and execution state.
+ *
+ * every piet_ctx_* function works on its own context, so a host can
+ * run several programs at once (one context per thread). the plain
+ * functions below work on a default context, as npiet always did.
+ */
+struct piet_context {
+  /* options (see parse_args): */
+  int verbose;			/* be somewhat verbose */
+  int quiet;			/* suppress the prompt when doing input */
+  int trace;			/* show program execution information */
+  int debug;			/* print debugging stuff */
+  unsigned max_exec_step;	/* maximum number of steps (0: unlimited) */
+  int stack_limit;		/* maximum number of values (0: unlimited) */
+  int unknown_color;		/* unknown colors: white 1, black 0, error -1 */
+  int codel_size;		/* codelsize of the input (-1: guess) */
+  int toggle_bug;		/* wrong toggle of dp and cc (-dpbug) */
+  int version_11;		/* npiet v1.1 white crossing (-v11) */
+  char *input_filename;		/* filename to work for */
+  char *do_n_str;		/* fun-stuff: -n-str string to commands */
+
+  /* graphical trace output: */
+  int do_gdtrace;
+  const char *gd_trace_filename;
+  int gd_trace_simple;
+  unsigned gd_trace_start;
+  unsigned gd_trace_end;
+  unsigned gd_save_interval;	/* steps between saves while tracing */
+  int c_xy;			/* pixelsize of a codel in the trace */
+  int pp_size;			/* threshold for pixel numbers */
+  struct piet_gd *gd;
+  int do_svgtrace;		/* -tsvg: open the svg trace */
+  const char *svg_trace_filename;
+  struct piet_svg *svg;		/* open svg trace (piet_ctx_svg_open) */
+
+  /* binary execution log (see npiet_log.h): */
+  int do_log;			/* -tlog: open the log */
+  const char *log_filename;
+  struct piet_log_writer *log;	/* open log (piet_ctx_log_open) */
+
+  /* picture storage: */
+  unsigned char *cells;		/* a byte per codel, with a black border */
+  int width, height;
+
+  /* connected color blocks and transition table: */
+  int *block_map;
+  struct piet_block *blocks;
+  int num_blocks;
+  int max_blocks;		/* allocated blocks and transitions */
+  int blocks_valid;
+  struct piet_transition *transitions;
+  int *free_blocks;		/* numbers given up by edits */
+  int num_free_blocks;
+  int *fill_stack;		/* work space of the block fill */
+  int fill_stack_size;
+  int *resolved;		/* transitions resolved so far */
+  int num_resolved, max_resolved;
+
+  /* execution state: */
+  int p_dir_pointer;		/* DP: p_{left, right, up, down} */
+  int p_codel_chooser;		/* CC: p_left or p_right */
+  int p_xpos, p_ypos;		/* execution position */
+  int p_toggle;			/* toggle counter of the tries */
+  unsigned exec_step;		/* informal step counter */
+  int exit_reason;		/* piet_exit_* */
+
+  /* breakpoints and watchpoints (see piet_ctx_set_breakpoint): */
+  int *break_codels;		/* x, y of every breakpoint */
+  int num_break_codels, max_break_codels;
+  unsigned char *break_blocks;	/* a bit per block with a breakpoint */
+  int break_blocks_size;	/* in blocks */
+  int break_blocks_valid;	/* 0: the blocks changed, build again */
+  struct piet_watch *watches;
+  int num_watches, max_watches;
+  int break_watch;		/* watch of the last break, -1: breakpoint */
+
+  /* stack space for runtime action: */
+  long *stack;
+  int num_stack;		/* current number of values on stack */
+  int max_stack;		/* max size of stack allocated */
+  int peak_stack;		/* max number of values seen on stack */
+  unsigned peak_stack_step;	/* step that reached peak_stack */
+
+  /* callbacks (see npiet_utils.h): */
+  step_callback_t step_callback;
+  void *step_object;
+  action_callback_t action_callback;
+  void *action_object;
+  readint_callback_t readint_callback;
+  void *readint_object;
+  readchar_callback_t readchar_callback;
+  void *readchar_object;
+  output_callback_t output_callback;	/* 0: write to stdout */
+  void *output_object;
+
+  /* stack change handed to the action callback and the log: */
+  struct stack_delta delta;
+  int delta_num;		/* depth before the action */
+  long delta_top[2];		/* top two values before the action */
+};
+
+/*
+ * create a context with the default options; free it and all the
+ * memory it holds.
+ */
+struct piet_context *piet_context_new ();
+void piet_context_free (struct piet_context *ctx);
+
+/* the context used by the functions without a context argument: */
+struct piet_context *piet_context_default ();
+
+int parse_args (struct piet_context *ctx, int argc, char **argv);
+
+int piet_ctx_set_image (struct piet_context *ctx, int w, int h);
+int piet_ctx_read_ppm (struct piet_context *ctx, char *fname);
+int piet_ctx_read_png (struct piet_context *ctx, char *fname);
+int piet_ctx_read_gif (struct piet_context *ctx, char *fname);
+/*
+ * set a single codel. once the blocks are labeled (a program ran or
+ * stepped) only the blocks around the codel are relabeled, so a
+ * program can be edited while it is debugged.
+ */
+void piet_ctx_set_cell (struct piet_context *ctx, int x, int y, int val);
+int piet_ctx_get_cell (struct piet_context *ctx, int x, int y);
+
+/*
+ * pixel rows for piet_classify_row and piet_ctx_set_row:
+ */
+#define piet_row_rgb		0	/* 3 bytes per pixel: r, g, b */
+#define piet_row_argb32		1	/* 32 bit words 0xAARRGGBB, alpha
+					   is ignored (as in a QImage) */
+
+/*
+ * turn n pixels of a row into color indexes, c_unknown for an
+ * unknown color. return the number of unknown colors.
+ */
+int piet_classify_row (const void *row, int format, int n, 
+		       unsigned char *cells);
+
+/*
+ * set row y of the picture (set_image first) from width pixels.
+ * unknown colors are handled as by unknown_color; return -1 if
+ * they are an error.
+ */
+int piet_ctx_set_row (struct piet_context *ctx, int y, 
+		      const void *row, int format);
+int piet_ctx_cleanup_input (struct piet_context *ctx);
+void piet_ctx_label_blocks (struct piet_context *ctx);
+
+/*
+ * stream a trace of the steps as svg to filename, as long as it is
+ * open. gd_trace_start, gd_trace_end, gd_trace_simple and c_xy apply
+ * as for the trace picture, but only the blocks visited are painted.
+ * close it after the run to finish the file.
+ */
+int piet_ctx_svg_open (struct piet_context *ctx, const char *filename);
+void piet_ctx_svg_close (struct piet_context *ctx);
+
+/*
+ * append every step to a binary log (see npiet_log.h) as long as it
+ * is open. open it after the program is read; close it after the run
+ * to write the index. return -1 on errors.
+ */
+int piet_ctx_log_open (struct piet_context *ctx, const char *filename);
+int piet_ctx_log_close (struct piet_context *ctx);
+
+/* run from the start; return piet_step_break if it stopped at one: */
+int piet_ctx_run (struct piet_context *ctx);
+/* run on from where a break stopped it, as piet_ctx_run: */
+int piet_ctx_continue (struct piet_context *ctx);
+void piet_ctx_init (struct piet_context *ctx);
+int piet_ctx_step (struct piet_context *ctx);
+
+/*
+ * the state a program goes on from, as kept by the checkpoints of a
+ * debugger. the picture is not part of it.
+ */
+struct piet_state {
+  unsigned exec_step;
+  int x, y;
+  int dp, cc;			/* p_{left, right, up, down} */
+  int num_stack;
+  const long *stack;		/* bottom first */
+};
+
+/* the current state; the stack is ctx's own and changes with a step: */
+void piet_ctx_get_state (struct piet_context *ctx, struct piet_state *state);
+/* go on from state; return -1 if its stack does not fit: */
+int piet_ctx_set_state (struct piet_context *ctx, 
+			const struct piet_state *state);
+
+/*
+ * breakpoints and watchpoints are checked by piet_ctx_step itself,
+ * which returns piet_step_break after the step that stopped (and sets
+ * break_watch). a breakpoint on a codel stops the steps entering its
+ * block, also after the blocks changed. no step stops on white or
+ * black, so a breakpoint there only fires once the codel is colored.
+ * a watchpoint on the stack stops the step that makes it true,
+ * piet_watch_command every step making the command. piet_ctx_run
+ * stops at them as well.
+ */
+void piet_ctx_set_breakpoint (struct piet_context *ctx, int x, int y, int on);
+void piet_ctx_clear_breakpoints (struct piet_context *ctx);
+/* add a piet_watch_* watchpoint; return its number, -1 on errors: */
+int piet_ctx_add_watch (struct piet_context *ctx, int kind, long value);
+void piet_ctx_clear_watches (struct piet_context *ctx);
+
+int piet_ctx_walk_border (struct piet_context *ctx, 
+			  int *n_x, int *n_y, int *num_cells);
+int piet_ctx_action (struct piet_context *ctx, 
+		     int c_col, int a_col, int num_cells, char *msg);
+int piet_ctx_command (struct piet_context *ctx, 
+		      int hue_change, int light_change, int num_cells, 
+		      char *msg);
+
+/*
+ * the classic interface, working on piet_context_default():
+ */
 int set_image( int w, int h );
 int read_ppm (char *fname);
 int read_png (char *fname);
 int get_color_idx (int col);
 void set_cell (int x, int y, int val);
+int get_cell (int x, int y);
+int set_row (int y, const void *row, int format);
 void cleanup_input ();
 
+/*
+ * label the connected color blocks of the picture. called from
+ * piet_init() and whenever the cells changed since the last run.
+ */
+void piet_label_blocks ();
+
 int piet_run();
+int piet_continue();
 void piet_init();
 int piet_step();
+void piet_get_state (struct piet_state *state);
+int piet_set_state (const struct piet_state *state);
+void piet_set_breakpoint (int x, int y, int on);
+void piet_clear_breakpoints ();
+int piet_add_watch (int kind, long value);
+void piet_clear_watches ();
 
 /*
  * walk along the border of a given colorblock looking about the
@@ -79,4 +342,10 @@ int piet_walk_border (int *n_x, int *n_y, int *num_cells);
 
 int piet_action (int c_col, int a_col, int num_cells, char *msg);
 
+/*
+ * like piet_action, but with the hue and lightness change already
+ * computed (as found in the transition table).
+ */
+int piet_command (int hue_change, int light_change, int num_cells, char *msg);
+
 #endif /*NPIET_H*/
\ No newline at end of file
@@ -0,0 +1,750 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+#include "npiet_log.h"
+#include "npiet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+# include "config.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char *command_names [18] = {
+  "noop", "push", "pop",
+  "add", "sub", "mul",
+  "div", "mod", "not",
+  "gt", "dp", "cc",
+  "dup", "roll", "inN",
+  "inC", "outN", "outC"
+};
+
+
+const char *
+piet_log_command_name (int command)
+{
+  if (command >= 0 && command < 18) {
+    return command_names [command];
+  }
+  return "none";
+}
+
+
+int
+piet_log_command_by_name (const char *name)
+{
+  int i;
+
+  for (i = 0; i < 18; i++) {
+    if (! strcmp (name, command_names [i])) {
+      return i;
+    }
+  }
+  return strcmp (name, "none") ? -1 : piet_log_noop;
+}
+
+
+/*
+ * values are zigzag varints: small numbers of both signs take a byte.
+ */
+struct log_buf {
+  unsigned char *data;
+  size_t len, max;
+};
+
+static void
+buf_put (struct log_buf *b, long val)
+{
+  uint64_t v = ((uint64_t) val << 1) ^ (uint64_t) (val < 0 ? -1 : 0);
+
+  /* room for the value and the padding: */
+  if (b->len + 16 > b->max) {
+    b->max = b->max ? 2 * b->max : 4096;
+    if (! (b->data = (unsigned char *) realloc (b->data, b->max))) {
+      fprintf (stderr, "out of memory: cannot log %lu bytes\n",
+	       (unsigned long) b->max);
+      exit (-99);
+    }
+  }
+  while (v >= 0x80) {
+    b->data [b->len++] = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  b->data [b->len++] = (unsigned char) v;
+}
+
+static void
+buf_pad (struct log_buf *b)
+{
+  while (b->len & 3) {
+    b->data [b->len++] = 0;
+  }
+}
+
+static long
+get_value (const unsigned char **p)
+{
+  uint64_t v = 0;
+  int shift = 0;
+
+  do {
+    v |= (uint64_t) (**p & 0x7f) << shift;
+    shift += 7;
+  } while (*(*p)++ & 0x80 && shift < 64);
+
+  return (long) ((v >> 1) ^ (uint64_t) -(int64_t) (v & 1));
+}
+
+
+/*
+ * writing:
+ */
+struct piet_log_writer {
+  FILE *out;
+  const char *filename;
+  uint64_t offset;		/* of the next chunk */
+  uint64_t *index;		/* chunk offsets */
+  unsigned num_chunks, max_chunks;
+  uint64_t since_copy;		/* bytes written since the last stack copy */
+  int error;
+
+  /* the chunk filled: */
+  int open;
+  struct piet_log_chunk chunk;
+  struct log_buf stack;
+  struct log_buf values;
+  struct piet_log_record records [piet_log_chunk_steps];
+};
+
+
+static void
+log_write (struct piet_log_writer *w, const void *data, size_t len)
+{
+  if (len > 0 && fwrite (data, len, 1, w->out) != 1 && ! w->error) {
+    fprintf (stderr, "cannot write %s; reason: %s\n", w->filename,
+	     strerror (errno));
+    w->error = 1;
+  }
+  w->offset += len;
+}
+
+
+static void
+log_flush (struct piet_log_writer *w)
+{
+  struct piet_log_chunk *c = &w->chunk;
+  uint64_t start = w->offset;
+
+  if (! w->open) {
+    return;
+  }
+  w->open = 0;
+  if (c->num_records == 0) {
+    return;
+  }
+
+  if (w->num_chunks >= w->max_chunks) {
+    w->max_chunks = w->max_chunks ? 2 * w->max_chunks : 256;
+    w->index = (uint64_t *) realloc (w->index,
+				     w->max_chunks * sizeof (uint64_t));
+    if (! w->index) {
+      fprintf (stderr, "out of memory: cannot log %u chunks\n",
+	       w->max_chunks);
+      exit (-99);
+    }
+  }
+  w->index [w->num_chunks++] = start;
+
+  buf_pad (&w->values);
+  c->values_size = w->values.len;
+
+  log_write (w, c, sizeof (*c));
+  log_write (w, w->stack.data, c->stack_size);
+  log_write (w, w->records, c->num_records * sizeof (struct piet_log_record));
+  log_write (w, w->values.data, c->values_size);
+
+  w->since_copy += w->offset - start - c->stack_size;
+}
+
+
+struct piet_log_writer *
+piet_log_writer_new (struct piet_context *ctx, const char *filename)
+{
+  struct piet_log_writer *w;
+  struct piet_log_header h;
+
+  if (ctx->width > 0xffff || ctx->height > 0xffff) {
+    fprintf (stderr, "cannot log a program of %d * %d codels\n",
+	     ctx->width, ctx->height);
+    return 0;
+  }
+  if (! (w = (struct piet_log_writer *) calloc (1, sizeof (*w)))) {
+    fprintf (stderr, "out of memory: cannot log to %s\n", filename);
+    return 0;
+  }
+  if (! (w->out = fopen (filename, "wb"))) {
+    fprintf (stderr, "cannot open %s for writing; reason: %s\n",
+	     filename, strerror (errno));
+    free (w);
+    return 0;
+  }
+  w->filename = filename;
+  setvbuf (w->out, 0, _IOFBF, 256 * 1024);
+
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, piet_log_magic, sizeof (h.magic));
+  h.version = piet_log_version;
+  h.record_size = sizeof (struct piet_log_record);
+  h.width = ctx->width;
+  h.height = ctx->height;
+  log_write (w, &h, sizeof (h));
+
+  return w;
+}
+
+
+void
+piet_log_begin_step (struct piet_log_writer *w, struct piet_context *ctx)
+{
+  struct piet_log_chunk *c = &w->chunk;
+  int i;
+
+  if (w->open) {
+    return;
+  }
+
+  /* a new chunk starts with the state before its first step: */
+  w->open = 1;
+  memset (c, 0, sizeof (*c));
+  c->first_step = ctx->exec_step;
+  c->num_stack = ctx->num_stack;
+  c->x = ctx->p_xpos;
+  c->y = ctx->p_ypos;
+  c->dp = ctx->p_dir_pointer;
+  c->cc = ctx->p_codel_chooser;
+  w->values.len = 0;
+
+  /* a stack copy, if the log since the last one is worth it: */
+  w->stack.len = 0;
+  if (w->num_chunks == 0
+      || w->since_copy >= (uint64_t) ctx->num_stack * sizeof (long)) {
+    for (i = 0; i < ctx->num_stack; i++) {
+      buf_put (&w->stack, ctx->stack [i]);
+    }
+    /* an empty stack copy takes a byte, so there is no doubt: */
+    if (w->stack.len == 0) {
+      buf_put (&w->stack, 0);
+    }
+    buf_pad (&w->stack);
+    c->stack_size = w->stack.len;
+    w->since_copy = 0;
+  }
+}
+
+
+void
+piet_log_end_step (struct piet_log_writer *w, struct piet_context *ctx,
+		   int block, int command, int x, int y)
+{
+  struct piet_log_chunk *c = &w->chunk;
+  struct piet_log_record *r = &w->records [c->num_records++];
+  const struct stack_delta *d = &ctx->delta;
+  int i;
+
+  r->block = block;
+  r->x = x;
+  r->y = y;
+  r->dp = ctx->p_dir_pointer;
+  r->cc = ctx->p_codel_chooser;
+  r->command = command;
+  r->values = w->values.len;
+  r->delta = 0;
+
+  if (command != piet_log_noop) {
+    r->delta = d->popped | d->pushed << 2 | (d->roll_depth > 0) << 4;
+    if (d->roll_depth > 0) {
+      buf_put (&w->values, d->roll_depth);
+      buf_put (&w->values, d->roll_count);
+    }
+    for (i = 0; i < d->pushed; i++) {
+      buf_put (&w->values, d->values [i]);
+    }
+  }
+
+  if (c->num_records == piet_log_chunk_steps) {
+    log_flush (w);
+  }
+}
+
+
+int
+piet_log_writer_free (struct piet_log_writer *w)
+{
+  struct piet_log_footer f;
+  int rc;
+
+  if (! w) {
+    return 0;
+  }
+
+  log_flush (w);
+
+  memset (&f, 0, sizeof (f));
+  f.index_offset = w->offset;
+  f.num_chunks = w->num_chunks;
+  memcpy (f.magic, piet_log_magic, sizeof (f.magic));
+  log_write (w, w->index, w->num_chunks * sizeof (uint64_t));
+  log_write (w, &f, sizeof (f));
+
+  if (fclose (w->out) != 0 && ! w->error) {
+    fprintf (stderr, "cannot write %s; reason: %s\n", w->filename,
+	     strerror (errno));
+    w->error = 1;
+  }
+  rc = w->error ? -1 : 0;
+
+  free (w->index);
+  free (w->stack.data);
+  free (w->values.data);
+  free (w);
+  return rc;
+}
+
+
+int
+piet_ctx_log_open (struct piet_context *ctx, const char *filename)
+{
+  piet_ctx_log_close (ctx);
+  return (ctx->log = piet_log_writer_new (ctx, filename)) ? 0 : -1;
+}
+
+
+int
+piet_ctx_log_close (struct piet_context *ctx)
+{
+  int rc = piet_log_writer_free (ctx->log);
+
+  ctx->log = 0;
+  return rc;
+}
+
+
+/*
+ * reading:
+ */
+struct piet_log {
+  const unsigned char *data;
+  size_t size;
+  int mapped;
+  struct piet_log_header header;
+  uint64_t *chunks;		/* chunk offsets */
+  unsigned num_chunks;
+  long *stack;			/* of piet_log_get_state */
+  int max_stack;
+};
+
+
+/*
+ * chunk i; set the pointers to its parts:
+ */
+static void
+log_chunk (struct piet_log *log, unsigned i, struct piet_log_chunk *c,
+	   const unsigned char **stack, const unsigned char **records,
+	   const unsigned char **values)
+{
+  const unsigned char *p = log->data + log->chunks [i];
+
+  memcpy (c, p, sizeof (*c));
+  *stack = p + sizeof (*c);
+  *records = *stack + c->stack_size;
+  *values = *records + c->num_records * sizeof (struct piet_log_record);
+}
+
+
+/*
+ * the chunk offsets from the index or, if the log was not closed, from
+ * walking the complete chunks:
+ */
+static int
+log_find_chunks (struct piet_log *log)
+{
+  struct piet_log_footer f;
+  struct piet_log_chunk c;
+  uint64_t off = sizeof (struct piet_log_header);
+  unsigned max = 0, next_step = 0;
+
+  if (log->size >= off + sizeof (f)) {
+    memcpy (&f, log->data + log->size - sizeof (f), sizeof (f));
+    if (! memcmp (f.magic, piet_log_magic, sizeof (f.magic))
+	&& f.index_offset + (uint64_t) f.num_chunks * sizeof (uint64_t)
+	   + sizeof (f) == log->size) {
+      log->num_chunks = f.num_chunks;
+      log->chunks = (uint64_t *) malloc ((f.num_chunks + 1)
+					 * sizeof (uint64_t));
+      if (! log->chunks) {
+	return -1;
+      }
+      memcpy (log->chunks, log->data + f.index_offset,
+	      f.num_chunks * sizeof (uint64_t));
+      return 0;
+    }
+  }
+
+  while (off + sizeof (c) <= log->size) {
+    uint64_t len;
+
+    memcpy (&c, log->data + off, sizeof (c));
+    len = sizeof (c) + c.stack_size + c.values_size
+      + (uint64_t) c.num_records * sizeof (struct piet_log_record);
+    if (c.num_records == 0 || c.num_records > piet_log_chunk_steps
+	|| (log->num_chunks > 0 && c.first_step != next_step)
+	|| off + len > log->size) {
+      break;
+    }
+    if (log->num_chunks >= max) {
+      max = max ? 2 * max : 256;
+      if (! (log->chunks = (uint64_t *) realloc (log->chunks,
+						 max * sizeof (uint64_t)))) {
+	return -1;
+      }
+    }
+    log->chunks [log->num_chunks++] = off;
+    next_step = c.first_step + c.num_records;
+    off += len;
+  }
+  return 0;
+}
+
+
+struct piet_log *
+piet_log_open (const char *filename)
+{
+  struct piet_log *log;
+  FILE *in;
+  long size;
+
+  if (! (log = (struct piet_log *) calloc (1, sizeof (*log)))) {
+    return 0;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  {
+    struct stat st;
+    int fd = open (filename, O_RDONLY);
+    void *p;
+
+    if (fd >= 0 && fstat (fd, &st) == 0 && st.st_size > 0
+	&& (p = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+	   != MAP_FAILED) {
+      log->data = (const unsigned char *) p;
+      log->size = st.st_size;
+      log->mapped = 1;
+    }
+    if (fd >= 0) {
+      close (fd);
+    }
+  }
+#endif
+
+  if (! log->mapped) {
+    unsigned char *data;
+
+    /* read it as a whole: */
+    if (! (in = fopen (filename, "rb"))) {
+      fprintf (stderr, "cannot open %s; reason: %s\n", filename,
+	       strerror (errno));
+      free (log);
+      return 0;
+    }
+    fseek (in, 0, SEEK_END);
+    size = ftell (in);
+    rewind (in);
+    if (size < 0 || ! (data = (unsigned char *) malloc (size + 1))
+	|| fread (data, 1, size, in) != (size_t) size) {
+      fprintf (stderr, "cannot read %s\n", filename);
+      fclose (in);
+      free (log);
+      return 0;
+    }
+    fclose (in);
+    log->data = data;
+    log->size = size;
+  }
+
+  if (log->size < sizeof (log->header)) {
+    fprintf (stderr, "%s is no npiet log\n", filename);
+    piet_log_close (log);
+    return 0;
+  }
+  memcpy (&log->header, log->data, sizeof (log->header));
+  if (memcmp (log->header.magic, piet_log_magic, sizeof (log->header.magic))
+      || log->header.version != piet_log_version
+      || log->header.record_size != sizeof (struct piet_log_record)) {
+    fprintf (stderr, "%s is no npiet log (or written on another machine)\n",
+	     filename);
+    piet_log_close (log);
+    return 0;
+  }
+
+  if (log_find_chunks (log) < 0) {
+    fprintf (stderr, "out of memory: cannot index %s\n", filename);
+    piet_log_close (log);
+    return 0;
+  }
+
+  return log;
+}
+
+
+void
+piet_log_close (struct piet_log *log)
+{
+  if (! log) {
+    return;
+  }
+#ifdef HAVE_SYS_MMAN_H
+  if (log->mapped) {
+    munmap ((void *) log->data, log->size);
+  } else
+#endif
+  free ((void *) log->data);
+  free (log->chunks);
+  free (log->stack);
+  free (log);
+}
+
+
+int
+piet_log_width (struct piet_log *log)
+{
+  return log->header.width;
+}
+
+
+int
+piet_log_height (struct piet_log *log)
+{
+  return log->header.height;
+}
+
+
+unsigned
+piet_log_first_step (struct piet_log *log)
+{
+  struct piet_log_chunk c;
+
+  if (log->num_chunks == 0) {
+    return 0;
+  }
+  memcpy (&c, log->data + log->chunks [0], sizeof (c));
+  return c.first_step;
+}
+
+
+unsigned
+piet_log_num_steps (struct piet_log *log)
+{
+  struct piet_log_chunk c;
+
+  if (log->num_chunks == 0) {
+    return 0;
+  }
+  memcpy (&c, log->data + log->chunks [log->num_chunks - 1], sizeof (c));
+  return c.first_step + c.num_records - piet_log_first_step (log);
+}
+
+
+/*
+ * the chunk holding step n, -1 if none:
+ */
+static int
+log_find_step (struct piet_log *log, unsigned n)
+{
+  struct piet_log_chunk c;
+  int lo = 0, hi = log->num_chunks - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    memcpy (&c, log->data + log->chunks [mid], sizeof (c));
+    if (n < c.first_step) {
+      hi = mid - 1;
+    } else if (n - c.first_step >= c.num_records) {
+      lo = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+  return -1;
+}
+
+
+static void
+log_decode (const struct piet_log_chunk *c, const unsigned char *records,
+	    const unsigned char *values, unsigned k, struct piet_log_step *s)
+{
+  struct piet_log_record r;
+  const unsigned char *p;
+  int i;
+
+  memcpy (&r, records + k * sizeof (r), sizeof (r));
+  p = values + r.values;
+
+  s->step = c->first_step + k;
+  s->x = r.x;
+  s->y = r.y;
+  s->dp = r.dp;
+  s->cc = r.cc;
+  s->block = r.block;
+  s->command = r.command;
+  s->popped = r.delta & 3;
+  s->pushed = (r.delta >> 2) & 3;
+  s->roll_depth = s->roll_count = 0;
+  if (r.delta & 0x10) {
+    s->roll_depth = get_value (&p);
+    s->roll_count = get_value (&p);
+  }
+  for (i = 0; i < s->pushed; i++) {
+    s->values [i] = get_value (&p);
+  }
+}
+
+
+int
+piet_log_get (struct piet_log *log, unsigned n, struct piet_log_step *s)
+{
+  struct piet_log_chunk c;
+  const unsigned char *stack, *records, *values;
+  int i = log_find_step (log, n);
+
+  if (i < 0) {
+    return -1;
+  }
+  log_chunk (log, i, &c, &stack, &records, &values);
+  log_decode (&c, records, values, n - c.first_step, s);
+  return 0;
+}
+
+
+static void
+reverse_values (long *vals, int n)
+{
+  int i;
+
+  for (i = 0; i < n / 2; i++) {
+    long v = vals [i];
+    vals [i] = vals [n - 1 - i];
+    vals [n - 1 - i] = v;
+  }
+}
+
+
+int
+piet_log_get_state (struct piet_log *log, unsigned n,
+		    struct piet_log_state *state)
+{
+  struct piet_log_chunk c;
+  struct piet_log_step s;
+  const unsigned char *stack, *records, *values;
+  int i, j, num;
+  unsigned k;
+
+  if (n == ~0u) {
+    /* before the first step: the first chunk always has a stack copy */
+    if (log->num_chunks == 0) {
+      return -1;
+    }
+    i = -1;
+  } else if ((i = log_find_step (log, n)) < 0) {
+    return -1;
+  }
+
+  /* back to the last stack copy: */
+  for (j = i < 0 ? 0 : i; j > 0; j--) {
+    memcpy (&c, log->data + log->chunks [j], sizeof (c));
+    if (c.stack_size > 0) {
+      break;
+    }
+  }
+
+  log_chunk (log, j, &c, &stack, &records, &values);
+  num = c.num_stack;
+  if (num > log->max_stack) {
+    log->max_stack = num + 1024;
+    log->stack = (long *) realloc (log->stack, log->max_stack * sizeof (long));
+    if (! log->stack) {
+      fprintf (stderr, "out of memory: cannot rebuild %d values\n", num);
+      exit (-99);
+    }
+  }
+  for (k = 0; k < c.num_stack; k++) {
+    log->stack [k] = get_value (&stack);
+  }
+  state->x = c.x;
+  state->y = c.y;
+  state->dp = c.dp;
+  state->cc = c.cc;
+
+  /* and replay the steps from there: */
+  for (; j <= i; j++) {
+    log_chunk (log, j, &c, &stack, &records, &values);
+    for (k = 0; k < c.num_records && c.first_step + k <= n; k++) {
+      log_decode (&c, records, values, k, &s);
+
+      num -= s.popped;
+      if (s.roll_depth > 0 && s.roll_depth <= num) {
+	long *base = log->stack + num - s.roll_depth;
+
+	/* rotate up, as the roll command does: */
+	reverse_values (base, s.roll_depth);
+	reverse_values (base, s.roll_count);
+	reverse_values (base + s.roll_count, s.roll_depth - s.roll_count);
+      }
+      if (num + s.pushed > log->max_stack) {
+	log->max_stack = 2 * log->max_stack + 1024;
+	log->stack = (long *) realloc (log->stack,
+				       log->max_stack * sizeof (long));
+	if (! log->stack) {
+	  fprintf (stderr, "out of memory: cannot rebuild %d values\n", num);
+	  exit (-99);
+	}
+      }
+      memcpy (log->stack + num, s.values, s.pushed * sizeof (long));
+      num += s.pushed;
+
+      state->x = s.x;
+      state->y = s.y;
+      state->dp = s.dp;
+      state->cc = s.cc;
+    }
+  }
+
+  state->step = n;
+  state->num_stack = num;
+  state->stack = log->stack;
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+#ifndef NPIET_LOG_H
+#define NPIET_LOG_H
+
+#include <stdint.h>
+
+/*
+ * binary execution log:
+ *
+ * the steps of a run are appended to the log in chunks of up to
+ * piet_log_chunk_steps fixed size records, so step n is found without
+ * reading the steps before. the values a step pushes (and the roll it
+ * did) follow the records of a chunk, zigzag varint coded. now and then
+ * a chunk starts with a copy of the whole stack, never more often than
+ * the log written since the last copy pays for it, so the state after
+ * any step is rebuilt from the nearest copy on.
+ *
+ *   header | chunk | chunk | ... | index | footer
+ *
+ * the index of the chunk offsets is written when the log is closed;
+ * without it (the run was killed) the reader walks the chunks. all
+ * numbers are in the byte order of the machine that wrote the log.
+ */
+
+#define piet_log_magic		"NPIETLOG"
+#define piet_log_version	1
+#define piet_log_chunk_steps	4096
+
+/* the command of a record, the hue * 3 + lightness change otherwise: */
+#define piet_log_noop		0xff	/* white crossed: no command */
+
+struct piet_log_header {
+  char magic [8];
+  uint32_t version;
+  uint32_t record_size;		/* sizeof (struct piet_log_record) */
+  uint32_t width, height;	/* of the program */
+  uint32_t unused [2];
+};
+
+struct piet_log_chunk {
+  uint32_t first_step;		/* step of the first record */
+  uint32_t num_records;
+  uint32_t values_size;		/* bytes of values after the records */
+  uint32_t num_stack;		/* stack depth before the first step */
+  uint32_t stack_size;		/* bytes of the stack copy, 0: none */
+  uint16_t x, y;		/* position before the first step */
+  uint8_t dp, cc;		/* dp and cc before the first step */
+  uint8_t unused [2];
+  /* then: stack copy, records, values */
+};
+
+struct piet_log_record {
+  uint32_t block;		/* block left */
+  uint16_t x, y;		/* position after the step */
+  uint8_t dp, cc;		/* dp and cc after the step */
+  uint8_t command;		/* hue * 3 + lightness change */
+  uint8_t delta;		/* popped | pushed << 2 | rolled << 4 */
+  uint32_t values;		/* offset of its values in the chunk */
+};
+
+struct piet_log_footer {
+  uint64_t index_offset;	/* an uint64_t offset per chunk */
+  uint32_t num_chunks;
+  char magic [8];
+};
+
+
+/*
+ * writing a log (see piet_ctx_log_open):
+ */
+struct piet_context;
+struct piet_log_writer;
+
+struct piet_log_writer *piet_log_writer_new (struct piet_context *ctx,
+					     const char *filename);
+/* before and after a step of ctx (the step changed pos, dp, cc): */
+void piet_log_begin_step (struct piet_log_writer *w, struct piet_context *ctx);
+void piet_log_end_step (struct piet_log_writer *w, struct piet_context *ctx,
+			int block, int command, int x, int y);
+/* write the rest, the index and close the file; -1 on write errors: */
+int piet_log_writer_free (struct piet_log_writer *w);
+
+
+/*
+ * reading a log:
+ */
+struct piet_log;
+
+/* a step as recorded: */
+struct piet_log_step {
+  unsigned step;
+  int x, y, dp, cc;		/* after the step */
+  int block;			/* block left */
+  int command;			/* hue * 3 + lightness, or piet_log_noop */
+  int popped, pushed;
+  int roll_depth, roll_count;	/* 0: no roll */
+  long values [3];		/* pushed */
+};
+
+/* the state after a step (before the first one for step ~0u): */
+struct piet_log_state {
+  unsigned step;
+  int x, y, dp, cc;
+  int num_stack;
+  long *stack;			/* belongs to the log, valid until the next
+				   call of piet_log_get_state */
+};
+
+struct piet_log *piet_log_open (const char *filename);
+void piet_log_close (struct piet_log *log);
+
+int piet_log_width (struct piet_log *log);
+int piet_log_height (struct piet_log *log);
+/* steps first_step .. first_step + num_steps - 1 are in the log: */
+unsigned piet_log_first_step (struct piet_log *log);
+unsigned piet_log_num_steps (struct piet_log *log);
+
+/* step n; return -1 if it is not in the log: */
+int piet_log_get (struct piet_log *log, unsigned n, struct piet_log_step *s);
+
+/*
+ * position, dp, cc and stack after step n, replayed from the nearest
+ * stack copy before; return -1 if n is not in the log.
+ */
+int piet_log_get_state (struct piet_log *log, unsigned n,
+			struct piet_log_state *state);
+
+/* "push", "pop", ... for a command of a record: */
+const char *piet_log_command_name (int command);
+/* the command for a name, -1 if there is none: */
+int piet_log_command_by_name (const char *name);
+
+#endif /* NPIET_LOG_H */
@@ -17,125 +17,170 @@ Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA.
 */
 #include "npiet_utils.h"
+#include "npiet.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void* step_object = 0;
-step_callback_t step_callback = 0;
 
-void* action_object = 0;
-action_callback_t action_callback = 0;
+void notify_step( struct piet_context *ctx, int step, int px, int py, int pdp, int pcc, int pcol,
+                  int nx, int ny, int ndp, int ncc, int ncol )
+{
+    if( ctx->step_callback ) {
+        struct trace_step s;
 
-void* readint_object = 0;
-readint_callback_t readint_callback = 0;
+        s.execution_step = step;
 
-void* readchar_object = 0;
-readchar_callback_t readchar_callback = 0;
+        s.p_xpos = px;
+        s.p_ypos = py;
+        s.p_dp = pdp;
+        s.p_cc = pcc;
+        s.p_color = pcol;
 
-long *before_stack = 0;
-long *after_stack = 0;
-int before_num = 0;
-int after_num = 0;
+        s.n_xpos = nx;
+        s.n_ypos = ny;
+        s.n_dp = ndp;
+        s.n_cc = ncc;
+        s.n_color = ncol;
 
+        ctx->step_callback( ctx->step_object, &s );
+    }
+}
 
-void notify_step( int step, int px, int py, int pdp, int pcc, int pcol,
-                  int nx, int ny, int ndp, int ncc, int ncol )
+void notify_action( struct piet_context *ctx, int hue_change, int light_change, int value, char* msg )
 {
-    if( step_callback ) {
-        struct trace_step *s;
-        s = malloc( sizeof( struct trace_step ) );
-
-        s->execution_step = step;
+    if( ctx->action_callback ) {
+        struct trace_action a;
 
-        s->p_xpos = px;
-        s->p_ypos = py;
-        s->p_dp = pdp;
-        s->p_cc = pcc;
-        s->p_color = pcol;
+        a.hue_change = hue_change;
+        a.light_change = light_change;
+        a.value = value;
+        a.msg = msg;
 
-        s->n_xpos = nx;
-        s->n_ypos = ny;
-        s->n_dp = ndp;
-        s->n_cc = ncc;
-        s->n_color = ncol;
+        a.num_stack = ctx->num_stack;
+        a.delta = ctx->delta;
 
-        step_callback(step_object, s );
+        ctx->action_callback( ctx->action_object, &a );
     }
 }
 
-void notify_action( int hue_change, int light_change, int value, char* msg )
+void notify_stack_before( struct piet_context *ctx, long int* stack, int num_stack )
 {
-    if( step_callback ) {
-        struct trace_action *a;
-        a = malloc( sizeof( struct trace_action ) );
-
-        a->hue_change = hue_change;
-        a->light_change = light_change;
-        a->value = value;
-        a->msg = strdup( msg );
-
-        a->after_stack = after_stack;
-        a->after_num = after_num;
+    if( !ctx->action_callback && !ctx->log )
+        return;
+    ctx->delta_num = num_stack;
+    if( num_stack > 1 )
+        ctx->delta_top[0] = stack[num_stack - 2];
+    if( num_stack > 0 )
+        ctx->delta_top[1] = stack[num_stack - 1];
+    ctx->delta.roll_depth = 0;
+    ctx->delta.roll_count = 0;
+}
 
-        a->before_stack = before_stack;
-        a->before_num = before_num;
+void notify_stack_roll( struct piet_context *ctx, int depth, int count )
+{
+    if( !ctx->action_callback && !ctx->log )
+        return;
+    ctx->delta.roll_depth = depth;
+    ctx->delta.roll_count = count;
+}
 
-        action_callback(action_object, a );
-    }
+/*
+ * everything below the old top two values is untouched (the roll aside),
+ * so the delta starts there, above any value that did not change:
+ */
+void notify_stack_after( struct piet_context *ctx, long int* stack, int num_stack )
+{
+    int before = ctx->delta_num;
+    int base = before - 2 < num_stack ? before - 2 : num_stack;
+    int i;
+
+    if( !ctx->action_callback && !ctx->log )
+        return;
+    if( base < 0 )
+        base = 0;
+    while( base < before && base < num_stack
+           && stack[base] == ctx->delta_top[base - ( before - 2 )] )
+        base++;
+
+    ctx->delta.popped = before - base;
+    ctx->delta.pushed = num_stack - base;
+    for( i = 0; i < ctx->delta.pushed; i++ )
+        ctx->delta.values[i] = stack[base + i];
 }
 
-void notify_stack_before(long int* stack, int num_stack)
+void piet_ctx_register_step_callback( struct piet_context *ctx, step_callback_t callable, void* obj )
 {
-	int i;
-    before_stack = malloc( sizeof( long ) * num_stack );
-    before_num = num_stack;
-    for ( i = 0; i < num_stack; i++ ) {
-        before_stack[i] = stack[i];
-    }
+    ctx->step_object = obj;
+    ctx->step_callback = callable;
 }
 
-void notify_stack_after(long int* stack, int num_stack)
+void piet_ctx_register_action_callback( struct piet_context *ctx, action_callback_t callable, void* obj )
 {
-	int i;
-    after_stack = malloc( sizeof( long ) * num_stack );
-    after_num = num_stack;
-    for ( i = 0; i < num_stack; i++ ) {
-        after_stack[i] = stack[i];
-    }
+    ctx->action_object = obj;
+    ctx->action_callback = callable;
 }
 
 void register_step_callback( step_callback_t callable, void* obj )
 {
-    step_object = obj;
-    step_callback = callable;
+    piet_ctx_register_step_callback( piet_context_default(), callable, obj );
 }
 
 void register_action_callback( action_callback_t callable, void* obj )
 {
-    action_object = obj;
-    action_callback = callable;
+    piet_ctx_register_action_callback( piet_context_default(), callable, obj );
 }
 
-int read_int()
+int read_int( struct piet_context *ctx )
 {
-    return readint_callback( readint_object );
+    return ctx->readint_callback( ctx->readint_object );
 }
 
-char read_char()
+char read_char( struct piet_context *ctx )
 {
-    return readchar_callback( readchar_object );
+    return ctx->readchar_callback( ctx->readchar_object );
+}
+
+void piet_ctx_register_readchar_callback( struct piet_context *ctx, readchar_callback_t callable, void* obj )
+{
+    ctx->readchar_object = obj;
+    ctx->readchar_callback = callable;
+}
+
+void piet_ctx_register_readint_callback( struct piet_context *ctx, readint_callback_t callable, void* obj )
+{
+    ctx->readint_object = obj;
+    ctx->readint_callback = callable;
 }
 
 void register_readchar_callback( readchar_callback_t callable, void* obj )
 {
-    readchar_object = obj;
-    readchar_callback = callable;
+    piet_ctx_register_readchar_callback( piet_context_default(), callable, obj );
 }
 
 void register_readint_callback( readint_callback_t callable, void* obj )
 {
-    readint_object = obj;
-    readint_callback = callable;
+    piet_ctx_register_readint_callback( piet_context_default(), callable, obj );
 }
 
+void write_output( struct piet_context *ctx, const char* str, int len )
+{
+    if( ctx->output_callback ) {
+        ctx->output_callback( ctx->output_object, str, len );
+    } else {
+        fwrite( str, 1, len, stdout );
+        fflush( stdout );
+    }
+}
+
+void piet_ctx_register_output_callback( struct piet_context *ctx, output_callback_t callable, void* obj )
+{
+    ctx->output_object = obj;
+    ctx->output_callback = callable;
+}
+
+void register_output_callback( output_callback_t callable, void* obj )
+{
+    piet_ctx_register_output_callback( piet_context_default(), callable, obj );
+}
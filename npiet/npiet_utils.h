@@ -16,7 +16,10 @@ along with this library; see the file COPYING.LIB.  If not, write to the
 Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA.
 */
+#ifndef NPIET_UTILS_H
+#define NPIET_UTILS_H
 
+struct piet_context;
 
 struct trace_step {
     int execution_step; /**< step number */
@@ -30,16 +33,25 @@ struct trace_step {
     int n_color; /**< color of cell at n_xpos, n_ypos */
 };
 
+/**
+* how an action changed the stack, applied in this order:
+* pop `popped` values, rotate the top roll_depth values up by
+* roll_count (like the roll command), push values[0..pushed-1].
+*/
+struct stack_delta {
+    int popped;
+    int roll_depth, roll_count;
+    int pushed;
+    long values[3];
+};
+
 struct trace_action {
     int hue_change;
     int light_change;
     int value;
 
-    int before_num;
-    long *before_stack;
-
-    int after_num;
-    long* after_stack;
+    int num_stack; /**< stack depth after the action */
+    struct stack_delta delta;
 
     char* msg;
 };
@@ -54,26 +66,62 @@ struct trace_action {
 * ndp/ncc - next dp/cc
 * ncol    - next color
 */
-void notify_step( int step, int px, int py, int pdp, int pcc, int pcol,
+void notify_step( struct piet_context *ctx, int step, int px, int py, int pdp, int pcc, int pcol,
                   int nx, int ny, int ndp, int ncc, int ncol );
 
-void notify_action( int hue_change, int light_change, int value, char* msg );
+void notify_action( struct piet_context *ctx, int hue_change, int light_change, int value, char* msg );
 
-void notify_stack_before( long* stack, int num_stack );
-void notify_stack_after( long* stack, int num_stack );
+/**
+* an action changes at most the top two values and pushes one more,
+* besides the rotation of roll, which it reports with notify_stack_roll.
+*/
+void notify_stack_before( struct piet_context *ctx, long* stack, int num_stack );
+void notify_stack_roll( struct piet_context *ctx, int depth, int count );
+void notify_stack_after( struct piet_context *ctx, long* stack, int num_stack );
 
+/**
+* the trace_step and trace_action (with its stacks and msg) handed to
+* the callbacks belong to npiet and are only valid during the call;
+* copy what you need to keep.
+*/
 typedef void (*step_callback_t)( void* object, struct trace_step* );
 typedef void (*action_callback_t)( void* object, struct trace_action* );
 
+/* register with the default context (see piet_context_default): */
 void register_step_callback( step_callback_t callable, void* obj );
 void register_action_callback( action_callback_t callable, void* obj );
 
+void piet_ctx_register_step_callback( struct piet_context *ctx,
+                                      step_callback_t callable, void* obj );
+void piet_ctx_register_action_callback( struct piet_context *ctx,
+                                        action_callback_t callable, void* obj );
 
-int read_int();
-char read_char();
+
+int read_int( struct piet_context *ctx );
+char read_char( struct piet_context *ctx );
 
 typedef int (*readint_callback_t)( void* object );
 typedef char (*readchar_callback_t)( void* object );
 
 void register_readint_callback( readint_callback_t callable, void* obj );
 void register_readchar_callback( readchar_callback_t callable, void* obj );
+
+void piet_ctx_register_readint_callback( struct piet_context *ctx,
+                                         readint_callback_t callable, void* obj );
+void piet_ctx_register_readchar_callback( struct piet_context *ctx,
+                                          readchar_callback_t callable, void* obj );
+
+/**
+* program output (out(number), out(char)); without a callback
+* it goes to stdout.
+*/
+void write_output( struct piet_context *ctx, const char* str, int len );
+
+typedef void (*output_callback_t)( void* object, const char* str, int len );
+
+void register_output_callback( output_callback_t callable, void* obj );
+
+void piet_ctx_register_output_callback( struct piet_context *ctx,
+                                        output_callback_t callable, void* obj );
+
+#endif /* NPIET_UTILS_H */
@@ -3,10 +3,13 @@
 extern "C"
 {
 #include "../npiet.h"
+#include "../npiet_log.h"
 }
 
 #include <QtTest/QTest>
 #include <QImage>
+#include <QDir>
+#include <QFile>
 #include <QDebug>
 
 void NPietTest::initTestCase()
@@ -38,6 +41,205 @@ void NPietTest::simpleTest()
     qDebug() << "result:" << piet_run();
 }
 
+static void push( piet_context *ctx, int val )
+{
+    char msg[128];
+    piet_ctx_command( ctx, 0, 1, val, msg );
+}
+
+static void roll( piet_context *ctx, int depth, int count )
+{
+    char msg[128];
+    push( ctx, depth );
+    push( ctx, count );
+    piet_ctx_command( ctx, 4, 1, 0, msg );
+}
+
+// light red, light red, red: push 2, then back with a pop, forever
+static piet_context* pushPopProgram()
+{
+    piet_context *ctx = piet_context_new();
+    ctx->quiet = 1;
+    piet_ctx_set_image( ctx, 3, 1 );
+    piet_ctx_set_cell( ctx, 0, 0, 0 );
+    piet_ctx_set_cell( ctx, 1, 0, 0 );
+    piet_ctx_set_cell( ctx, 2, 0, 6 );
+    return ctx;
+}
+
+void NPietTest::rollTest()
+{
+    piet_context *ctx = piet_context_new();
+    ctx->quiet = 1;
+    for( int i = 1; i <= 5; ++i )
+      push( ctx, i );
+
+    // 1 2 3 4 5 -> 1 2 5 3 4
+    roll( ctx, 3, 1 );
+    QCOMPARE( ctx->num_stack, 5 );
+    QCOMPARE( ctx->stack[2], 5L );
+    QCOMPARE( ctx->stack[3], 3L );
+    QCOMPARE( ctx->stack[4], 4L );
+
+    // a full turn and a negative roll undo it
+    roll( ctx, 3, 3000001 );
+    roll( ctx, 3, -1 );
+    QCOMPARE( ctx->stack[2], 5L );
+    QCOMPARE( ctx->stack[3], 3L );
+    QCOMPARE( ctx->stack[4], 4L );
+
+    // depth 0 leaves the stack alone
+    roll( ctx, 0, 1 );
+    QCOMPARE( ctx->num_stack, 5 );
+    QCOMPARE( ctx->stack[4], 4L );
+
+    piet_context_free( ctx );
+}
+
+void NPietTest::editTest()
+{
+    // the step pushes the size of the block left
+    piet_context *ctx = pushPopProgram();
+    piet_ctx_init( ctx );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( ctx->stack[0], 2L );
+
+    // shrink the block, the blocks stay labeled and the step must see it
+    piet_ctx_set_cell( ctx, 1, 0, 6 );
+    piet_ctx_init( ctx );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( ctx->num_stack, 1 );
+    QCOMPARE( ctx->stack[0], 1L );
+
+    piet_context_free( ctx );
+}
+
+void NPietTest::stateTest()
+{
+    piet_context *ctx = pushPopProgram();
+    piet_ctx_init( ctx );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+
+    // keep the state after the push
+    piet_state state;
+    piet_ctx_get_state( ctx, &state );
+    QCOMPARE( state.exec_step, 1u );
+    QCOMPARE( state.x, 2 );
+    QCOMPARE( state.num_stack, 1 );
+    long stack = state.stack[0];
+    state.stack = &stack;
+
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( ctx->num_stack, 0 );
+
+    // back to after the push, the pop is made again
+    QCOMPARE( piet_ctx_set_state( ctx, &state ), 0 );
+    QCOMPARE( ctx->exec_step, 1u );
+    QCOMPARE( ctx->p_xpos, 2 );
+    QCOMPARE( ctx->num_stack, 1 );
+    QCOMPARE( ctx->stack[0], 2L );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( ctx->num_stack, 0 );
+    QCOMPARE( ctx->p_xpos, 1 );
+
+    piet_context_free( ctx );
+}
+
+void NPietTest::breakTest()
+{
+    piet_context *ctx = pushPopProgram();
+    ctx->max_exec_step = 100;
+
+    piet_ctx_set_breakpoint( ctx, 2, 0, 1 );
+    QCOMPARE( piet_ctx_run( ctx ), piet_step_break );
+    QCOMPARE( ctx->exec_step, 1u );
+    QCOMPARE( ctx->break_watch, -1 );
+    QCOMPARE( piet_ctx_continue( ctx ), piet_step_break );
+    QCOMPARE( ctx->exec_step, 3u );
+
+    // the breakpoint stays on its codel when the blocks change
+    piet_ctx_set_breakpoint( ctx, 2, 0, 0 );
+    piet_ctx_set_breakpoint( ctx, 0, 0, 1 );
+    piet_ctx_set_cell( ctx, 1, 0, 6 );
+    QCOMPARE( piet_ctx_continue( ctx ), piet_step_break );
+    QCOMPARE( ctx->p_xpos, 0 );
+    piet_ctx_clear_breakpoints( ctx );
+
+    // the next pop, then the stack growing again
+    QCOMPARE( piet_ctx_add_watch( ctx, piet_watch_command, 2 ), 0 );
+    QCOMPARE( piet_ctx_continue( ctx ), piet_step_break );
+    QCOMPARE( ctx->break_watch, 0 );
+    QCOMPARE( ctx->num_stack, 0 );
+    piet_ctx_clear_watches( ctx );
+    QCOMPARE( piet_ctx_add_watch( ctx, piet_watch_depth, 0 ), 0 );
+    QCOMPARE( piet_ctx_continue( ctx ), piet_step_break );
+    QCOMPARE( ctx->num_stack, 1 );
+
+    piet_context_free( ctx );
+}
+
+void NPietTest::logTest()
+{
+    QByteArray name = QFile::encodeName( QDir::temp().filePath( "npiettest.log" ) );
+    piet_context *ctx = pushPopProgram();
+    piet_ctx_init( ctx );
+    QCOMPARE( piet_ctx_log_open( ctx, name.data() ), 0 );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( piet_ctx_step( ctx ), 0 );
+    QCOMPARE( piet_ctx_log_close( ctx ), 0 );
+    piet_context_free( ctx );
+
+    piet_log *log = piet_log_open( name.data() );
+    QVERIFY( log );
+    QCOMPARE( piet_log_num_steps( log ), 2u );
+
+    piet_log_step step;
+    QCOMPARE( piet_log_get( log, 0, &step ), 0 );
+    QCOMPARE( QString( piet_log_command_name( step.command ) ), QString( "push" ) );
+    QCOMPARE( step.x, 2 );
+    QCOMPARE( step.pushed, 1 );
+    QCOMPARE( step.values[0], 2L );
+
+    piet_log_state state;
+    QCOMPARE( piet_log_get_state( log, ~0u, &state ), 0 );
+    QCOMPARE( state.x, 0 );
+    QCOMPARE( state.num_stack, 0 );
+    QCOMPARE( piet_log_get_state( log, 0, &state ), 0 );
+    QCOMPARE( state.num_stack, 1 );
+    QCOMPARE( state.stack[0], 2L );
+    QCOMPARE( piet_log_get_state( log, 1, &state ), 0 );
+    QCOMPARE( state.num_stack, 0 );
+    QCOMPARE( piet_log_get_state( log, 2, &state ), -1 );
+
+    piet_log_close( log );
+    QFile::remove( QString::fromLocal8Bit( name ) );
+}
+
+void NPietTest::rollBenchmark_data()
+{
+    QTest::addColumn<int>( "count" );
+    QTest::newRow( "1" ) << 1;
+    QTest::newRow( "1000" ) << 1000;
+    QTest::newRow( "1000000" ) << 1000000;
+    QTest::newRow( "-1000000" ) << -1000000;
+}
+
+void NPietTest::rollBenchmark()
+{
+    QFETCH( int, count );
+    piet_context *ctx = piet_context_new();
+    ctx->quiet = 1;
+    for( int i = 0; i < 1000; ++i )
+      push( ctx, i );
+
+    // the cost should not depend on the count
+    QBENCHMARK {
+      roll( ctx, 999, count );
+    }
+    QCOMPARE( ctx->num_stack, 1000 );
+    piet_context_free( ctx );
+}
+
 QTEST_MAIN( NPietTest )
 
 #include "NPietTest.moc"
\ No newline at end of file
@@ -8,6 +8,13 @@ class NPietTest : public QObject
 private slots:
   void initTestCase();
   void simpleTest();
+  void rollTest();
+  void rollBenchmark_data();
+  void rollBenchmark();
+  void editTest();
+  void stateTest();
+  void breakTest();
+  void logTest();
 };
 
 #endif
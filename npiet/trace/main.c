@@ -0,0 +1,199 @@
+/*
+    Copyright (C) 2010 Casey Link <unnamedrambler@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+/*
+ * npiet-trace: look into a binary execution log (see npiet_log.h)
+ * without running the program again.
+ */
+
+#include "../npiet_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void
+usage (int rc)
+{
+  fprintf (stderr, "use: npiet-trace <log> [<command>]\n");
+  fprintf (stderr, "commands:\n");
+  fprintf (stderr, "\tinfo              - program size and steps "
+	   "(default)\n");
+  fprintf (stderr, "\tshow <n> [<k>]    - the k steps from step n on "
+	   "(default: 1)\n");
+  fprintf (stderr, "\tfind [<options>]  - the steps matching all options:\n");
+  fprintf (stderr, "\t  -c <command>    - push, pop, add, ..., outC, "
+	   "none (white crossed)\n");
+  fprintf (stderr, "\t  -r <x0,y0,x1,y1> - ending in this codel region\n");
+  fprintf (stderr, "\t  -b <block>      - leaving this block\n");
+  fprintf (stderr, "\t  -s <n> -e <n>   - from and to step n\n");
+  fprintf (stderr, "\t  -m <n>          - at most n steps\n");
+  fprintf (stderr, "\tstate <n>         - position, dp, cc and stack "
+	   "after step n\n");
+  exit (rc);
+}
+
+
+static void
+print_step (const struct piet_log_step *s)
+{
+  int i;
+
+  printf ("%u\t%d,%d\t%c/%c\tblock %d\t%s", s->step, s->x, s->y,
+	  s->dp, s->cc, s->block, piet_log_command_name (s->command));
+  if (s->popped > 0) {
+    printf ("\t-%d", s->popped);
+  }
+  if (s->roll_depth > 0) {
+    printf ("\troll %d,%d", s->roll_depth, s->roll_count);
+  }
+  for (i = 0; i < s->pushed; i++) {
+    printf ("\t+%ld", s->values [i]);
+  }
+  printf ("\n");
+}
+
+
+static int
+show (struct piet_log *log, unsigned n, unsigned k)
+{
+  struct piet_log_step s;
+
+  for (; k > 0; k--, n++) {
+    if (piet_log_get (log, n, &s) < 0) {
+      break;
+    }
+    print_step (&s);
+  }
+  return 0;
+}
+
+
+static int
+find (struct piet_log *log, int argc, char **argv)
+{
+  struct piet_log_step s;
+  unsigned from = piet_log_first_step (log);
+  unsigned to = from + piet_log_num_steps (log) - 1;
+  unsigned max = ~0u, found = 0, n;
+  int command = -1, block = -1, region = 0;
+  int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+  if (piet_log_num_steps (log) == 0) {
+    return 0;
+  }
+
+  for (; argc > 1; argc -= 2, argv += 2) {
+    if (! strcmp (argv [0], "-c")) {
+      if ((command = piet_log_command_by_name (argv [1])) < 0) {
+	fprintf (stderr, "unknown command %s\n", argv [1]);
+	return -1;
+      }
+    } else if (! strcmp (argv [0], "-r")) {
+      if (sscanf (argv [1], "%d,%d,%d,%d", &x0, &y0, &x1, &y1) != 4) {
+	usage (-1);
+      }
+      region = 1;
+    } else if (! strcmp (argv [0], "-b")) {
+      block = atoi (argv [1]);
+    } else if (! strcmp (argv [0], "-s")) {
+      from = strtoul (argv [1], 0, 10);
+    } else if (! strcmp (argv [0], "-e")) {
+      to = strtoul (argv [1], 0, 10);
+    } else if (! strcmp (argv [0], "-m")) {
+      max = strtoul (argv [1], 0, 10);
+    } else {
+      usage (-1);
+    }
+  }
+  if (argc > 0) {
+    usage (-1);
+  }
+
+  for (n = from; n <= to && found < max; n++) {
+    if (piet_log_get (log, n, &s) < 0) {
+      break;
+    }
+    if ((command < 0 || s.command == command)
+	&& (block < 0 || s.block == block)
+	&& (! region || (s.x >= x0 && s.x <= x1 && s.y >= y0 && s.y <= y1))) {
+      print_step (&s);
+      found++;
+    }
+    if (n == ~0u) {
+      break;
+    }
+  }
+  return 0;
+}
+
+
+static int
+state (struct piet_log *log, unsigned n)
+{
+  struct piet_log_state st;
+  int i;
+
+  if (piet_log_get_state (log, n, &st) < 0) {
+    fprintf (stderr, "step %u is not in the log\n", n);
+    return -1;
+  }
+  printf ("step %u: %d,%d %c/%c, %d values:", st.step, st.x, st.y,
+	  st.dp, st.cc, st.num_stack);
+  for (i = 0; i < st.num_stack; i++) {
+    printf (" %ld", st.stack [i]);
+  }
+  printf ("\n");
+  return 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct piet_log *log;
+  const char *cmd = argc > 2 ? argv [2] : "info";
+  int rc = 0;
+
+  if (argc < 2) {
+    usage (-1);
+  }
+  if (! (log = piet_log_open (argv [1]))) {
+    return 2;
+  }
+
+  if (! strcmp (cmd, "info")) {
+    printf ("program: %d * %d codels\n", piet_log_width (log),
+	    piet_log_height (log));
+    printf ("steps: %u from step %u on\n", piet_log_num_steps (log),
+	    piet_log_first_step (log));
+  } else if (! strcmp (cmd, "show") && argc > 3) {
+    rc = show (log, strtoul (argv [3], 0, 10),
+	       argc > 4 ? strtoul (argv [4], 0, 10) : 1);
+  } else if (! strcmp (cmd, "find")) {
+    rc = find (log, argc - 3, argv + 3);
+  } else if (! strcmp (cmd, "state") && argc > 3) {
+    rc = state (log, strtoul (argv [3], 0, 10));
+  } else {
+    usage (-1);
+  }
+
+  piet_log_close (log);
+  return rc < 0 ? 1 : 0;
+}